@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdarg.h>
 #include <stddef.h>
 
 // Definir tipos para 64-bit
@@ -41,11 +42,181 @@ typedef unsigned long long uint64_t;
 #define VGA_LIGHT_YELLOW 14
 #define VGA_WHITE 15
 
-// Endereço base da memória VGA (64-bit)
+// Escapes de cor para vga_puts/kprintf: ESC seguido de um dígito hexa com a
+// cor do texto (fundo preto). Ex.: kprintf(KC_LIGHT_CYAN "OS: %s\n", os)
+#define KC_ESCAPE '\033'
+#define KC_BLACK "\0330"
+#define KC_BLUE "\0331"
+#define KC_GREEN "\0332"
+#define KC_CYAN "\0333"
+#define KC_RED "\0334"
+#define KC_MAGENTA "\0335"
+#define KC_BROWN "\0336"
+#define KC_LIGHT_GREY "\0337"
+#define KC_DARK_GREY "\0338"
+#define KC_LIGHT_BLUE "\0339"
+#define KC_LIGHT_GREEN "\033A"
+#define KC_LIGHT_CYAN "\033B"
+#define KC_LIGHT_RED "\033C"
+#define KC_LIGHT_MAGENTA "\033D"
+#define KC_LIGHT_BROWN "\033E"
+#define KC_LIGHT_YELLOW "\033E"
+#define KC_WHITE "\033F"
+
+// Buffer de formatação do kprintf (na pilha)
+#define KPRINTF_BUFFER 512
+
+// Endereço base da memória VGA (64-bit), pelo mapa da metade alta
 #define VGA_BASE 0xFFFFFFFF800B8000ULL
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 
+// Memória de texto completa: 32 KB em 0xB8000 (16384 células, 204 linhas)
+#define VGA_MEM_CELLS 16384
+#define VGA_MEM_ROWS (VGA_MEM_CELLS / VGA_WIDTH)
+
+// Registradores do CRTC usados para rolar a tela por hardware
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CRTC_START_HIGH 0x0C
+#define VGA_CRTC_START_LOW 0x0D
+
+// Porta serial COM1 (UART 16550)
+#define COM1_PORT 0x3F8
+#define SERIAL_THR 0                // Transmit Holding Register (escrita)
+#define SERIAL_IER 1                // Interrupt Enable Register
+#define SERIAL_IIR 2                // Interrupt Identification (leitura)
+#define SERIAL_FCR 2                // FIFO Control (escrita)
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_IER_THRI 0x02        // Interrupção de THR vazio
+#define SERIAL_LSR_THRE 0x20        // THR (e FIFO de TX) vazio
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_BUFFER 4096       // Anel de transmissão (potência de 2)
+#define SERIAL_IRQ 4
+
+#define EFLAGS_IF 0x200
+
+// Controladores de interrupção 8259 (PIC)
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define IRQ_BASE 0x20               // IRQ 0-15 remapeadas para os vetores 0x20-0x2F
+
+// PIT 8253/8254: o canal 0 roda em one-shot (modo 0) e só interrompe no
+// próximo prazo
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define PIT_ONESHOT_CH0 0x30        // Canal 0, byte baixo e alto, modo 0
+#define PIT_LATCH_CH0 0x00          // Congela o contador do canal 0 para leitura
+#define PIT_IRQ 0
+#define PIT_MAX_COUNT 60000         // Maior one-shot (~50 ms); a folga até 0xFFFF detecta a volta
+#define PIT_MAX_NS 50285706ULL      // PIT_MAX_COUNT em ns
+#define PIT_NS_MULT 54925401ULL     // 2^16 * 10^9 / 1193182 Hz
+#define PIT_TICKS_MULT 5124678ULL   // 2^32 * 1193182 / 10^9
+#define SLEEP_SPIN_NS (1u << TIMER_TICK_SHIFT)  // Esperas de menos de um tick da roda são em laço
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_ONESHOT_CH2 0xB0        // Canal 2, byte baixo e alto, modo 0
+#define PIT_GATE_PORT 0x61          // Bit 0: gate do canal 2, 1: alto-falante, 5: OUT2
+
+// Roda de timers hierárquica por CPU: o tick é 2^20 ns (~1,05 ms), o nível
+// 1 tem 256 slots de um tick e os 4 de cima 64 slots cada, cobrindo 2^32 ticks
+#define TIMER_TICK_SHIFT 20
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+#define TIMER_LOOKAHEAD 64          // Ticks olhados para o próximo prazo (> um one-shot)
+#define NR_CPUS 1
+
+// Softirqs: trabalho das IRQs adiado para a saída delas, com IF ligado
+#define SOFTIRQ_TIMER 0
+#define SOFTIRQ_COUNT 1
+
+// Calibração do TSC: melhor de 3 janelas de 10 ms do canal 2 do PIT
+#define TSC_CALIBRATE_COUNT 11932
+#define TSC_CALIBRATE_ROUNDS 3
+#define CPUID_EDX_TSC 0x10          // Folha 1: a CPU tem TSC
+#define CPUID_EDX_INVARIANT_TSC 0x100   // Folha 0x80000007: TSC com taxa constante
+
+// Seletores da GDT do kernel (a TSS ocupa duas entradas)
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS 0x18
+#define GDT_ENTRIES 5
+
+// Stubs de interrupção: 32 exceções + 16 IRQs
+#define IDT_STUBS 48
+
+// Pilha própria (IST1 da TSS) para o double fault
+#define IST_DOUBLE_FAULT 1
+
+// Multiboot: o que o GRUB deixa em EAX e EBX
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY 0x01      // mem_lower/mem_upper válidos
+#define MULTIBOOT_INFO_MMAP 0x40        // mmap_addr/mmap_length válidos
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define LOW_MEMORY 0x100000             // mem_upper conta a partir de 1 MB
+
+// Nó de lista duplamente ligada e circular (a cabeça é um nó sem dono)
+typedef struct ListNode {
+    struct ListNode* next;
+    struct ListNode* prev;
+} ListNode;
+
+// Timer de um disparo. Fica na lista de um slot da roda, então inserir e
+// cancelar são O(1).
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer* t);
+struct Timer {
+    ListNode entry;                     // Primeiro campo: o nó é o próprio timer
+    uint32_t expires;                   // Tick da roda em que vence
+    TimerCallback callback;             // Chamado no softirq de timers
+    struct TimerWheel* wheel;           // Roda onde foi posto
+    volatile int pending;               // 1 enquanto está na roda
+};
+
+// Roda de timers de uma CPU
+typedef struct TimerWheel {
+    uint32_t clock;                     // Próximo tick a processar
+    uint32_t count;                     // Timers na roda
+    uint32_t next_tick;                 // Tick para o qual o PIT foi armado
+    ListNode tv1[TVR_SIZE];
+    ListNode tvn[TVN_LEVELS][TVN_SIZE];
+} TimerWheel;
+
+typedef void (*SoftirqHandler)();
+
+// Informações que o GRUB passa em EBX (até o mapa de memória); os
+// endereços são físicos e abaixo de 4 GB, no mapa identidade
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;                 // KB abaixo de 1 MB
+    uint32_t mem_upper;                 // KB acima de 1 MB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) MultibootInfo;
+
+// Entrada do mapa de memória; 'size' não conta o próprio campo
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) MultibootMmapEntry;
+
 // Estrutura para informações do sistema (64-bit)
 typedef struct {
     char hostname[32];
@@ -57,15 +228,1103 @@ typedef struct {
 } SystemInfo;
 
 // Variáveis globais
-static uint16_t* vga_buffer = (uint16_t*)VGA_BASE;
+static volatile uint16_t* vga_buffer = (volatile uint16_t*)VGA_BASE;
 static uint8_t vga_color = VGA_LIGHT_GREY | (VGA_BLACK << 4);
 static size_t vga_x = 0;
 static size_t vga_y = 0;
 
+// Cópia em RAM dos 32 KB de texto; só as faixas sujas das linhas visíveis
+// vão para a VGA. A tela é uma janela de 25 linhas a partir de vga_origin.
+static uint16_t vga_shadow[VGA_MEM_CELLS];
+static size_t vga_origin = 0;           // Linha da memória no topo da tela
+static size_t vga_hw_origin = 0;        // Última origem programada no CRTC
+static uint8_t vga_dirty_start[VGA_HEIGHT];
+static uint8_t vga_dirty_end[VGA_HEIGHT];
+static uint32_t vga_dirty_rows = 0;     // Um bit por linha suja
+static int vga_batch_depth = 0;         // > 0 adia o flush do '\n'
+
+// Relógio: ticks do PIT fechados até o one-shot atual e as rodas de timers
+static uint64_t pit_ticks = 0;
+static uint32_t pit_programmed = 0;     // Contagem do one-shot atual
+static TimerWheel timer_wheels[NR_CPUS];
+
+// Softirqs pendentes (um bit cada) e seus handlers
+static volatile uint32_t softirq_pending = 0;
+static SoftirqHandler softirq_handlers[SOFTIRQ_COUNT];
+static int softirq_active = 0;          // 1 enquanto softirq_run roda
+
+// Clocksource: com TSC invariante, ns = tsc_base_ns + (TSC - tsc_base) * tsc_mult >> tsc_shift
+static uint64_t tsc_base = 0;           // TSC no instante tsc_base_ns
+static uint64_t tsc_base_ns = 0;
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 32;
+static uint32_t tsc_khz = 0;            // 0 = sem TSC
+static int tsc_invariant = 0;           // CPUID diz que a taxa é constante
+static int tsc_clocksource = 0;         // 1 = ktime_ns lê o TSC
+
+// Anel de transmissão da serial: o código escreve em head e a IRQ de THR
+// vazio consome de tail, 16 bytes (uma FIFO cheia) por interrupção
+static char serial_tx[SERIAL_TX_BUFFER];
+static volatile uint32_t serial_tx_head = 0;
+static volatile uint32_t serial_tx_tail = 0;
+static uint8_t serial_ier = 0;          // Cópia do IER (evita ler a porta)
+static int serial_fifo_size = 1;        // 16 se a FIFO do 16550 existir
+static int serial_present = 0;
+
+// RAM utilizável segundo o mapa de memória do multiboot
+static uint64_t ram_bytes = 0;
+
+// Função para ler byte de uma porta
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Função para escrever byte em uma porta
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Função para ler o contador de ciclos da CPU
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Função para executar CPUID (subfolha 0)
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+// Multiplica 64 por 32 bits e desloca 'shift' (1-32) usando só produtos
+// de 32x32, sem estourar no meio e sem libgcc
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint64_t lo = (uint64_t)(uint32_t)a * mul;
+    uint64_t hi = (uint64_t)(uint32_t)(a >> 32) * mul;
+    return (lo >> shift) + (hi << (32 - shift));
+}
+
+// Pequena pausa para o PIC (escreve na porta de diagnóstico 0x80)
+static inline void io_wait() {
+    outb(0x80, 0);
+}
+
+// Descritor de segmento da GDT (a TSS ocupa dois em 64 bits)
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;                // Limite 19:16 e flags (L = código 64 bits)
+    uint8_t base_high;
+} __attribute__((packed)) GdtEntry;
+
+// Task State Segment de 64 bits: só pilhas (RSP0-2 e IST1-7)
+typedef struct {
+    uint32_t reserved0;
+    uint64_t rsp0, rsp1, rsp2;          // Pilha usada ao entrar em cada anel
+    uint64_t reserved1;
+    uint64_t ist[7];                    // Pilhas fixas escolhidas pela IDT
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed)) Tss;
+
+// Entrada da IDT (interrupt gate de 64 bits)
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;                        // 0 = pilha atual, 1-7 = IST da TSS
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed)) IdtEntry;
+
+// Operando de lgdt/lidt
+typedef struct {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed)) DescriptorPointer;
+
+// Registradores salvos por isr_common, na ordem em que ficam na pilha
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector, error;
+    uint64_t rip, cs, rflags, rsp, ss;  // Empilhados pela CPU (sempre, em 64 bits)
+} InterruptFrame;
+
+typedef void (*InterruptHandler)(InterruptFrame* frame);
+
+static GdtEntry gdt[GDT_ENTRIES];
+static Tss tss;
+static uint8_t double_fault_stack[4096] __attribute__((aligned(16)));
+static IdtEntry idt[256];
+static InterruptHandler interrupt_handlers[256];
+static uint16_t pic_mask = 0xFFFF;      // Cópia das máscaras (evita ler o PIC)
+
+// Pontos de entrada gerados em assembly, logo abaixo
+extern const uint64_t isr_stub_table[IDT_STUBS];
+extern uint8_t kernel_stack_top[];
+extern uint32_t boot_gb_pages;          // 1 se a entrada mapeou com páginas de 1 GB
+void kernel_main(uint32_t magic, MultibootInfo* mbi);
+void interrupt_dispatch(InterruptFrame* frame);
+void serial_irq(InterruptFrame* frame);
+
+// Cabeçalho multiboot com os endereços de carga (bit 16 das flags): o
+// -kernel do QEMU não carrega ELF de 64 bits, então a imagem é lida como
+// binária de kernel_phys_start até kernel_load_end, e o resto até
+// kernel_end é zerado. Tudo aqui é físico.
+__asm__(
+    ".pushsection .multiboot, \"a\"\n"
+    ".align 4\n"
+    "multiboot_header:\n"
+    "    .long 0x1BADB002\n"                // Magic
+    "    .long 0x00010003\n"                // Alinhar módulos, info de memória, endereços abaixo
+    "    .long -(0x1BADB002 + 0x00010003)\n"
+    "    .long multiboot_header\n"
+    "    .long kernel_phys_start\n"
+    "    .long kernel_load_end\n"
+    "    .long kernel_end\n"
+    "    .long _start\n"
+    ".popsection\n"
+);
+
+// Entrada em 32 bits (modo protegido, sem paginação): monta as tabelas de
+// páginas, liga PAE, LME e PG e salta para kernel_main na metade alta com o
+// magic e a multiboot info do GRUB como argumentos. Os primeiros 4 GB ficam
+// em identidade (os últimos sem cache: é onde os PCs põem os dispositivos)
+// e os primeiros 2 GB aparecem de novo em KERNEL_VMA. Usa páginas de 1 GB
+// quando a CPU tem pdpe1gb, senão de 2 MB.
+__asm__(
+    ".pushsection .bss\n"
+    ".align 4096\n"
+    "boot_pml4:\n"
+    "    .skip 4096\n"
+    "boot_pdpt_low:\n"
+    "    .skip 4096\n"
+    "boot_pdpt_high:\n"
+    "    .skip 4096\n"
+    "boot_pd:\n"
+    "    .skip 4 * 4096\n"                  // 4 GB em páginas de 2 MB
+    "boot_gb_pages:\n"
+    "    .skip 4\n"
+    ".popsection\n"
+    ".pushsection .boot, \"ax\"\n"
+    ".code32\n"
+    ".globl _start\n"
+    "_start:\n"
+    "    cli\n"
+    "    cld\n"
+    "    movl %eax, %edi\n"                 // 1º e 2º argumentos de kernel_main
+    "    movl %ebx, %esi\n"
+    "    movl $0x80000000, %eax\n"
+    "    cpuid\n"
+    "    cmpl $0x80000001, %eax\n"
+    "    jb no_long_mode\n"
+    "    movl $0x80000001, %eax\n"
+    "    cpuid\n"
+    "    testl $0x20000000, %edx\n"         // LM
+    "    jz no_long_mode\n"
+    "    testl $0x04000000, %edx\n"         // pdpe1gb
+    "    jz 2f\n"
+    "    movl $boot_pdpt_low - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $0x00000083, (%ebx)\n"        // P | W | PS
+    "    movl $0x40000083, 8(%ebx)\n"
+    "    movl $0x80000083, 16(%ebx)\n"
+    "    movl $0xC000009B, 24(%ebx)\n"      // + PWT | PCD
+    "    movl $boot_pdpt_high - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $0x00000083, 510 * 8(%ebx)\n"
+    "    movl $0x40000083, 511 * 8(%ebx)\n"
+    "    movl $1, boot_gb_pages - 0xFFFFFFFF80000000\n"
+    "    jmp 3f\n"
+    "2:\n"
+    "    movl $boot_pd - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $0x00000083, %eax\n"
+    "    movl $2048, %ecx\n"
+    "1:  movl %eax, (%ebx)\n"
+    "    addl $0x200000, %eax\n"
+    "    addl $8, %ebx\n"
+    "    loop 1b\n"
+    "    movl $boot_pd - 0xFFFFFFFF80000000 + 3 * 4096, %ebx\n"
+    "    movl $512, %ecx\n"
+    "1:  orl $0x18, (%ebx)\n"               // Último GB sem cache
+    "    addl $8, %ebx\n"
+    "    loop 1b\n"
+    "    movl $boot_pdpt_low - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $boot_pd - 0xFFFFFFFF80000000 + 3, %eax\n"
+    "    movl %eax, (%ebx)\n"
+    "    addl $4096, %eax\n"
+    "    movl %eax, 8(%ebx)\n"
+    "    addl $4096, %eax\n"
+    "    movl %eax, 16(%ebx)\n"
+    "    addl $4096, %eax\n"
+    "    movl %eax, 24(%ebx)\n"
+    "    movl $boot_pdpt_high - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $boot_pd - 0xFFFFFFFF80000000 + 3, %eax\n"
+    "    movl %eax, 510 * 8(%ebx)\n"
+    "    addl $4096, %eax\n"
+    "    movl %eax, 511 * 8(%ebx)\n"
+    "3:\n"
+    "    movl $boot_pml4 - 0xFFFFFFFF80000000, %ebx\n"
+    "    movl $boot_pdpt_low - 0xFFFFFFFF80000000 + 3, (%ebx)\n"
+    "    movl $boot_pdpt_high - 0xFFFFFFFF80000000 + 3, 511 * 8(%ebx)\n"
+    "    movl %ebx, %cr3\n"
+    "    movl %cr4, %eax\n"
+    "    orl $0x20, %eax\n"                 // PAE
+    "    movl %eax, %cr4\n"
+    "    movl $0xC0000080, %ecx\n"          // EFER
+    "    rdmsr\n"
+    "    orl $0x100, %eax\n"                // LME
+    "    wrmsr\n"
+    "    movl %cr0, %eax\n"
+    "    orl $0x80010000, %eax\n"           // PG | WP
+    "    movl %eax, %cr0\n"
+    "    lgdt boot_gdtr\n"
+    "    ljmp $0x08, $long_mode_entry\n"
+    "no_long_mode:\n"
+    "    movl $0xB8000, %edi\n"
+    "    movl $no_long_mode_message, %esi\n"
+    "    movb $0x4F, %ah\n"                 // Branco sobre vermelho
+    "1:  lodsb\n"
+    "    testb %al, %al\n"
+    "    jz 2f\n"
+    "    stosw\n"
+    "    jmp 1b\n"
+    "2:  hlt\n"
+    "    jmp 2b\n"
+    "no_long_mode_message:\n"
+    "    .asciz \"SingularittyOS 64-bit: esta CPU nao tem long mode\"\n"
+    ".align 8\n"
+    "boot_gdt:\n"
+    "    .quad 0\n"
+    "    .quad 0x00AF9A000000FFFF\n"        // Código 64 bits (L = 1)
+    "    .quad 0x00CF92000000FFFF\n"        // Dados
+    "boot_gdtr:\n"
+    "    .word 3 * 8 - 1\n"
+    "    .long boot_gdt\n"
+    ".code64\n"
+    "long_mode_entry:\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %ss\n"
+    "    xorl %eax, %eax\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    movabsq $kernel_stack_top, %rsp\n"
+    "    xorl %ebp, %ebp\n"
+    "    movl %edi, %edi\n"                 // A metade alta fica indefinida na troca de modo
+    "    movl %esi, %esi\n"
+    "    movabsq $kernel_main, %rax\n"
+    "    call *%rax\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+    ".popsection\n"
+);
+
+// Pilha do kernel. Cada stub empilha um código de erro (0 quando a CPU não
+// empilha um) e o número do vetor, então todas as entradas chegam iguais em
+// isr_common; com os 15 registradores a pilha fica alinhada em 16 no call.
+__asm__(
+    ".pushsection .bss\n"
+    ".align 16\n"
+    "kernel_stack:\n"
+    "    .skip 16384\n"                     // 16 KB de pilha
+    "kernel_stack_top:\n"
+    ".popsection\n"
+    ".pushsection .text\n"
+    ".macro ISR_NOERR vec\n"
+    "isr\\vec:\n"
+    "    pushq $0\n"
+    "    pushq $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".macro ISR_ERR vec\n"
+    "isr\\vec:\n"
+    "    pushq $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,9,15,16,18,19,20,22,23,24,25,26,27,28,31\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 8,10,11,12,13,14,17,21,29,30\n"
+    "    ISR_ERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    "isr_common:\n"
+    "    pushq %rax\n"
+    "    pushq %rbx\n"
+    "    pushq %rcx\n"
+    "    pushq %rdx\n"
+    "    pushq %rsi\n"
+    "    pushq %rdi\n"
+    "    pushq %rbp\n"
+    "    pushq %r8\n"
+    "    pushq %r9\n"
+    "    pushq %r10\n"
+    "    pushq %r11\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    cld\n"
+    "    movq %rsp, %rdi\n"                 // InterruptFrame*
+    "    call interrupt_dispatch\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %r11\n"
+    "    popq %r10\n"
+    "    popq %r9\n"
+    "    popq %r8\n"
+    "    popq %rbp\n"
+    "    popq %rdi\n"
+    "    popq %rsi\n"
+    "    popq %rdx\n"
+    "    popq %rcx\n"
+    "    popq %rbx\n"
+    "    popq %rax\n"
+    "    addq $16, %rsp\n"                  // Vetor e código de erro
+    "    iretq\n"
+    ".popsection\n"
+    ".pushsection .rodata\n"
+    ".align 8\n"
+    "isr_stub_table:\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23\n"
+    "    .quad isr\\vec\n"
+    ".endr\n"
+    ".irp vec, 24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    .quad isr\\vec\n"
+    ".endr\n"
+    ".popsection\n"
+);
+
+// Função para preencher um descritor da GDT
+static void gdt_set(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_mid = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = (flags & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[index].base_high = base >> 24;
+}
+
+// Função para carregar a GDT do kernel (código 64 bits, dados e a TSS)
+void gdt_init() {
+    uint64_t tss_base = (uint64_t)&tss;
+    
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(GDT_KERNEL_CODE >> 3, 0, 0xFFFFF, 0x9A, 0xA0);     // L = 1
+    gdt_set(GDT_KERNEL_DATA >> 3, 0, 0xFFFFF, 0x92, 0xC0);
+    gdt_set(GDT_TSS >> 3, tss_base, sizeof(Tss) - 1, 0x89, 0x00);
+    gdt[(GDT_TSS >> 3) + 1].limit_low = (tss_base >> 32) & 0xFFFF;  // Base 63:32
+    gdt[(GDT_TSS >> 3) + 1].base_low = tss_base >> 48;
+    
+    tss.rsp0 = (uint64_t)kernel_stack_top;
+    tss.ist[IST_DOUBLE_FAULT - 1] = (uint64_t)(double_fault_stack + sizeof(double_fault_stack));
+    tss.iomap_base = sizeof(Tss);           // Sem bitmap de I/O
+    
+    DescriptorPointer gdtr = { sizeof(gdt) - 1, (uint64_t)gdt };
+    __asm__ volatile(
+        "lgdt %0\n"
+        "pushq %1\n"                        // Recarrega o CS com lretq
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "movw %w2, %%ds\n"
+        "movw %w2, %%es\n"
+        "movw %w2, %%ss\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA) : "rax", "memory");
+    __asm__ volatile("ltr %w0" : : "r"(GDT_TSS));
+}
+
+// Função para preencher uma entrada da IDT
+static void idt_set_gate(int vector, uint64_t offset, uint8_t ist, uint8_t type_attr) {
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].ist = ist;
+    idt[vector].type_attr = type_attr;
+    idt[vector].offset_mid = (offset >> 16) & 0xFFFF;
+    idt[vector].offset_high = offset >> 32;
+    idt[vector].reserved = 0;
+}
+
+// Função para remapear o PIC para os vetores 0x20-0x2F com tudo mascarado
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11); io_wait();   // ICW1: inicialização com ICW4
+    outb(PIC2_COMMAND, 0x11); io_wait();
+    outb(PIC1_DATA, IRQ_BASE); io_wait();  // ICW2: vetor base
+    outb(PIC2_DATA, IRQ_BASE + 8); io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();      // ICW3: escravo na IRQ2
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();      // ICW4: modo 8086
+    outb(PIC2_DATA, 0x01); io_wait();
+    
+    pic_mask = 0xFFFF;
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// Função para liberar uma IRQ no PIC (as do escravo liberam também a IRQ2)
+static void pic_unmask(int irq) {
+    uint16_t mask = pic_mask & ~(1 << irq);
+    if (irq >= 8) {
+        mask &= ~(1 << 2);
+    }
+    if ((mask ^ pic_mask) & 0x00FF) {
+        outb(PIC1_DATA, mask & 0xFF);
+    }
+    if ((mask ^ pic_mask) & 0xFF00) {
+        outb(PIC2_DATA, mask >> 8);
+    }
+    pic_mask = mask;
+}
+
+// Função para avisar o fim de uma IRQ: o escravo só é tocado nas IRQs 8-15
+static inline void pic_eoi(int irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// Função para ver se a IRQ está em serviço (ISR do PIC), para achar as espúrias
+static int pic_in_service(int irq) {
+    uint16_t port = irq >= 8 ? PIC2_COMMAND : PIC1_COMMAND;
+    outb(port, 0x0B);                      // OCW3: próxima leitura devolve o ISR
+    return (inb(port) >> (irq & 7)) & 1;
+}
+
+// Função para registrar o handler de um vetor (exceções)
+void interrupt_install(int vector, InterruptHandler handler) {
+    interrupt_handlers[vector] = handler;
+}
+
+// Função para registrar o handler de uma IRQ e liberá-la no PIC
+void irq_install(int irq, InterruptHandler handler) {
+    interrupt_handlers[IRQ_BASE + irq] = handler;
+    pic_unmask(irq);
+}
+
+// Função para carregar a IDT e remapear o PIC (interrupções ainda desligadas)
+void interrupts_init() {
+    for (int i = 0; i < IDT_STUBS; i++) {
+        idt_set_gate(i, isr_stub_table[i], 0, 0x8E);    // Interrupt gate, DPL 0
+    }
+    
+    // O #DF troca para a pilha IST: roda mesmo se a do kernel estourou
+    idt_set_gate(8, isr_stub_table[8], IST_DOUBLE_FAULT, 0x8E);
+    
+    DescriptorPointer idtr = { sizeof(idt) - 1, (uint64_t)idt };
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+    
+    pic_remap();
+}
+
+// Desliga as interrupções e devolve o RFLAGS anterior
+static inline uint64_t irq_save() {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Religa as interrupções se estavam ligadas em irq_save
+static inline void irq_restore(uint64_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+// Função para ler quantos ticks do PIT já correram no one-shot atual.
+// Em modo 0 o contador desce até 0, levanta a IRQ0 e segue descendo a
+// partir de 0xFFFF; como nenhum one-shot passa de PIT_MAX_COUNT, um valor
+// acima do programado quer dizer que o contador já deu a volta.
+static uint32_t pit_elapsed() {
+    outb(PIT_COMMAND, PIT_LATCH_CH0);
+    uint16_t count = inb(PIT_CHANNEL0);
+    count |= (uint16_t)inb(PIT_CHANNEL0) << 8;
+    
+    if (count <= pit_programmed) {
+        return pit_programmed - count;
+    }
+    return pit_programmed + (0x10000 - count);
+}
+
+// Função para converter ticks do PIT em nanossegundos sem divisão de 64 bits:
+// ns = ticks * 2^16 * 10^9 / 1193182 >> 16, em duas partes para não estourar
+static inline uint64_t pit_ticks_to_ns(uint64_t ticks) {
+    return (ticks >> 16) * PIT_NS_MULT + (((ticks & 0xFFFF) * PIT_NS_MULT) >> 16);
+}
+
+// Função para converter nanossegundos em ticks do PIT (arredonda para cima),
+// limitada a um one-shot: ticks = ns * 1193182 / 10^9 = ns * PIT_TICKS_MULT >> 32
+static inline uint32_t ns_to_pit_ticks(uint64_t ns) {
+    if (ns >= PIT_MAX_NS) {
+        return PIT_MAX_COUNT;
+    }
+    uint32_t ticks = (uint32_t)((ns * PIT_TICKS_MULT) >> 32) + 1;
+    return ticks < PIT_MAX_COUNT ? ticks : PIT_MAX_COUNT;
+}
+
+// Relógio do PIT em nanossegundos desde o timer_init
+static uint64_t pit_clock_ns() {
+    uint64_t flags = irq_save();
+    uint64_t ticks = pit_ticks + pit_elapsed();
+    irq_restore(flags);
+    return pit_ticks_to_ns(ticks);
+}
+
+// Função para converter ciclos do TSC em nanossegundos
+static inline uint64_t tsc_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+// Relógio monotônico em nanossegundos desde o timer_init. Com o TSC
+// invariante é só um rdtsc, uma multiplicação e um shift; sem ele, lê o PIT.
+uint64_t ktime_ns() {
+    if (tsc_clocksource) {
+        return tsc_base_ns + tsc_to_ns(rdtsc() - tsc_base);
+    }
+    return pit_clock_ns();
+}
+
+// Função para medir quantos ciclos do TSC cabem em TSC_CALIBRATE_COUNT ticks
+// do PIT. Usa o canal 2 (o do alto-falante), que conta sem gerar IRQ, e
+// espera o OUT2 subir na porta 0x61.
+static uint64_t tsc_measure() {
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    outb(PIT_COMMAND, PIT_ONESHOT_CH2);
+    outb(PIT_CHANNEL2, TSC_CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, TSC_CALIBRATE_COUNT >> 8);
+    
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {}
+    uint64_t cycles = rdtsc() - start;
+    
+    outb(PIT_GATE_PORT, gate);
+    return cycles;
+}
+
+// Função para calibrar o TSC contra o PIT e, se o CPUID garante que ele é
+// invariante, passar ktime_ns para o TSC. Chamada depois do timer_init.
+void clocksource_init() {
+    uint32_t a, b, c, d;
+    
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_EDX_TSC)) {
+        return;
+    }
+    
+    uint64_t flags = irq_save();
+    
+    // A menor medida é a que menos sofreu com SMIs e com o emulador
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < TSC_CALIBRATE_ROUNDS; i++) {
+        uint64_t cycles = tsc_measure();
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    
+    // kHz = ciclos * 1193182 / (contagem * 1000)
+    tsc_khz = best * PIT_FREQUENCY / (TSC_CALIBRATE_COUNT * 1000);
+    
+    // ns = ciclos * 10^6 / kHz: usa o maior shift em que o multiplicador
+    // ainda cabe em 32 bits
+    tsc_shift = 32;
+    while (1) {
+        uint64_t mult = (1000000ULL << tsc_shift) / tsc_khz;
+        if ((mult >> 32) == 0) {
+            tsc_mult = (uint32_t)mult;
+            break;
+        }
+        tsc_shift--;
+    }
+    
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        tsc_invariant = (d & CPUID_EDX_INVARIANT_TSC) != 0;
+    }
+    
+    // O TSC continua de onde o PIT estava, então os prazos já na fila valem
+    if (tsc_invariant) {
+        tsc_base_ns = pit_clock_ns();
+        tsc_base = rdtsc();
+        tsc_clocksource = 1;
+    }
+    irq_restore(flags);
+}
+
+// Funções da lista circular com cabeça usada pelos slots da roda
+static inline void list_init(ListNode* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const ListNode* head) {
+    return head->next == head;
+}
+
+static inline void list_add_tail(ListNode* head, ListNode* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void list_del(ListNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+// Função para marcar um softirq: ele roda na saída da IRQ atual
+static inline void softirq_raise(int n) {
+    softirq_pending |= 1u << n;
+}
+
+// Função para registrar o handler de um softirq
+void softirq_install(int n, SoftirqHandler handler) {
+    softirq_handlers[n] = handler;
+}
+
+// Função para rodar os softirqs pendentes na saída de uma IRQ, já com o
+// EOI dado e as interrupções ligadas. Uma IRQ que chegue enquanto eles
+// rodam só marca o bit, e o laço a atende antes de sair.
+static void softirq_run() {
+    if (softirq_active) {
+        return;
+    }
+    softirq_active = 1;
+    
+    while (softirq_pending) {
+        uint32_t pending = softirq_pending;
+        softirq_pending = 0;
+        __asm__ volatile("sti" : : : "memory");
+        for (int n = 0; n < SOFTIRQ_COUNT; n++) {
+            if ((pending & (1u << n)) && softirq_handlers[n]) {
+                softirq_handlers[n]();
+            }
+        }
+        __asm__ volatile("cli" : : : "memory");
+    }
+    softirq_active = 0;
+}
+
+// Roda de timers da CPU atual (por enquanto só existe a CPU 0)
+static inline TimerWheel* this_wheel() {
+    return &timer_wheels[0];
+}
+
+// Função para converter ns de ktime_ns no tick da roda
+static inline uint32_t ns_to_tick(uint64_t ns) {
+    return (uint32_t)(ns >> TIMER_TICK_SHIFT);
+}
+
+// Função para pôr o timer no slot que vence no tick dele: o nível 1 guarda
+// os próximos 256 ticks um por slot; cada nível acima cobre 64 vezes mais
+// com slots 64 vezes mais largos. Chamada com as interrupções desligadas.
+static void wheel_enqueue(TimerWheel* w, Timer* t) {
+    uint32_t expires = t->expires;
+    uint32_t delta = expires - w->clock;
+    ListNode* slot;
+    
+    if ((int32_t)delta < 0) {
+        // Já venceu: roda no próximo tick processado
+        slot = &w->tv1[w->clock & TVR_MASK];
+    } else if (delta < TVR_SIZE) {
+        slot = &w->tv1[expires & TVR_MASK];
+    } else {
+        int level = 0;
+        while (level < TVN_LEVELS - 1 && delta >= (1u << (TVR_BITS + (level + 1) * TVN_BITS))) {
+            level++;
+        }
+        slot = &w->tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    list_add_tail(slot, &t->entry);
+}
+
+// Função para descer os timers de um slot de nível alto para os níveis de
+// baixo (cascata), quando o nível 1 dá a volta
+static void wheel_cascade(TimerWheel* w, int level, uint32_t index) {
+    ListNode* head = &w->tvn[level][index];
+    
+    while (!list_empty(head)) {
+        Timer* t = (Timer*)head->next;
+        list_del(&t->entry);
+        wheel_enqueue(w, t);
+    }
+}
+
+// Função para achar o próximo tick com trabalho: o primeiro slot ocupado do
+// nível 1 ou a próxima volta dele (que pode descer timers dos níveis altos).
+// Olha no máximo TIMER_LOOKAHEAD ticks, mais do que cabe num one-shot do PIT.
+static uint32_t wheel_next_tick(TimerWheel* w) {
+    for (uint32_t i = 0; i < TIMER_LOOKAHEAD; i++) {
+        uint32_t tick = w->clock + i;
+        uint32_t index = tick & TVR_MASK;
+        if (index == 0 || !list_empty(&w->tv1[index])) {
+            return tick;
+        }
+    }
+    return w->clock + TIMER_LOOKAHEAD;
+}
+
+// Função para programar o próximo one-shot. Com timers na roda ele vence no
+// próximo tick com trabalho. Sem nenhum, o PIT fica parado se o relógio é o
+// TSC; se é o próprio PIT, arma o máximo do contador para o relógio não
+// perder uma volta. Chamada com as interrupções desligadas.
+static void timer_program(TimerWheel* w) {
+    uint64_t now;
+    
+    if (tsc_clocksource) {
+        if (w->count == 0) {
+            return;
+        }
+        now = ktime_ns();
+    } else {
+        // Fecha os ticks do one-shot anterior antes de trocar o contador
+        if (pit_programmed) {
+            pit_ticks += pit_elapsed();
+        }
+        now = pit_ticks_to_ns(pit_ticks);
+    }
+    
+    uint32_t count = PIT_MAX_COUNT;
+    if (w->count) {
+        w->next_tick = wheel_next_tick(w);
+        int32_t ahead = (int32_t)(w->next_tick - ns_to_tick(now));
+        if (ahead <= 0) {
+            count = 1;
+        } else {
+            // Até o início do tick: os ticks inteiros menos o que já correu do atual
+            uint64_t wait = ((uint64_t)ahead << TIMER_TICK_SHIFT)
+                          - (now & ((1u << TIMER_TICK_SHIFT) - 1));
+            count = ns_to_pit_ticks(wait);
+        }
+    }
+    
+    pit_programmed = count;
+    outb(PIT_COMMAND, PIT_ONESHOT_CH0);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+// Softirq dos timers: processa os ticks da roda até agora, com cascata a
+// cada volta do nível 1, e chama os callbacks com as interrupções ligadas
+static void timer_softirq() {
+    TimerWheel* w = this_wheel();
+    uint32_t now = ns_to_tick(ktime_ns());
+    uint64_t flags = irq_save();
+    
+    while ((int32_t)(now - w->clock) >= 0) {
+        // Roda vazia: não há o que descer nem disparar, pula direto para agora
+        if (w->count == 0) {
+            w->clock = now + 1;
+            break;
+        }
+        
+        uint32_t index = w->clock & TVR_MASK;
+        if (index == 0) {
+            for (int level = 0; level < TVN_LEVELS; level++) {
+                uint32_t slot = (w->clock >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+                wheel_cascade(w, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+        w->clock++;
+        
+        ListNode* head = &w->tv1[index];
+        while (!list_empty(head)) {
+            Timer* t = (Timer*)head->next;
+            list_del(&t->entry);
+            t->pending = 0;
+            w->count--;
+            
+            irq_restore(flags);
+            t->callback(t);
+            flags = irq_save();
+        }
+    }
+    
+    timer_program(w);
+    irq_restore(flags);
+}
+
+// Handler da IRQ0: o trabalho fica para o softirq de timers
+void timer_irq(InterruptFrame* frame) {
+    (void)frame;
+    softirq_raise(SOFTIRQ_TIMER);
+}
+
+// Função para agendar 't' para o instante 'deadline' (ns de ktime_ns) na
+// roda da CPU atual. O tick é arredondado para cima, então o callback nunca
+// roda antes do prazo.
+void timer_add(Timer* t, uint64_t deadline, TimerCallback callback) {
+    uint64_t flags = irq_save();
+    TimerWheel* w = this_wheel();
+    
+    // Com a roda vazia o relógio dela pode ter ficado para trás (tickless)
+    if (w->count == 0) {
+        w->clock = ns_to_tick(ktime_ns());
+    }
+    
+    t->expires = ns_to_tick(deadline + (1u << TIMER_TICK_SHIFT) - 1);
+    t->callback = callback;
+    t->wheel = w;
+    t->pending = 1;
+    wheel_enqueue(w, t);
+    w->count++;
+    
+    // Só reprograma o PIT se o novo timer vence antes do one-shot armado
+    if (w->count == 1 || (int32_t)(t->expires - w->next_tick) < 0) {
+        timer_program(w);
+    }
+    irq_restore(flags);
+}
+
+// Função para tirar 't' da roda em O(1) (não faz nada se já disparou)
+void timer_cancel(Timer* t) {
+    uint64_t flags = irq_save();
+    
+    if (t->pending) {
+        list_del(&t->entry);
+        t->wheel->count--;
+        t->pending = 0;
+    }
+    irq_restore(flags);
+}
+
+// Callback dos timers de espera: só marca que o prazo venceu
+static void timer_wake(Timer* t) {
+    (void)t;
+}
+
+// Função para dormir até 'ns' nanossegundos. Esperas curtas demais para
+// valer uma IRQ leem o relógio em laço; as outras dormem em hlt.
+void ksleep_ns(uint64_t ns) {
+    uint64_t deadline = ktime_ns() + ns;
+    
+    if (ns < SLEEP_SPIN_NS) {
+        while (ktime_ns() < deadline) {
+            __asm__ volatile("pause");
+        }
+        return;
+    }
+    
+    Timer t;
+    timer_add(&t, deadline, timer_wake);
+    while (1) {
+        __asm__ volatile("cli" : : : "memory");
+        if (!t.pending) {
+            break;
+        }
+        __asm__ volatile("sti; hlt" : : : "memory");
+    }
+    __asm__ volatile("sti" : : : "memory");
+}
+
+void ksleep_us(uint32_t us) {
+    ksleep_ns((uint64_t)us * 1000);
+}
+
+void ksleep_ms(uint32_t ms) {
+    ksleep_ns((uint64_t)ms * 1000000);
+}
+
+// Função para montar as rodas de timers e ligar o PIT em one-shot na IRQ0
+// (o relógio começa em zero)
+void timer_init() {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        TimerWheel* w = &timer_wheels[cpu];
+        for (int i = 0; i < TVR_SIZE; i++) {
+            list_init(&w->tv1[i]);
+        }
+        for (int level = 0; level < TVN_LEVELS; level++) {
+            for (int i = 0; i < TVN_SIZE; i++) {
+                list_init(&w->tvn[level][i]);
+            }
+        }
+    }
+    softirq_install(SOFTIRQ_TIMER, timer_softirq);
+    
+    uint64_t flags = irq_save();
+    timer_program(this_wheel());
+    irq_install(PIT_IRQ, timer_irq);
+    irq_restore(flags);
+}
+
+// Função para inicializar a COM1: 115200 8N1 com as FIFOs ligadas
+void serial_init() {
+    outb(COM1_PORT + SERIAL_IER, 0x00);    // Sem interrupções por enquanto
+    outb(COM1_PORT + SERIAL_LCR, 0x80);    // DLAB para programar o divisor
+    outb(COM1_PORT + 0, 0x01);             // Divisor 1 = 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + SERIAL_LCR, 0x03);    // 8 bits, sem paridade, 1 stop bit
+    outb(COM1_PORT + SERIAL_FCR, 0xC7);    // Liga e limpa as FIFOs
+    outb(COM1_PORT + SERIAL_MCR, 0x0B);    // DTR, RTS e OUT2 (OUT2 libera a IRQ)
+    
+    // Sem UART a porta lê 0xFF; os bits 6-7 do IIR dizem se a FIFO existe
+    if (inb(COM1_PORT + SERIAL_LSR) == 0xFF) {
+        return;
+    }
+    uint8_t iir = inb(COM1_PORT + SERIAL_IIR);
+    serial_fifo_size = (iir & 0xC0) == 0xC0 ? SERIAL_FIFO_SIZE : 1;
+    serial_present = 1;
+    irq_install(SERIAL_IRQ, serial_irq);
+}
+
+// Função para encher a FIFO de TX a partir do anel (THR precisa estar vazio)
+static void serial_fill_fifo() {
+    for (int i = 0; i < serial_fifo_size && serial_tx_tail != serial_tx_head; i++) {
+        outb(COM1_PORT + SERIAL_THR, serial_tx[serial_tx_tail & (SERIAL_TX_BUFFER - 1)]);
+        serial_tx_tail++;
+    }
+}
+
+// Função para esvaziar o anel por polling: um teste de LSR a cada FIFO cheia
+static void serial_drain_polled() {
+    while (serial_tx_tail != serial_tx_head) {
+        while (!(inb(COM1_PORT + SERIAL_LSR) & SERIAL_LSR_THRE));
+        serial_fill_fifo();
+    }
+}
+
+// Handler da IRQ4: enche a FIFO e desliga a interrupção quando o anel esvazia
+void serial_irq(InterruptFrame* frame) {
+    (void)frame;
+    inb(COM1_PORT + SERIAL_IIR);           // Reconhece a interrupção
+    
+    if (inb(COM1_PORT + SERIAL_LSR) & SERIAL_LSR_THRE) {
+        serial_fill_fifo();
+        if (serial_tx_tail == serial_tx_head) {
+            serial_ier &= ~SERIAL_IER_THRI;
+            outb(COM1_PORT + SERIAL_IER, serial_ier);
+        }
+    }
+}
+
+// Função para enfileirar um byte (não transmite; veja serial_kick)
+static void serial_queue(char c) {
+    if (serial_tx_head - serial_tx_tail == SERIAL_TX_BUFFER) {
+        // Anel cheio: esvazia na hora para não perder log
+        uint64_t flags = irq_save();
+        serial_drain_polled();
+        irq_restore(flags);
+    }
+    serial_tx[serial_tx_head & (SERIAL_TX_BUFFER - 1)] = c;
+    serial_tx_head++;
+}
+
+// Função para enviar um caractere da tela para a serial ('\n' vira "\r\n")
+static inline void serial_putchar(char c) {
+    if (!serial_present) {
+        return;
+    }
+    if (c == '\n') {
+        serial_queue('\r');
+    }
+    serial_queue(c);
+}
+
+// Função para começar a transmitir o que está no anel: com interrupções
+// ligadas habilita a IRQ de THR vazio, sem elas esvazia por polling
+void serial_kick() {
+    if (!serial_present || serial_tx_tail == serial_tx_head) {
+        return;
+    }
+    
+    uint64_t flags = irq_save();
+    if (flags & EFLAGS_IF) {
+        if (!(serial_ier & SERIAL_IER_THRI)) {
+            serial_ier |= SERIAL_IER_THRI;
+            outb(COM1_PORT + SERIAL_IER, serial_ier);
+        }
+    } else {
+        serial_drain_polled();
+    }
+    irq_restore(flags);
+}
+
+// Copia 'count' palavras de 32 bits de uma vez (rep movsl)
+static inline void vga_copy32(volatile void* dst, const void* src, size_t count) {
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// Marca as colunas [start, end) da linha y como sujas
+static inline void vga_mark_dirty(size_t y, size_t start, size_t end) {
+    if (vga_dirty_rows & (1u << y)) {
+        if (start < vga_dirty_start[y]) vga_dirty_start[y] = start;
+        if (end > vga_dirty_end[y]) vga_dirty_end[y] = end;
+    } else {
+        vga_dirty_rows |= 1u << y;
+        vga_dirty_start[y] = start;
+        vga_dirty_end[y] = end;
+    }
+}
+
+// Programa o CRTC para começar a tela na linha 'origin' da memória de texto
+static void vga_set_start(size_t origin) {
+    uint16_t pos = origin * VGA_WIDTH;
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH);
+    outb(VGA_CRTC_DATA, pos >> 8);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    vga_hw_origin = origin;
+}
+
+// Copia as faixas sujas da shadow para a memória de vídeo
+void vga_flush() {
+    while (vga_dirty_rows) {
+        size_t y = __builtin_ctz(vga_dirty_rows);
+        vga_dirty_rows &= vga_dirty_rows - 1;
+        
+        // Alinha a faixa em pares de células para copiar 32 bits por vez
+        size_t start = vga_dirty_start[y] & ~1u;
+        size_t end = (vga_dirty_end[y] + 1) & ~1u;
+        size_t offset = (vga_origin + y) * VGA_WIDTH + start;
+        vga_copy32(vga_buffer + offset, vga_shadow + offset, (end - start) / 2);
+    }
+    
+    // Só move a janela depois que o conteúdo novo já está na VGA
+    if (vga_hw_origin != vga_origin) {
+        vga_set_start(vga_origin);
+    }
+    
+    serial_kick();
+}
+
+// Agrupa várias escritas em um único flush
+void vga_batch_begin() {
+    vga_batch_depth++;
+}
+
+void vga_batch_end() {
+    if (--vga_batch_depth == 0) {
+        vga_flush();
+    }
+}
+
 // Função para limpar a tela
 void vga_clear() {
+    uint16_t* screen = vga_shadow + vga_origin * VGA_WIDTH;
     for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+        screen[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        vga_mark_dirty(y, 0, VGA_WIDTH);
     }
     vga_x = 0;
     vga_y = 0;
@@ -76,62 +1335,424 @@ void vga_set_color(uint8_t color) {
     vga_color = color;
 }
 
+// Rola a tela uma linha. Normalmente só avança a origem do CRTC (O(1));
+// só copia quando a janela chega ao fim dos 32 KB de memória de texto.
+static void vga_scroll() {
+    if (vga_origin + VGA_HEIGHT < VGA_MEM_ROWS) {
+        vga_origin++;
+        
+        // As linhas sujas sobem junto com a janela
+        vga_dirty_rows >>= 1;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_dirty_start[y] = vga_dirty_start[y + 1];
+            vga_dirty_end[y] = vga_dirty_end[y + 1];
+        }
+    } else {
+        // Fim da memória: traz as 24 linhas de baixo para o início
+        uint16_t* src = vga_shadow + (vga_origin + 1) * VGA_WIDTH;
+        for (size_t i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
+            vga_shadow[i] = src[i];
+        }
+        vga_origin = 0;
+        vga_dirty_rows = 0;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_mark_dirty(y, 0, VGA_WIDTH);
+        }
+    }
+    
+    // Limpa a nova última linha
+    uint16_t* row = vga_shadow + (vga_origin + VGA_HEIGHT - 1) * VGA_WIDTH;
+    for (size_t x = 0; x < VGA_WIDTH; x++) {
+        row[x] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    vga_mark_dirty(VGA_HEIGHT - 1, 0, VGA_WIDTH);
+}
+
+// Vai para o início da próxima linha, rolando a tela se preciso
+static void vga_newline() {
+    vga_x = 0;
+    vga_y++;
+    if (vga_y >= VGA_HEIGHT) {
+        vga_scroll();
+        vga_y = VGA_HEIGHT - 1;
+    }
+}
+
 // Função para colocar caractere na tela
 void vga_putchar(char c) {
+    serial_putchar(c);
+    
     if (c == '\n') {
-        vga_x = 0;
-        vga_y++;
-        if (vga_y >= VGA_HEIGHT) {
-            // Scroll da tela
-            for (size_t i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
-                vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
-            }
-            for (size_t i = VGA_WIDTH * (VGA_HEIGHT - 1); i < VGA_WIDTH * VGA_HEIGHT; i++) {
-                vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
-            }
-            vga_y = VGA_HEIGHT - 1;
+        vga_newline();
+        if (vga_batch_depth == 0) {
+            vga_flush();
         }
         return;
     }
     
     if (vga_x >= VGA_WIDTH) {
-        vga_x = 0;
-        vga_y++;
-    }
-    
-    if (vga_y >= VGA_HEIGHT) {
-        vga_y = 0;
+        vga_newline();
     }
     
-    size_t index = vga_y * VGA_WIDTH + vga_x;
-    vga_buffer[index] = (uint16_t)c | (uint16_t)vga_color << 8;
+    size_t index = (vga_origin + vga_y) * VGA_WIDTH + vga_x;
+    vga_shadow[index] = (uint16_t)c | (uint16_t)vga_color << 8;
+    vga_mark_dirty(vga_y, vga_x, vga_x + 1);
     vga_x++;
 }
 
+// Escreve 'len' bytes na tela de uma vez, interpretando os escapes de cor
+void vga_write(const char* buf, size_t len) {
+    vga_batch_begin();
+    for (size_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == KC_ESCAPE && i + 1 < len) {
+            char d = buf[++i];
+            uint8_t fg = (d >= 'A') ? d - 'A' + 10 : d - '0';
+            vga_set_color((fg & 0x0F) | (VGA_BLACK << 4));
+            continue;
+        }
+        vga_putchar(c);
+    }
+    vga_batch_end();
+}
+
 // Função para exibir string
 void vga_puts(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
     }
+    vga_write(str, len);
 }
 
-// Função para exibir inteiro
-void vga_putint(uint64_t num) {
-    if (num == 0) {
-        vga_putchar('0');
-        return;
+// Pares "00".."99": cada divisão por 100 gera dois dígitos de uma vez
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Divide n por d e retorna o resto (mesma interface do kernel 32-bit)
+static inline uint32_t div64_32(uint64_t* n, uint32_t d) {
+    uint32_t r = *n % d;
+    *n /= d;
+    return r;
+}
+
+// Escreve n em decimal de trás para frente terminando em 'end'.
+// Retorna o início dos dígitos.
+static char* fmt_u32(char* end, uint32_t n) {
+    while (n >= 100) {
+        uint32_t q = n / 100;
+        uint32_t r = (n - q * 100) * 2;
+        end -= 2;
+        end[0] = digit_pairs[r];
+        end[1] = digit_pairs[r + 1];
+        n = q;
     }
+    if (n >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[n * 2];
+        end[1] = digit_pairs[n * 2 + 1];
+    } else {
+        *--end = '0' + n;
+    }
+    return end;
+}
+
+static char* fmt_u64(char* end, uint64_t n) {
+    // Blocos de 8 dígitos enquanto o número não cabe em 32 bits
+    while (n >> 32) {
+        char* start = fmt_u32(end, div64_32(&n, 100000000));
+        end -= 8;
+        while (start > end) {
+            *--start = '0';
+        }
+    }
+    return fmt_u32(end, (uint32_t)n);
+}
+
+static char* fmt_hex(char* end, uint64_t n, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[n & 0xF];
+        n >>= 4;
+    } while (n);
+    return end;
+}
+
+// Buffer de saída do kprintf: tudo é formatado aqui e vai para a tela em um
+// único vga_write (ou em blocos, se passar de KPRINTF_BUFFER)
+typedef struct {
+    char buf[KPRINTF_BUFFER];
+    size_t len;
+} KprintfBuffer;
+
+#define FMT_LEFT 1      // '-': alinha à esquerda
+#define FMT_ZERO 2      // '0': completa com zeros
+
+static void kbuf_putc(KprintfBuffer* b, char c) {
+    // Não separa um escape de cor do seu dígito entre dois blocos
+    if (b->len == KPRINTF_BUFFER || (c == KC_ESCAPE && b->len == KPRINTF_BUFFER - 1)) {
+        vga_write(b->buf, b->len);
+        b->len = 0;
+    }
+    b->buf[b->len++] = c;
+}
+
+// Emite um campo com largura mínima; o prefixo (sinal, "0x") vem antes dos zeros
+static void kbuf_field(KprintfBuffer* b, const char* prefix, const char* s, size_t len,
+                       int width, int flags) {
+    int pad = width - (int)len;
+    for (const char* p = prefix; *p; p++) {
+        pad--;
+    }
+    if (!(flags & (FMT_LEFT | FMT_ZERO))) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+    while (*prefix) {
+        kbuf_putc(b, *prefix++);
+    }
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        while (pad-- > 0) kbuf_putc(b, '0');
+    }
+    for (size_t i = 0; i < len; i++) {
+        kbuf_putc(b, s[i]);
+    }
+    if (flags & FMT_LEFT) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+}
+
+// printf do kernel: %d %u %x %X %p %s %c %%, com 'l'/'ll', largura, '-' e '0'
+void vkprintf(const char* fmt, va_list args) {
+    KprintfBuffer b;
+    char num[24];
+    b.len = 0;
     
-    char buffer[32];
-    size_t i = 0;
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        fmt++;
+        
+        int flags = 0;
+        int width = 0;
+        int longs = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FMT_LEFT;
+            else if (*fmt == '0') flags |= FMT_ZERO;
+            else break;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+        
+        char* end = num + sizeof(num);
+        char* start;
+        const char* prefix = "";
+        uint64_t value;
+        switch (*fmt) {
+        case 'd': {
+            int64_t v = longs >= 2 ? va_arg(args, long long)
+                      : longs ? va_arg(args, long) : va_arg(args, int);
+            if (v < 0) {
+                prefix = "-";
+                value = -(uint64_t)v;
+            } else {
+                value = v;
+            }
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        }
+        case 'u':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        case 'x':
+        case 'X':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = fmt_hex(end, value, *fmt == 'X');
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void*);
+            start = fmt_hex(end, value, 0);
+            prefix = "0x";
+            flags |= FMT_ZERO;
+            width = 2 + 2 * sizeof(void*);
+            break;
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            size_t len = 0;
+            if (!str) {
+                str = "(null)";
+            }
+            while (str[len] != '\0') {
+                len++;
+            }
+            kbuf_field(&b, "", str, len, width, flags);
+            continue;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            kbuf_field(&b, "", &c, 1, width, flags);
+            continue;
+        }
+        case '\0':
+            fmt--;
+            continue;
+        default:
+            // '%%' vira '%'; conversão desconhecida é copiada como está
+            if (*fmt != '%') {
+                kbuf_putc(&b, '%');
+            }
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        kbuf_field(&b, prefix, start, end - start, width, flags);
+    }
     
-    while (num > 0) {
-        buffer[i++] = '0' + (num % 10);
-        num /= 10;
+    if (b.len) {
+        vga_write(b.buf, b.len);
     }
+}
+
+void kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vkprintf(fmt, args);
+    va_end(args);
+}
+
+// Nomes das exceções da CPU (vetores 0-31)
+static const char* const exception_names[32] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "BOUND Range Exceeded", "Invalid Opcode", "Device Not Available",
+    "Double Fault", "Coprocessor Segment Overrun", "Invalid TSS", "Segment Not Present",
+    "Stack-Segment Fault", "General Protection", "Page Fault", "Reserved",
+    "x87 Floating-Point", "Alignment Check", "Machine Check", "SIMD Floating-Point",
+    "Virtualization", "Control Protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security", "Reserved"
+};
+
+// Tela de pânico: mostra o motivo e os registradores (se houver frame) na
+// tela e na serial, e para a CPU
+void panic(const char* reason, InterruptFrame* frame) {
+    uint64_t cr0, cr2, cr3, cr4;
+    
+    __asm__ volatile("cli");
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    
+    // Escreve direto, sem lote
+    vga_batch_depth = 0;
+    vga_set_color(VGA_WHITE | (VGA_RED << 4));
+    vga_clear();
+    
+    kprintf("\n *** KERNEL PANIC: %s ***\n\n", reason);
+    if (frame) {
+        kprintf(" vetor %lu  erro 0x%016lx\n\n", frame->vector, frame->error);
+        kprintf(" RAX=%016lx  RBX=%016lx  RCX=%016lx\n", frame->rax, frame->rbx, frame->rcx);
+        kprintf(" RDX=%016lx  RSI=%016lx  RDI=%016lx\n", frame->rdx, frame->rsi, frame->rdi);
+        kprintf(" RBP=%016lx  RSP=%016lx  R8 =%016lx\n", frame->rbp, frame->rsp, frame->r8);
+        kprintf(" R9 =%016lx  R10=%016lx  R11=%016lx\n", frame->r9, frame->r10, frame->r11);
+        kprintf(" R12=%016lx  R13=%016lx  R14=%016lx\n", frame->r12, frame->r13, frame->r14);
+        kprintf(" R15=%016lx  RIP=%016lx\n", frame->r15, frame->rip);
+        kprintf(" RFLAGS=%08lx  CS=%04lx  SS=%04lx\n", frame->rflags, frame->cs, frame->ss);
+    }
+    kprintf(" CR0=%08lx  CR2=%016lx  CR3=%016lx  CR4=%08lx\n\n", cr0, cr2, cr3, cr4);
+    kprintf(" Sistema parado.\n");
+    vga_flush();
+    
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+// Ponto comum de todas as interrupções: IRQs levam o EOI antes do handler
+// (que roda com o IF desligado) e depois rodam os softirqs; exceções sem
+// handler viram pânico
+void interrupt_dispatch(InterruptFrame* frame) {
+    uint64_t vector = frame->vector;
+    InterruptHandler handler = interrupt_handlers[vector];
+    
+    if (vector >= IRQ_BASE) {
+        int irq = vector - IRQ_BASE;
+        
+        // IRQ 7/15 sem bit no ISR é espúria: não leva EOI (a 15 ainda deve um ao mestre)
+        if ((irq == 7 || irq == 15) && !pic_in_service(irq)) {
+            if (irq == 15) {
+                outb(PIC1_COMMAND, PIC_EOI);
+            }
+            return;
+        }
+        
+        pic_eoi(irq);
+        if (handler) {
+            handler(frame);
+        }
+        softirq_run();
+        return;
+    }
+    
+    if (handler) {
+        handler(frame);
+        return;
+    }
+    panic(exception_names[vector], frame);
+}
+
+// Função para percorrer o mapa de memória do multiboot: preenche a próxima
+// região a partir de '*cursor' (0 na primeira chamada) e devolve 0 no fim.
+// Sem mmap, o GRUB só informa mem_upper: vira uma região acima de 1 MB.
+static int mmap_next(MultibootInfo* mbi, uint32_t* cursor, uint64_t* start, uint64_t* end, uint32_t* type) {
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        if (*cursor >= mbi->mmap_length) {
+            return 0;
+        }
+        MultibootMmapEntry* entry = (MultibootMmapEntry*)(uintptr_t)(mbi->mmap_addr + *cursor);
+        *start = entry->addr;
+        *end = entry->addr + entry->len;
+        *type = entry->type;
+        *cursor += entry->size + sizeof(entry->size);
+        return 1;
+    }
+    if (*cursor == 0 && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+        *start = LOW_MEMORY;
+        *end = LOW_MEMORY + (uint64_t)mbi->mem_upper * 1024;
+        *type = MULTIBOOT_MEMORY_AVAILABLE;
+        *cursor = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Função para somar a RAM utilizável do mapa de memória
+void memory_probe(MultibootInfo* mbi) {
+    uint32_t cursor = 0;
+    uint64_t start, end;
+    uint32_t type;
     
-    while (i > 0) {
-        vga_putchar(buffer[--i]);
+    while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+        if (type == MULTIBOOT_MEMORY_AVAILABLE) {
+            ram_bytes += end - start;
+        }
     }
 }
 
@@ -163,49 +1784,23 @@ void get_system_info(SystemInfo* info) {
     }
     info->architecture[i] = '\0';
     
-    info->memory_mb = 2048; // Simulado - mais memória para 64-bit
-    info->uptime_seconds = 0;
+    info->memory_mb = ram_bytes >> 20;
+    info->uptime_seconds = ktime_ns() / 1000000000;
 }
 
 // Função para exibir informações do sistema no estilo neofetch
 void display_system_info(SystemInfo* info) {
-    vga_set_color(VGA_LIGHT_CYAN | (VGA_BLACK << 4));
-    vga_puts("                    ");
-    vga_puts(info->hostname);
-    vga_puts("@singularitty\n");
-    
-    vga_set_color(VGA_LIGHT_GREY | (VGA_BLACK << 4));
-    vga_puts("                   ---------------\n");
-    
-    vga_set_color(VGA_LIGHT_GREEN | (VGA_BLACK << 4));
-    vga_puts("OS:                 SingularittyOS ");
-    vga_puts(info->architecture);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_BLUE | (VGA_BLACK << 4));
-    vga_puts("Kernel:             ");
-    vga_puts(info->kernel_version);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_MAGENTA | (VGA_BLACK << 4));
-    vga_puts("Architecture:       ");
-    vga_puts(info->architecture);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
-    vga_puts("Uptime:             ");
-    vga_putint(info->uptime_seconds);
-    vga_puts("s\n");
-    
-    vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-    vga_puts("Memory:             ");
-    vga_putint(info->memory_mb);
-    vga_puts("MB\n");
-    
-    vga_set_color(VGA_LIGHT_BROWN | (VGA_BLACK << 4));
-    vga_puts("Shell:              singularity-shell\n");
-    
-    vga_putchar('\n');
+    kprintf(KC_LIGHT_CYAN    "                    %s@singularitty\n"
+            KC_LIGHT_GREY    "                   ---------------\n"
+            KC_LIGHT_GREEN   "OS:                 SingularittyOS %s\n"
+            KC_LIGHT_BLUE    "Kernel:             %s\n"
+            KC_LIGHT_MAGENTA "Architecture:       %s\n"
+            KC_LIGHT_YELLOW  "Uptime:             %lus\n"
+            KC_LIGHT_RED     "Memory:             %luMB\n"
+            KC_LIGHT_BROWN   "Shell:              singularity-shell\n"
+            "\n",
+            info->hostname, info->architecture, info->kernel_version,
+            info->architecture, info->uptime_seconds, info->memory_mb);
 }
 
 // Função para inicializar o sistema
@@ -239,9 +1834,28 @@ void kernel_init() {
     vga_puts("singularitty> ");
 }
 
-// Função principal do kernel
-void kernel_main() {
+// Função principal do kernel: chega aqui já em long mode, na metade alta,
+// vindo de _start
+void kernel_main(uint32_t magic, MultibootInfo* mbi) {
+    // GDT/TSS e IDT primeiro: daqui em diante uma falha vira tela de pânico
+    gdt_init();
+    interrupts_init();
+    
+    // Log pela COM1 (rodamos sem monitor)
+    serial_init();
+    timer_init();
+    clocksource_init();
+    
+    // Sem o magic do GRUB não há mapa de memória
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        memory_probe(mbi);
+    }
+    __asm__ volatile("sti");
+    
+    // Todo o banner sai em um único flush
+    vga_batch_begin();
     kernel_init();
+    vga_batch_end();
     
     // Loop principal do sistema
     while (1) {
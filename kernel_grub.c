@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdarg.h>
 #include <stddef.h>
 
 // Definições do Multiboot
@@ -6,6 +7,14 @@
 #define MULTIBOOT_HEADER_FLAGS 0x00000003
 #define MULTIBOOT_HEADER_CHECKSUM -(MULTIBOOT_HEADER_MAGIC + MULTIBOOT_HEADER_FLAGS)
 
+// O GRUB deixa este magic em EAX e o endereço das informações em EBX
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY 0x01      // mem_lower/mem_upper válidos
+#define MULTIBOOT_INFO_MMAP 0x40        // mmap_addr/mmap_length válidos
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_ACPI 3         // Tabelas ACPI (recuperável)
+#define MULTIBOOT_MEMORY_NVS 4
+
 // Definições de cores para VGA
 #define VGA_BLACK 0
 #define VGA_BLUE 1
@@ -25,36 +34,837 @@
 #define VGA_LIGHT_YELLOW 14
 #define VGA_WHITE 15
 
+// Escapes de cor para vga_puts/kprintf: ESC seguido de um dígito hexa com a
+// cor do texto (fundo preto). Ex.: kprintf(KC_LIGHT_CYAN "OS: %s\n", os)
+#define KC_ESCAPE '\033'
+#define KC_BLACK "\0330"
+#define KC_BLUE "\0331"
+#define KC_GREEN "\0332"
+#define KC_CYAN "\0333"
+#define KC_RED "\0334"
+#define KC_MAGENTA "\0335"
+#define KC_BROWN "\0336"
+#define KC_LIGHT_GREY "\0337"
+#define KC_DARK_GREY "\0338"
+#define KC_LIGHT_BLUE "\0339"
+#define KC_LIGHT_GREEN "\033A"
+#define KC_LIGHT_CYAN "\033B"
+#define KC_LIGHT_RED "\033C"
+#define KC_LIGHT_MAGENTA "\033D"
+#define KC_LIGHT_BROWN "\033E"
+#define KC_LIGHT_YELLOW "\033E"
+#define KC_WHITE "\033F"
+
+// Buffer de formatação do kprintf (na pilha)
+#define KPRINTF_BUFFER 512
+
 // Endereço base da memória VGA
 #define VGA_BASE 0xB8000
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 
+// Memória de texto completa: 32 KB em 0xB8000 (16384 células, 204 linhas)
+#define VGA_MEM_CELLS 16384
+#define VGA_MEM_ROWS (VGA_MEM_CELLS / VGA_WIDTH)
+
+// Registradores do CRTC usados para rolar a tela por hardware
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CRTC_START_HIGH 0x0C
+#define VGA_CRTC_START_LOW 0x0D
+
+// Histórico de rolagem (scrollback): potência de 2, 512 linhas = 80 KB
+#define SCROLLBACK_ROWS 512
+
+// Teclas, modificadores e tabelas do scancode set 1 (comuns aos kernels)
+#include "keymap.h"
+
+// Porta serial COM1 (UART 16550)
+#define COM1_PORT 0x3F8
+#define SERIAL_THR 0                // Transmit Holding Register (escrita)
+#define SERIAL_IER 1                // Interrupt Enable Register
+#define SERIAL_IIR 2                // Interrupt Identification (leitura)
+#define SERIAL_FCR 2                // FIFO Control (escrita)
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_IER_THRI 0x02        // Interrupção de THR vazio
+#define SERIAL_LSR_THRE 0x20        // THR (e FIFO de TX) vazio
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_BUFFER 4096       // Anel de transmissão (potência de 2)
+#define SERIAL_IRQ 4
+
+// Controladores de interrupção 8259 (PIC)
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define IRQ_BASE 0x20               // IRQ 0-15 remapeadas para os vetores 0x20-0x2F
+
+#define EFLAGS_IF 0x200
+
+// Seletores da GDT do kernel
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS 0x18
+#define GDT_DOUBLE_FAULT_TSS 0x20
+#define GDT_PERCPU 0x28             // Base em per_cpu[cpu]: o GS de cada CPU
+#define GDT_ENTRIES 6
+
+// Stubs de interrupção: 32 exceções + 16 IRQs do PIC + 16 vetores do LAPIC
+#define IDT_STUBS 64
+
+// PIT 8253/8254: o canal 0 roda em one-shot (modo 0) e só interrompe no
+// próximo prazo
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define PIT_ONESHOT_CH0 0x30        // Canal 0, byte baixo e alto, modo 0
+#define PIT_LATCH_CH0 0x00          // Congela o contador do canal 0 para leitura
+#define PIT_IRQ 0
+#define PIT_MAX_COUNT 60000         // Maior one-shot (~50 ms); a folga até 0xFFFF detecta a volta
+#define PIT_MAX_NS 50285706ULL      // PIT_MAX_COUNT em ns
+#define PIT_NS_MULT 54925401ULL     // 2^16 * 10^9 / 1193182 Hz
+#define PIT_TICKS_MULT 5124678ULL   // 2^32 * 1193182 / 10^9
+#define SLEEP_SPIN_NS (1u << TIMER_TICK_SHIFT)  // Esperas de menos de um tick da roda são em laço
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_ONESHOT_CH2 0xB0        // Canal 2, byte baixo e alto, modo 0
+#define PIT_GATE_PORT 0x61          // Bit 0: gate do canal 2, 1: alto-falante, 5: OUT2
+
+// Roda de timers hierárquica por CPU: o tick é 2^20 ns (~1,05 ms), o nível
+// 1 tem 256 slots de um tick e os 4 de cima 64 slots cada, cobrindo 2^32 ticks
+#define TIMER_TICK_SHIFT 20
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+#define TIMER_LOOKAHEAD 64          // Ticks olhados para o próximo prazo (> um one-shot)
+#define NR_CPUS 8
+
+// Softirqs: trabalho das IRQs adiado para a saída delas, com IF ligado
+#define SOFTIRQ_TIMER 0
+#define SOFTIRQ_COUNT 1
+
+// Calibração do TSC: melhor de 3 janelas de 10 ms do canal 2 do PIT
+#define TSC_CALIBRATE_COUNT 11932
+#define TSC_CALIBRATE_ROUNDS 3
+#define CPUID_EDX_TSC 0x10          // Folha 1: a CPU tem TSC
+#define CPUID_EDX_INVARIANT_TSC 0x100   // Folha 0x80000007: TSC com taxa constante
+
+// Marcas de tempo das fases do boot (comando boottime)
+#define BOOT_PHASES 16
+
+// Relógio de tempo real (RTC) na CMOS
+#define CMOS_INDEX 0x70
+#define CMOS_DATA 0x71
+#define RTC_SECONDS 0x00
+#define RTC_MINUTES 0x02
+#define RTC_HOURS 0x04
+#define RTC_DAY 0x07
+#define RTC_MONTH 0x08
+#define RTC_YEAR 0x09
+#define RTC_CENTURY 0x32            // Não é padrão; só vale se tiver um valor plausível
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+#define RTC_STATUS_C 0x0C           // Ler reconhece a IRQ8
+#define RTC_A_UIP 0x80              // Atualização em andamento
+#define RTC_B_24H 0x02
+#define RTC_B_BINARY 0x04           // Sem ele os campos vêm em BCD
+#define RTC_B_UIE 0x10              // IRQ a cada atualização (1 Hz)
+#define RTC_B_PIE 0x40              // IRQ periódica
+#define RTC_HOUR_PM 0x80            // Bit de PM no modo de 12 horas
+#define RTC_REG_COUNT 7
+#define RTC_IRQ 8
+#define RTC_C_PF 0x40               // Registrador C: foi a IRQ periódica
+#define RTC_PERIODIC_RATE 6         // 32768 >> (6 - 1) = 1024 Hz
+#define RTC_PERIODIC_HZ 1024
+
+// Alocador de frames físicos: um bit por frame de 4 KB (1 = livre)
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+#define PMM_LOW_MEMORY 0x100000         // O primeiro MB (BIOS, VGA) nunca é alocado
+#define PMM_MAX_ADDRESS 0xC0000000ULL   // RAM acima do alias do kernel fica fora do mapa identidade
+
+// Buddy allocator: blocos de 2^0 a 2^10 páginas (4 KB a 4 MB) em duas zonas
+#define BUDDY_MAX_ORDER 10
+#define ZONE_DMA 0                      // Abaixo de 16 MB (alcance do DMA do ISA)
+#define ZONE_NORMAL 1
+#define ZONE_COUNT 2
+#define ZONE_DMA_LIMIT_PFN 4096         // 16 MB em frames
+#define PAGE_FREE 0x01                  // Page é a cabeça de um bloco livre
+#define GFP_DMA 0x01                    // buddy_alloc: só da zona DMA
+#define GFP_THISNODE 0x02               // buddy_alloc_node: sem fallback para outros nós
+#define BUDDY_BENCH_BLOCKS 256
+#define PAGE_SLAB 0x02                  // Página de um slab (Page.slab aponta para ele)
+#define PAGE_LARGE 0x04                 // Cabeça de um kmalloc grande, direto do buddy
+
+// Slab: caches de objetos sobre blocos do buddy, com magazines por CPU
+#define CACHE_LINE 64
+#define SLAB_ALIGN 8
+#define SLAB_HEADER 32                  // Espaço do descritor no início do slab
+#define SLAB_MIN_OBJECTS 8              // O slab cresce de ordem até caber isso
+#define SLAB_KEEP_EMPTY 1               // Slabs vazios que cada cache guarda
+#define MAGAZINE_SIZE 15                // Objetos por magazine
+#define KMEM_MAX_CACHES 32
+#define CACHE_NO_MAGAZINES 0x01         // Só a camada de slabs (a cache de magazines)
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 2048
+#define KMALLOC_CACHES 8                // 16 B a 2 KB
+#define SLAB_BENCH_ROUNDS 10000
+#define SLAB_BENCH_BATCH 256
+#define SLAB_BENCH_BATCH_ROUNDS 16      // Lotes por CPU na medida em paralelo
+
+// ACPI: o RSDP fica na EBDA ou na ROM da BIOS; SRAT e SLIT dão a topologia NUMA
+#define ACPI_BDA_EBDA 0x40E             // Segmento da EBDA, guardado na BDA
+#define ACPI_BIOS_START 0xE0000
+#define ACPI_BIOS_END 0x100000
+#define ACPI_RSDP_V1_LENGTH 20          // Parte do RSDP coberta pelo checksum do ACPI 1.0
+#define ACPI_SRAT_ENTRIES 48            // Cabeçalho + 12 bytes reservados
+#define ACPI_SLIT_MATRIX 44             // Cabeçalho + número de localidades (64 bits)
+#define SRAT_CPU 0
+#define SRAT_MEMORY 1
+#define SRAT_X2APIC 2
+#define SRAT_ENABLED 0x01
+
+// NUMA: cada nó tem as suas zonas; os pedidos vão primeiro ao nó da CPU
+#define MAX_NUMNODES 8
+#define NUMA_MAX_RANGES 32              // Faixas de memória do SRAT
+#define NUMA_LOCAL_DISTANCE 10          // Distâncias padrão sem SLIT
+#define NUMA_REMOTE_DISTANCE 20
+#define NUMA_BENCH_BLOCKS 4             // Blocos de 4 MB por nó no numabench
+#define NUMA_BENCH_ROUNDS 4
+
+// Frames zerados: o laço ocioso enche um estoque limitado, zerando com
+// escritas não temporais para não tirar da cache o que está em uso
+#define ZERO_POOL_SIZE 64               // Frames zerados guardados (256 KB)
+#define ZERO_POOL_RESERVE 1024          // Frames livres no nó abaixo dos quais o idle não enche
+#define CPUID_EDX_SSE2 0x04000000       // Folha 1: a CPU tem movnti
+
+// Threads do kernel: round-robin dentro de cada prioridade, com a fatia de
+// tempo vencida pelo timer e a troca na saída da IRQ
+#define THREAD_STACK_SIZE 16384         // Como a pilha do boot
+#define THREAD_STACK_MAGIC 0x57AC0FF5   // Na base da pilha: some quando ela estoura
+#define THREAD_PRIORITIES 3
+#define THREAD_PRIO_LOW 0
+#define THREAD_PRIO_NORMAL 1
+#define THREAD_PRIO_HIGH 2
+#define THREAD_RUNNING 0
+#define THREAD_READY 1
+#define THREAD_BLOCKED 2
+#define THREAD_DEAD 3
+#define SCHED_SLICE_NS 10000000         // Fatia de tempo: 10 ms
+#define OVERLAY_PERIOD_MS 100           // Redesenho do indicador no canto da tela
+#define LOG_FLUSH_PERIOD_MS 20          // Saída pendente levada à tela e à serial
+#define SCHED_BENCH_ROUNDS 10000
+
+// SMP: as APs vêm do MADT e acordam com INIT-SIPI-SIPI num trampolim em
+// modo real; cada uma usa o timer do seu LAPIC (a BSP fica com o PIT)
+#define LAPIC_VECTOR_BASE 0x30          // Vetores do LAPIC, acima das IRQs do PIC
+#define LAPIC_TIMER_VECTOR 0x30
+#define LAPIC_RESCHED_VECTOR 0x31       // IPI: a CPU tem thread nova na fila
+#define LAPIC_SPURIOUS_VECTOR 0x3F
+#define LAPIC_ID 0x20
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+#define LAPIC_TIMER_DIV16 0x3
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_ICR_INIT 0x4500           // INIT, nível ligado
+#define LAPIC_ICR_STARTUP 0x4600        // SIPI; o vetor é a página do trampolim
+#define LAPIC_ICR_PENDING 0x1000        // A IPI anterior ainda não saiu
+#define LAPIC_CALIBRATE_NS 10000000     // Janela de calibração do timer: 10 ms
+#define MADT_ENTRIES 44                 // Cabeçalho + endereço do LAPIC + flags
+#define MADT_LAPIC 0
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_ENABLED 0x01
+#define MADT_ONLINE_CAPABLE 0x02
+#define CPUID_EDX_APIC 0x200
+#define SMP_TRAMPOLINE 0x7000           // Página baixa do trampolim (vetor da SIPI 0x07)
+#define SMP_BOOT_TIMEOUT_MS 100         // Espera de cada AP depois das SIPIs
+
+// Roubo de trabalho: deques Chase-Lev por CPU (threads prontas e itens de
+// trabalho) e um kworker em cada uma
+#define DEQUE_SIZE 256                  // Itens por deque (potência de 2)
+#define PARALLEL_BENCH_ORDER 10         // Buffer do parbench: 4 MB
+#define PARALLEL_BENCH_GRAIN 16         // Páginas por trecho (64 KB)
+#define PARALLEL_BENCH_ROUNDS 8
+
+// Paginação de 32 bits: páginas de 4 MB (PSE), 4 KB só onde é preciso
+#define PTE_PRESENT 0x001
+#define PTE_WRITE 0x002
+#define PTE_PWT 0x008                   // Sozinho escolhe a entrada 1 do PAT
+#define PTE_PCD 0x010
+#define PTE_LARGE 0x080                 // PDE de 4 MB
+#define PTE_GLOBAL 0x100                // Fica no TLB quando o CR3 muda
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_SHIFT 22
+#define KERNEL_VIRTUAL_BASE 0xC0000000  // Alias dos primeiros 4 MB na metade alta
+#define TLB_BENCH_BASE 0xD0000000       // Janela de 4 KB do tlbbench
+#define IOREMAP_BASE 0xE0000000         // Registradores de dispositivos
+#define IOREMAP_END 0xFF000000
+#define VGA_WINDOW_START 0xA0000
+#define VGA_WINDOW_END 0xC0000
+#define CR0_WP 0x00010000               // O kernel respeita páginas só de leitura
+#define CR0_PG 0x80000000
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+#define CPUID_EDX_PSE 0x08
+#define CPUID_EDX_PGE 0x2000
+#define CPUID_EDX_PAT 0x10000
+#define MSR_PAT 0x277
+#define PAT_WC 0x01
+#define PF_PRESENT 0x01                 // Erro do #PF: a página existia (proteção)
+#define PF_WRITE 0x02
+#define PF_RESERVED 0x08
+#define PF_FETCH 0x10
+#define TLB_BENCH_PAGES 4096            // 16 MB: bem mais que o TLB de 4 KB
+#define TLB_BENCH_ROUNDS 8
+
 // Portas do teclado
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
+#define KEYBOARD_IRQ 1
+#define KEYBOARD_RING_SIZE 256      // Scancodes pendentes (potência de 2)
 
 // Tamanho máximo do buffer de comando
 #define MAX_COMMAND_LENGTH 256
 
+// Limites de espera dos comandos do shell
+#define DEBUG_IDLE_SECONDS 30       // debug sai sozinho sem teclas
+#define SLEEP_MAX_SECONDS 3600
+
 // Estrutura para informações do sistema
 typedef struct {
     char hostname[32];
     char kernel_version[32];
     char cpu_info[64];
     uint32_t memory_mb;
+    uint32_t memory_free_mb;
     uint32_t uptime_seconds;
+    uint32_t node_count;
+    uint32_t node_total_mb[MAX_NUMNODES];
+    uint32_t node_free_mb[MAX_NUMNODES];
+    uint32_t cpu_count;
+    uint32_t cpu_apic[NR_CPUS];         // APIC ID das CPUs online
 } SystemInfo;
 
+// Nó de lista duplamente ligada e circular (a cabeça é um nó sem dono)
+typedef struct ListNode {
+    struct ListNode* next;
+    struct ListNode* prev;
+} ListNode;
+
+// Trava de espera ativa
+typedef struct {
+    volatile uint32_t locked;
+} Spinlock;
+
+// Timer de um disparo. Fica na lista de um slot da roda, então inserir e
+// cancelar são O(1).
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer* t);
+struct Timer {
+    ListNode entry;                     // Primeiro campo: o nó é o próprio timer
+    uint32_t expires;                   // Tick da roda em que vence
+    TimerCallback callback;             // Chamado no softirq de timers
+    struct TimerWheel* volatile wheel;  // Roda onde foi posto
+    volatile int pending;               // 1 enquanto está na roda
+    void* data;                         // Livre para o callback (timer_wake: a thread)
+};
+
+// Roda de timers de uma CPU
+typedef struct TimerWheel {
+    uint32_t clock;                     // Próximo tick a processar
+    uint32_t count;                     // Timers na roda
+    uint32_t next_tick;                 // Tick para o qual o PIT foi armado
+    Spinlock lock;                      // timer_cancel vem de outras CPUs
+    Timer* volatile running;            // Callback rodando agora (fora da trava)
+    ListNode tv1[TVR_SIZE];
+    ListNode tvn[TVN_LEVELS][TVN_SIZE];
+} TimerWheel;
+
+typedef void (*SoftirqHandler)();
+
+// Deque Chase-Lev de tamanho fixo: o dono põe e tira no fundo, as outras
+// CPUs só avançam o topo (com CAS)
+typedef struct {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    void* slots[DEQUE_SIZE];
+} __attribute__((aligned(CACHE_LINE))) Deque;
+
+// Thread do kernel. Só roda no anel 0, então o contexto salvo é o esp: o
+// resto fica na própria pilha (switch_to e, vindo de uma IRQ, o InterruptFrame)
+typedef struct Thread {
+    ListNode run;                       // Primeiro campo: nó da fila de prontas
+    ListNode all;                       // Lista de todas as threads
+    uint32_t esp;                       // Pilha salva por switch_to
+    uint8_t* stack;                     // Base da pilha (0 na ociosa, que usa a do boot)
+    void (*entry)(void* arg);
+    void* arg;
+    const char* name;
+    uint32_t id;
+    int priority;                       // THREAD_PRIO_x
+    volatile int state;                 // THREAD_x
+    uint32_t switches;                  // Vezes que ganhou a CPU
+    uint64_t runtime_ns;                // Tempo de CPU até a última troca
+    volatile uint32_t cpu;              // CPU onde rodou por último
+    int pinned;                         // Presa a cpu: nunca é roubada
+    volatile int on_cpu;                // 1 até sair de vez da CPU (switch_to terminado)
+    Spinlock lock;                      // state e wakeup: thread_wake vem de outras CPUs
+    volatile int wakeup;                // Acordada antes de bloquear (thread_wait volta na hora)
+} Thread;
+
+// Escalonador de uma CPU. As prontas livres ficam num deque por prioridade,
+// de onde as CPUs ociosas roubam; as presas à CPU (e as que não couberam no
+// deque) ficam nas listas travadas.
+typedef struct {
+    Deque ready[THREAD_PRIORITIES];     // Prontas livres: entram no fundo, saem pelo topo
+    Spinlock lock;                      // queues e mask: thread_wake vem de outras CPUs
+    ListNode queues[THREAD_PRIORITIES];
+    volatile uint32_t mask;             // Bit p: fila p tem threads
+    Thread* current;
+    Thread* previous;                   // Quem saiu na última troca (sched_finish)
+    Thread* idle;
+    int preempt_count;                  // > 0 proíbe a troca
+    volatile int need_resched;          // Troca pendente
+    Timer slice;                        // Fim da fatia de tempo da atual
+    uint64_t switch_start;              // ktime_ns da última troca
+    uint32_t switches;
+    uint32_t preemptions;               // Trocas na saída de uma IRQ
+    uint32_t steals;                    // Threads roubadas de outras CPUs
+} RunQueue;
+
+// Item de trabalho dos deques: run recebe o próprio item
+typedef struct Work {
+    void (*run)(struct Work* work);
+    void* data;
+    uint32_t begin;                     // Trecho de um parallel_for
+    uint32_t end;
+} Work;
+
+// Deque de trabalho de uma CPU
+typedef struct {
+    Deque deque;
+    uint32_t executed;                  // Itens rodados nesta CPU
+    uint32_t steals;                    // Itens que esta CPU roubou
+    uint32_t steal_misses;              // Roubos perdidos para outro ladrão
+} __attribute__((aligned(CACHE_LINE))) WorkDeque;
+
+typedef void (*ParallelFunc)(uint32_t begin, uint32_t end, void* arg);
+
+// Um parallel_for em andamento (na pilha de quem chamou)
+typedef struct {
+    ParallelFunc func;
+    void* arg;
+    uint32_t grain;                     // Maior trecho que não se divide mais
+    volatile uint32_t remaining;        // Índices ainda não processados
+} ParallelJob;
+
+// Soma do parbench: cada trecho soma as suas palavras no total
+typedef struct {
+    uint32_t base;
+    volatile uint32_t total;
+} ParallelSum;
+
+// Dados de uma CPU, apontados pela base do GS: cpu_id() é uma leitura só
+typedef struct PerCpu {
+    struct PerCpu* self;                // Primeiro campo: this_cpu() lê %gs:0
+    uint32_t cpu;
+    uint32_t apic_id;
+    volatile uint32_t softirq_pending;  // Softirqs marcados (um bit cada)
+    int softirq_active;                 // 1 enquanto softirq_run roda
+    uint8_t* stack;                     // Pilha do boot da AP (a thread ociosa dela)
+    volatile int online;                // A AP terminou ap_main e está no idle
+} __attribute__((aligned(CACHE_LINE))) PerCpu;
+
+// Dados que a BSP deixa no fim do trampolim para cada AP
+typedef struct {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;                     // Topo da pilha da AP
+    uint32_t cpu;                       // Argumento de ap_main
+    uint32_t entry;                     // ap_main
+} SmpTrampolineData;
+
+// Fim de uma fase do boot, em ciclos crus do TSC (convertidos depois da calibração)
+typedef struct {
+    const char* name;
+    uint64_t tsc;
+} BootPhase;
+
+// Descritor de um frame físico (mem_map). Só a primeira página de um bloco
+// livre está na free list, com a ordem do bloco.
+typedef struct {
+    ListNode list;                      // Primeiro campo: o nó é a própria Page
+    uint8_t order;
+    uint8_t flags;                      // PAGE_x
+    uint8_t node;                       // Nó NUMA do frame
+    void* slab;                         // Slab dono da página (PAGE_SLAB)
+} Page;
+
+// Zona de memória do buddy: uma free list por ordem e as estatísticas
+typedef struct {
+    const char* name;
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+    ListNode free_area[BUDDY_MAX_ORDER + 1];
+    uint32_t free_count[BUDDY_MAX_ORDER + 1];   // Blocos livres por ordem
+    uint32_t managed_pages;             // Páginas entregues à zona no boot
+    uint32_t free_pages;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t splits;
+    uint32_t merges;
+    uint32_t failures;
+} Zone;
+
+// Nó NUMA: as zonas do buddy com a memória dele e a ordem de fallback
+typedef struct {
+    Zone zones[ZONE_COUNT];
+    uint32_t pxm;                       // Domínio de proximidade do SRAT
+    uint32_t cpus;                      // CPUs do SRAT no nó
+    uint8_t fallback[MAX_NUMNODES];     // Nós por distância (o próprio primeiro)
+} NumaNode;
+
+// Faixa de memória física de um nó (do SRAT)
+typedef struct {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+    uint32_t node;
+} NumaRange;
+
+// Ponteiro para as tabelas do sistema (ACPI 2.0+ acrescenta a XSDT)
+typedef struct {
+    char signature[8];                  // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) AcpiRsdp;
+
+// Cabeçalho comum das tabelas ACPI
+typedef struct {
+    char signature[4];
+    uint32_t length;                    // Inclui o cabeçalho
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) AcpiHeader;
+
+// Entradas do SRAT: afinidade de CPU (APIC e x2APIC) e de memória
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t pxm_low;                    // Bits 7:0 do domínio
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t pxm_high[3];                // Bits 31:8 do domínio
+    uint32_t clock_domain;
+} __attribute__((packed)) SratCpu;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint32_t pxm;
+    uint16_t reserved0;
+    uint64_t base;
+    uint64_t length_bytes;
+    uint32_t reserved1;
+    uint32_t flags;
+    uint64_t reserved2;
+} __attribute__((packed)) SratMemory;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved0;
+    uint32_t pxm;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved1;
+} __attribute__((packed)) SratX2apic;
+
+// Entrada do MADT com um LAPIC (uma CPU)
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;                     // MADT_x
+} __attribute__((packed)) MadtLapic;
+
+// Descritor de um slab, no início do próprio bloco
+typedef struct {
+    ListNode list;                      // Na lista partial/full/empty da cache
+    struct KmemCache* cache;
+    void* free;                         // Objetos livres, ligados por dentro
+    uint32_t inuse;
+    uint32_t color;                     // Deslocamento do primeiro objeto
+} Slab;
+
+// Pilha de objetos prontos de uma cache (camada de magazines do Bonwick)
+typedef struct {
+    ListNode list;                      // No depot, quando não está numa CPU
+    uint32_t rounds;                    // Objetos guardados
+    void* objects[MAGAZINE_SIZE];
+} Magazine;
+
+// Magazines de uma CPU; cada uma em sua linha de cache
+typedef struct {
+    Magazine* loaded;                   // De onde sai o alloc e entra o free
+    Magazine* previous;                 // Sempre cheio ou vazio
+    uint32_t alloc_hits;                // Allocs resolvidos no magazine
+    uint32_t free_hits;
+} __attribute__((aligned(CACHE_LINE))) CpuCache;
+
+// Cache de objetos de um tamanho
+typedef struct KmemCache {
+    const char* name;
+    uint32_t size;
+    uint32_t flags;                     // CACHE_x
+    uint32_t order;                     // Ordem do buddy de cada slab
+    uint32_t per_slab;
+    uint32_t color_max;                 // Maior deslocamento de cor
+    uint32_t color_next;
+    ListNode partial;
+    ListNode full;
+    ListNode empty;
+    uint32_t empty_slabs;
+    uint32_t slabs;
+    uint32_t active;                    // Objetos fora dos slabs (incluindo magazines)
+    ListNode depot_full;                // Magazines cheios e vazios fora das CPUs
+    ListNode depot_empty;
+    uint32_t depot_full_count;
+    uint32_t depot_empty_count;
+    Spinlock lock;                      // Depot e slabs; o magazine da CPU não usa
+    CpuCache cpu[NR_CPUS];
+} KmemCache;
+
+// Informações que o GRUB passa em EBX (até o mapa de memória)
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;                 // KB abaixo de 1 MB
+    uint32_t mem_upper;                 // KB acima de 1 MB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) MultibootInfo;
+
+// Entrada do mapa de memória; 'size' não conta o próprio campo
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) MultibootMmapEntry;
+
+// Data e hora do relógio de parede (UTC)
+typedef struct {
+    uint32_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t weekday;                    // 0 = domingo
+} DateTime;
+
+// Consoles virtuais: cada um tem uma fatia da memória de texto (51 linhas)
+// e troca de console é só mudar o endereço inicial no CRTC (page flip)
+#define NUM_CONSOLES 4
+#define CONSOLE_MEM_ROWS (VGA_MEM_ROWS / NUM_CONSOLES)
+
+// Estado de um console virtual. A tela é uma janela de 25 linhas que começa
+// na linha 'origin' da memória de texto, dentro de [base, base + 51).
+// Toda escrita vai para a shadow e só as faixas modificadas de cada linha
+// visível (dirty spans) são copiadas para 0xB8000.
+typedef struct {
+    size_t base;                        // Primeira linha da fatia deste console
+    size_t origin;                      // Linha da memória no topo da tela
+    size_t x;
+    size_t y;
+    uint8_t color;
+    uint8_t dirty_start[VGA_HEIGHT];
+    uint8_t dirty_end[VGA_HEIGHT];
+    uint32_t dirty_rows;                // Um bit por linha suja
+    
+    // Anel com as linhas que saíram do topo da tela. Escrever só custa copiar
+    // a linha que sai; PgUp/PgDn redesenham a janela a partir daqui.
+    uint16_t scrollback[SCROLLBACK_ROWS * VGA_WIDTH];
+    uint32_t scrollback_head;           // Próxima linha a gravar no anel
+    uint32_t scrollback_count;          // Linhas válidas no anel
+    uint32_t scrollback_view;           // Linhas acima da tela ao vivo (0 = ao vivo)
+    
+    // Linha de comando sendo digitada neste console
+    char command_buffer[MAX_COMMAND_LENGTH];
+    int command_pos;
+} Console;
+
 // Variáveis globais
-static uint16_t* vga_buffer = (uint16_t*)VGA_BASE;
-static uint8_t vga_color = VGA_LIGHT_GREY | (VGA_BLACK << 4);
-static size_t vga_x = 0;
-static size_t vga_y = 0;
-static char command_buffer[MAX_COMMAND_LENGTH];
-static int command_pos = 0;
-static int cursor_x = 0;
-static int cursor_y = 0;
+static volatile uint16_t* vga_buffer = (volatile uint16_t*)VGA_BASE;
+static uint16_t vga_shadow[VGA_MEM_CELLS];  // Cópia em RAM dos 32 KB de texto
+static size_t vga_hw_origin = 0;            // Última origem programada no CRTC
+static int vga_batch_depth = 0;             // > 0 adia o flush do '\n'
+static int vga_writethrough = 0;            // 1 = escreve direto na VGA (modo antigo)
+
+static Console consoles[NUM_CONSOLES];
+static Console* con = &consoles[0];         // Console que recebe a saída
+static Console* con_visible = &consoles[0]; // Console mostrado na tela
+static Spinlock console_spinlock;           // Consoles, shadow e VGA entre CPUs
+static volatile int console_owner = -1;     // CPU com o console (-1: livre)
+static int console_depth = 0;               // Aninhamento na CPU dona
+static KeyDecoder keyboard_decoder;         // Shift/Ctrl/Alt/Caps do teclado
+static uint32_t console_switch_cycles = 0;  // Custo da última troca de console
+
+// Anel de transmissão da serial: o código escreve em head e a IRQ de THR
+// vazio consome de tail, 16 bytes (uma FIFO cheia) por interrupção
+static char serial_tx[SERIAL_TX_BUFFER];
+static volatile uint32_t serial_tx_head = 0;
+static volatile uint32_t serial_tx_tail = 0;
+static uint8_t serial_ier = 0;              // Cópia do IER (evita ler a porta)
+static int serial_fifo_size = 1;            // 16 se a FIFO do 16550 existir
+static int serial_present = 0;
+static int serial_mute = 0;                 // > 0 não espelha a tela na serial
+static Spinlock serial_lock;                // tail, IER e o polling (a IRQ4 vem em outra CPU)
+
+// Relógio: ticks do PIT fechados até o one-shot atual e as rodas de timers
+static uint64_t pit_ticks = 0;
+static uint32_t pit_programmed = 0;         // Contagem do one-shot atual
+static TimerWheel timer_wheels[NR_CPUS];
+
+// Handlers dos softirqs (os bits pendentes ficam em PerCpu)
+static SoftirqHandler softirq_handlers[SOFTIRQ_COUNT];
+
+// SMP: dados de cada CPU e o LAPIC, igual em todas no mesmo endereço
+static PerCpu per_cpu[NR_CPUS];
+static volatile uint32_t cpus_online = 1;
+static volatile uint32_t* lapic = 0;
+static uint32_t lapic_mult = 0;             // Contagens do timer do LAPIC por ns << 32
+static uint64_t smp_pat = 0;                // PAT da BSP, copiado nas APs
+
+// Roubo de trabalho: os deques, o kworker de cada CPU e quem está dormindo
+static WorkDeque work_deques[NR_CPUS];
+static Thread* work_threads[NR_CPUS];
+static KmemCache* work_cache = 0;
+static volatile uint32_t work_idle_mask = 0;    // Bit por CPU: kworker bloqueado
+static volatile uint32_t work_cpu_mask = 1;     // CPUs liberadas para o trabalho (parbench)
+
+// Escalonador: filas de prontas por CPU; TCBs e pilhas vêm de caches próprias
+static RunQueue run_queues[NR_CPUS];
+static volatile uint32_t sched_idle_mask = 0;   // Bit por CPU: ociosa em hlt
+static Thread idle_threads[NR_CPUS];        // O contexto do boot vira a thread ociosa
+static ListNode all_threads;
+static Spinlock threads_lock;               // all_threads, thread_count e os IDs
+static uint32_t thread_count = 0;
+static uint32_t thread_next_id = 0;
+static KmemCache* thread_cache = 0;
+static KmemCache* stack_cache = 0;
+static Thread* volatile keyboard_waiter = 0; // Thread esperando a IRQ1
+static Thread* overlay_task = 0;            // Thread do indicador (0: o shell desenha)
+
+// Indicador no canto da tela: o shell conta as teclas, o overlay desenha
+static int frame_counter = 0;
+static uint32_t frame_us = 0;               // Da tecla até a tela, em us
+
+// Clocksource: com TSC invariante, ns = tsc_base_ns + (TSC - tsc_base) * tsc_mult >> tsc_shift
+static uint64_t tsc_base = 0;               // TSC no instante tsc_base_ns
+static uint64_t tsc_base_ns = 0;
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 32;
+static uint32_t tsc_khz = 0;                // 0 = sem TSC
+static int tsc_invariant = 0;               // CPUID diz que a taxa é constante
+static int tsc_clocksource = 0;             // 1 = ktime_ns lê o TSC
+static BootPhase boot_phases[BOOT_PHASES];
+static int boot_phase_count = 0;
+
+// Relógio de parede: a CMOS é lida uma vez e o resto sai do ktime_ns
+static uint32_t rtc_boot_epoch = 0;         // Segundos desde 1970 lidos no boot
+static uint64_t rtc_boot_ns = 0;            // ktime_ns() dessa leitura
+static volatile uint32_t rtc_ticks = 0;     // IRQs periódicas do RTC
+
+// Anel de scancodes: a IRQ1 é a única que escreve (head) e o shell o único
+// que lê (tail), então não precisa de trava
+static uint8_t keyboard_ring[KEYBOARD_RING_SIZE];
+static volatile uint32_t keyboard_head = 0;
+static volatile uint32_t keyboard_tail = 0;
+static uint32_t keyboard_dropped = 0;       // Scancodes perdidos com o anel cheio
+
+// Alocador de frames: o bitmap fica na primeira RAM livre depois do kernel
+static uint32_t* pmm_bitmap = 0;
+static uint32_t pmm_words = 0;              // Palavras de 32 frames no bitmap
+static uint32_t pmm_hint = 0;               // Palavra onde a última busca parou
+static uint32_t pmm_total_frames = 0;       // Frames de RAM utilizável
+static uint32_t pmm_free_frames = 0;
+
+// Buddy: recebe os frames livres do bitmap no fim do boot
+static Page* mem_map = 0;                   // Um Page por frame físico
+static uint32_t mem_map_pages = 0;
+static int buddy_ready = 0;
+
+// ACPI: o RSDP é procurado uma vez, antes da paginação (0 se não há)
+static AcpiRsdp* acpi_rsdp = 0;
+static int acpi_probed = 0;
+
+// NUMA: sem SRAT há um nó só, com toda a memória
+static NumaNode numa_nodes[MAX_NUMNODES];
+static uint32_t numa_node_count = 1;
+static NumaRange numa_ranges[NUMA_MAX_RANGES];
+static uint32_t numa_range_count = 0;
+static uint8_t numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+static uint32_t cpu_node[NR_CPUS];          // Nó de cada CPU
+static uint8_t apic_node[256];              // Nó de cada APIC ID (SRAT), para as APs
+static Spinlock buddy_lock;                 // Zonas de todos os nós
+
+// Estoque de frames zerados: o idle enche, pmm_alloc_zeroed consome
+static uint32_t zero_pool[ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+static Spinlock zero_pool_lock;             // Todos os idles enchem o mesmo estoque
+static int zero_nt = 0;                     // Zera com movnti (SSE2)
+static uint32_t zero_hits = 0;              // Pedidos atendidos pelo estoque
+static uint32_t zero_misses = 0;            // Pedidos zerados na hora
+static uint32_t zero_refills = 0;           // Frames zerados no idle
+static uint64_t zero_refill_ns = 0;         // Tempo gasto nessas zeragens
+
+// Caches de objetos: as de kmalloc e as criadas por kmem_cache_create
+static KmemCache kmem_caches[KMEM_MAX_CACHES];
+static uint32_t kmem_cache_count = 0;
+static KmemCache* magazine_cache = 0;
+static KmemCache* kmalloc_caches[KMALLOC_CACHES];
+
+// Paginação: um diretório só; a tabela de 4 KB cobre os primeiros 4 MB
+static uint32_t page_directory[1024] __attribute__((aligned(FRAME_SIZE)));
+static uint32_t low_page_table[1024] __attribute__((aligned(FRAME_SIZE)));
+static int paging_enabled = 0;
+static int pat_wc = 0;                      // VGA em write-combining (senão uncached)
+static uint32_t identity_top = 0;           // Fim do mapa identidade
+static uint32_t ioremap_next = IOREMAP_BASE;
+static uint32_t page_tables = 0;            // Tabelas de 4 KB criadas por map_page
 
 // Header do Multiboot (deve estar no início do arquivo)
 __attribute__((section(".multiboot")))
@@ -69,221 +879,5007 @@ const struct {
     MULTIBOOT_HEADER_CHECKSUM
 };
 
-// Função para limpar a tela
-void vga_clear() {
-    for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+void kernel_main(uint32_t magic, MultibootInfo* mbi);
+
+// Fim da imagem do kernel (definido no kernel_grub.ld)
+extern char kernel_end[];
+
+// Página sem mapeamento logo abaixo da pilha do kernel
+extern char kernel_stack_guard[];
+
+// Ponto de entrada: monta a pilha do kernel e chama kernel_main com o que o
+// GRUB deixou em EAX e EBX
+__asm__(
+    ".pushsection .bss\n"
+    ".align 4096\n"
+    "kernel_stack_guard:\n"
+    "    .skip 4096\n"                     // Estouro da pilha vira #PF (e double fault)
+    "kernel_stack:\n"
+    "    .skip 16384\n"                    // 16 KB de pilha
+    "kernel_stack_top:\n"
+    ".popsection\n"
+    ".pushsection .text\n"
+    ".globl _start\n"
+    "_start:\n"
+    "    movl $kernel_stack_top, %esp\n"
+    "    xorl %ebp, %ebp\n"
+    "    pushl %ebx\n"                     // Informações do multiboot
+    "    pushl %eax\n"                     // Magic do bootloader
+    "    call kernel_main\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+    ".popsection\n"
+);
+
+// Função para ler byte de uma porta
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Função para escrever byte em uma porta
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Função para ler o contador de ciclos da CPU
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Função para executar CPUID (subfolha 0)
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+// Funções para ler e escrever um MSR
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+// Multiplica 64 por 32 bits e desloca 'shift' (1-32) usando só produtos
+// de 32x32, sem estourar no meio e sem libgcc
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint64_t lo = (uint64_t)(uint32_t)a * mul;
+    uint64_t hi = (uint64_t)(uint32_t)(a >> 32) * mul;
+    return (lo >> shift) + (hi << (32 - shift));
+}
+
+// Divide n (64 bits) por d (32 bits) com duas instruções divl, sem depender
+// do __udivdi3 da libgcc. Retorna o resto e deixa o quociente em n.
+static inline uint32_t div64_32(uint64_t* n, uint32_t d) {
+    uint32_t hi = (uint32_t)(*n >> 32);
+    uint32_t lo = (uint32_t)*n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    *n = ((uint64_t)q_hi << 32) | q_lo;
+    return r;
+}
+
+// Pequena pausa para o PIC (escreve na porta de diagnóstico 0x80)
+static inline void io_wait() {
+    outb(0x80, 0);
+}
+
+// Desliga as interrupções e devolve o EFLAGS anterior
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    __asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Religa as interrupções se estavam ligadas em irq_save
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile("sti" : : : "memory");
     }
-    vga_x = 0;
-    vga_y = 0;
-    cursor_x = 0;
-    cursor_y = 0;
 }
 
-// Função para definir cor
-void vga_set_color(uint8_t color) {
-    vga_color = color;
+// Diz se as interrupções estão ligadas
+static inline int irq_enabled() {
+    uint32_t flags;
+    __asm__ volatile("pushfl; popl %0" : "=r"(flags));
+    return (flags & EFLAGS_IF) != 0;
 }
 
-// Função para colocar caractere na tela
-void vga_putchar(char c) {
-    if (c == '\n') {
-        vga_x = 0;
-        vga_y++;
-        if (vga_y >= VGA_HEIGHT) {
-            // Scroll da tela
-            for (size_t i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
-                vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
-            }
-            for (size_t i = VGA_WIDTH * (VGA_HEIGHT - 1); i < VGA_WIDTH * VGA_HEIGHT; i++) {
-                vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
-            }
-            vga_y = VGA_HEIGHT - 1;
+// Pega a trava com as interrupções desligadas (uma IRQ na mesma CPU não
+// pode esperar por quem ela interrompeu)
+static inline uint32_t spin_lock_irqsave(Spinlock* lock) {
+    uint32_t flags = irq_save();
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        while (lock->locked) {
+            __asm__ volatile("pause");
         }
-        cursor_x = 0;
-        cursor_y = vga_y;
-        return;
+    }
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(Spinlock* lock, uint32_t flags) {
+    __sync_lock_release(&lock->locked);
+    irq_restore(flags);
+}
+
+// Pega e solta a trava sem mexer no IF (quem chama já desligou as interrupções)
+static inline void spin_lock(Spinlock* lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        while (lock->locked) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+static inline void spin_unlock(Spinlock* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+// Dados da CPU atual, pela base do GS que gdt_init carregou. Uma thread
+// livre pode ser roubada por outra CPU em qualquer troca, então a leitura é
+// refeita a cada chamada e só fica valendo com as interrupções desligadas
+// (ou com a troca proibida).
+static inline PerCpu* this_cpu() {
+    PerCpu* self;
+    __asm__ volatile("movl %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+// Número da CPU atual
+static inline int cpu_id() {
+    uint32_t cpu;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(cpu) : "i"(offsetof(PerCpu, cpu)));
+    return cpu;
+}
+
+// Nó NUMA da CPU atual
+static inline uint32_t numa_node_id() {
+    return cpu_node[cpu_id()];
+}
+
+// Fila de prontas da CPU atual
+static inline RunQueue* this_rq() {
+    return &run_queues[cpu_id()];
+}
+
+// Thread atual: achar a fila e ler o current tem que ser na mesma CPU
+static inline Thread* current_thread() {
+    uint32_t flags = irq_save();
+    Thread* t = this_rq()->current;
+    irq_restore(flags);
+    return t;
+}
+
+void schedule();
+
+// Função para fazer a troca pendente se aqui ela é permitida: com as
+// interrupções ligadas, fora de softirq e sem preempt_disable
+static inline void preempt_check() {
+    RunQueue* rq = this_rq();
+    if (rq->need_resched && rq->current && rq->preempt_count == 0 && !this_cpu()->softirq_active && irq_enabled()) {
+        schedule();
+    }
+}
+
+// Funções para proibir e voltar a permitir a troca de thread (seções que
+// usam dados da CPU atual); uma troca pedida no meio fica para o fim. O
+// contador é o da fila, então é incrementado sem a chance de a thread
+// trocar de CPU no meio.
+static inline void preempt_disable() {
+    uint32_t flags = irq_save();
+    this_rq()->preempt_count++;
+    irq_restore(flags);
+}
+
+static inline void preempt_enable() {
+    __asm__ volatile("" : : : "memory");
+    this_rq()->preempt_count--;
+    preempt_check();
+}
+
+// Descritor de segmento da GDT
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;                // Limite 19:16 e flags (4 KB, 32 bits)
+    uint8_t base_high;
+} __attribute__((packed)) GdtEntry;
+
+// Task State Segment de 32 bits
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0, ss0;                 // Pilha usada ao entrar no anel 0
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3;
+    uint32_t eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) Tss;
+
+// Entrada da IDT (interrupt ou task gate de 32 bits)
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed)) IdtEntry;
+
+// Operando de lgdt/lidt
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) DescriptorPointer;
+
+// Registradores salvos por isr_common, na ordem em que ficam na pilha
+typedef struct {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;    // pushal
+    uint32_t vector, error;
+    uint32_t eip, cs, eflags;                           // Empilhados pela CPU
+} InterruptFrame;
+
+typedef void (*InterruptHandler)(InterruptFrame* frame);
+
+static GdtEntry gdt[NR_CPUS][GDT_ENTRIES]; // Uma GDT por CPU: as TSS e o GS são dela
+static Tss tss[NR_CPUS];                    // TSS do kernel
+static Tss double_fault_tss[NR_CPUS];       // Tarefa que trata o #DF
+static uint8_t double_fault_stack[NR_CPUS][4096] __attribute__((aligned(16)));
+static IdtEntry idt[256];
+static InterruptHandler interrupt_handlers[256];
+static uint16_t pic_mask = 0xFFFF;          // Cópia das máscaras (evita ler o PIC)
+
+// Pontos de entrada gerados em assembly, logo abaixo
+extern const uint32_t isr_stub_table[IDT_STUBS];
+extern uint8_t kernel_stack_top[];
+void interrupt_dispatch(InterruptFrame* frame);
+static void double_fault_task();
+void keyboard_irq(InterruptFrame* frame);
+void serial_irq(InterruptFrame* frame);
+void thread_wake(Thread* t);
+static void thread_wait();
+
+// Cada stub empilha um código de erro (0 quando a CPU não empilha um) e o
+// número do vetor, então todas as entradas chegam iguais em isr_common
+__asm__(
+    ".pushsection .text\n"
+    ".macro ISR_NOERR vec\n"
+    "isr\\vec:\n"
+    "    pushl $0\n"
+    "    pushl $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".macro ISR_ERR vec\n"
+    "isr\\vec:\n"
+    "    pushl $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,9,15,16,18,19,20,22,23,24,25,26,27,28,31\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 8,10,11,12,13,14,17,21,29,30\n"
+    "    ISR_ERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    "isr_common:\n"
+    "    pushal\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    pushl %fs\n"
+    "    pushl %gs\n"
+    "    movw $0x10, %ax\n"                 // GDT_KERNEL_DATA
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    cld\n"
+    "    pushl %esp\n"                      // InterruptFrame*
+    "    call interrupt_dispatch\n"
+    "    addl $4, %esp\n"
+    "    popl %gs\n"
+    "    popl %fs\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    popal\n"
+    "    addl $8, %esp\n"                   // Vetor e código de erro
+    "    iretl\n"
+    ".popsection\n"
+    ".pushsection .rodata\n"
+    ".align 4\n"
+    "isr_stub_table:\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23\n"
+    "    .long isr\\vec\n"
+    ".endr\n"
+    ".irp vec, 24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    .long isr\\vec\n"
+    ".endr\n"
+    ".irp vec, 48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63\n"
+    "    .long isr\\vec\n"
+    ".endr\n"
+    ".popsection\n"
+);
+
+// Função para preencher um descritor da GDT da CPU 'cpu'
+static void gdt_set(int cpu, int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    GdtEntry* entry = &gdt[cpu][index];
+    entry->limit_low = limit & 0xFFFF;
+    entry->base_low = base & 0xFFFF;
+    entry->base_mid = (base >> 16) & 0xFF;
+    entry->access = access;
+    entry->granularity = (flags & 0xF0) | ((limit >> 16) & 0x0F);
+    entry->base_high = base >> 24;
+}
+
+// Função para carregar a GDT da CPU 'cpu' (código/dados planos de 4 GB, as
+// duas TSS e o segmento dos dados per-CPU) no lugar da que o GRUB deixou
+// (ou da do trampolim, numa AP). O GS fica apontando para per_cpu[cpu].
+void gdt_init(int cpu) {
+    Tss* task = &tss[cpu];
+    Tss* df = &double_fault_tss[cpu];
+    PerCpu* self = &per_cpu[cpu];
+    
+    self->self = self;
+    self->cpu = cpu;
+    
+    gdt_set(cpu, 0, 0, 0, 0, 0);
+    gdt_set(cpu, GDT_KERNEL_CODE >> 3, 0, 0xFFFFF, 0x9A, 0xC0);
+    gdt_set(cpu, GDT_KERNEL_DATA >> 3, 0, 0xFFFFF, 0x92, 0xC0);
+    gdt_set(cpu, GDT_TSS >> 3, (uint32_t)task, sizeof(Tss) - 1, 0x89, 0x00);
+    gdt_set(cpu, GDT_DOUBLE_FAULT_TSS >> 3, (uint32_t)df, sizeof(Tss) - 1, 0x89, 0x00);
+    gdt_set(cpu, GDT_PERCPU >> 3, (uint32_t)self, sizeof(PerCpu) - 1, 0x92, 0x40);
+    
+    task->ss0 = GDT_KERNEL_DATA;
+    task->esp0 = cpu ? (uint32_t)(self->stack + THREAD_STACK_SIZE) : (uint32_t)kernel_stack_top;
+    task->iomap_base = sizeof(Tss);         // Sem bitmap de I/O
+    
+    // Tarefa do #DF: começa em double_fault_task com a pilha própria
+    df->eip = (uint32_t)double_fault_task;
+    df->esp = (uint32_t)(double_fault_stack[cpu] + sizeof(double_fault_stack[cpu]));
+    df->eflags = 0x2;
+    df->cs = GDT_KERNEL_CODE;
+    df->ds = df->es = df->ss = df->fs = GDT_KERNEL_DATA;
+    df->gs = GDT_PERCPU;
+    df->iomap_base = sizeof(Tss);
+    __asm__ volatile("mov %%cr3, %0" : "=r"(df->cr3));
+    
+    DescriptorPointer gdtr = { sizeof(gdt[cpu]) - 1, (uint32_t)gdt[cpu] };
+    __asm__ volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "movw %w2, %%ds\n"
+        "movw %w2, %%es\n"
+        "movw %w2, %%fs\n"
+        "movw %w3, %%gs\n"
+        "movw %w2, %%ss\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_PERCPU) : "memory");
+    __asm__ volatile("ltr %w0" : : "r"(GDT_TSS));
+}
+
+// Função para preencher uma entrada da IDT
+static void idt_set_gate(int vector, uint32_t offset, uint16_t selector, uint8_t type_attr) {
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].selector = selector;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = type_attr;
+    idt[vector].offset_high = offset >> 16;
+}
+
+// Função para remapear o PIC para os vetores 0x20-0x2F com tudo mascarado
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11); io_wait();   // ICW1: inicialização com ICW4
+    outb(PIC2_COMMAND, 0x11); io_wait();
+    outb(PIC1_DATA, IRQ_BASE); io_wait();  // ICW2: vetor base
+    outb(PIC2_DATA, IRQ_BASE + 8); io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();      // ICW3: escravo na IRQ2
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();      // ICW4: modo 8086
+    outb(PIC2_DATA, 0x01); io_wait();
+    
+    pic_mask = 0xFFFF;
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// Função para liberar uma IRQ no PIC (as do escravo liberam também a IRQ2)
+static void pic_unmask(int irq) {
+    uint16_t mask = pic_mask & ~(1 << irq);
+    if (irq >= 8) {
+        mask &= ~(1 << 2);
+    }
+    if ((mask ^ pic_mask) & 0x00FF) {
+        outb(PIC1_DATA, mask & 0xFF);
+    }
+    if ((mask ^ pic_mask) & 0xFF00) {
+        outb(PIC2_DATA, mask >> 8);
+    }
+    pic_mask = mask;
+}
+
+// Função para avisar o fim de uma IRQ: o escravo só é tocado nas IRQs 8-15
+static inline void pic_eoi(int irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// Função para ver se a IRQ está em serviço (ISR do PIC), para achar as espúrias
+static int pic_in_service(int irq) {
+    uint16_t port = irq >= 8 ? PIC2_COMMAND : PIC1_COMMAND;
+    outb(port, 0x0B);                      // OCW3: próxima leitura devolve o ISR
+    return (inb(port) >> (irq & 7)) & 1;
+}
+
+// Função para registrar o handler de um vetor (exceções)
+void interrupt_install(int vector, InterruptHandler handler) {
+    interrupt_handlers[vector] = handler;
+}
+
+// Função para registrar o handler de uma IRQ e liberá-la no PIC
+void irq_install(int irq, InterruptHandler handler) {
+    interrupt_handlers[IRQ_BASE + irq] = handler;
+    pic_unmask(irq);
+}
+
+// Função para carregar a IDT (a mesma em todas as CPUs)
+static void idt_load() {
+    DescriptorPointer idtr = { sizeof(idt) - 1, (uint32_t)idt };
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+}
+
+// Função para carregar a IDT e remapear o PIC (interrupções ainda desligadas)
+void interrupts_init() {
+    for (int i = 0; i < IDT_STUBS; i++) {
+        idt_set_gate(i, isr_stub_table[i], GDT_KERNEL_CODE, 0x8E);  // Interrupt gate, DPL 0
     }
     
-    if (vga_x >= VGA_WIDTH) {
-        vga_x = 0;
-        vga_y++;
+    // O #DF troca de tarefa: roda com pilha própria mesmo se a do kernel estourou
+    idt_set_gate(8, 0, GDT_DOUBLE_FAULT_TSS, 0x85);                 // Task gate
+    
+    idt_load();
+    pic_remap();
+}
+
+// Função para ler quantos ticks do PIT já correram no one-shot atual.
+// Em modo 0 o contador desce até 0, levanta a IRQ0 e segue descendo a
+// partir de 0xFFFF; como nenhum one-shot passa de PIT_MAX_COUNT, um valor
+// acima do programado quer dizer que o contador já deu a volta.
+static uint32_t pit_elapsed() {
+    outb(PIT_COMMAND, PIT_LATCH_CH0);
+    uint16_t count = inb(PIT_CHANNEL0);
+    count |= (uint16_t)inb(PIT_CHANNEL0) << 8;
+    
+    if (count <= pit_programmed) {
+        return pit_programmed - count;
+    }
+    return pit_programmed + (0x10000 - count);
+}
+
+// Função para converter ticks do PIT em nanossegundos sem divisão de 64 bits:
+// ns = ticks * 2^16 * 10^9 / 1193182 >> 16, em duas partes para não estourar
+static inline uint64_t pit_ticks_to_ns(uint64_t ticks) {
+    return (ticks >> 16) * PIT_NS_MULT + (((ticks & 0xFFFF) * PIT_NS_MULT) >> 16);
+}
+
+// Função para converter nanossegundos em ticks do PIT (arredonda para cima),
+// limitada a um one-shot: ticks = ns * 1193182 / 10^9 = ns * PIT_TICKS_MULT >> 32
+static inline uint32_t ns_to_pit_ticks(uint64_t ns) {
+    if (ns >= PIT_MAX_NS) {
+        return PIT_MAX_COUNT;
+    }
+    uint32_t ticks = (uint32_t)((ns * PIT_TICKS_MULT) >> 32) + 1;
+    return ticks < PIT_MAX_COUNT ? ticks : PIT_MAX_COUNT;
+}
+
+// Relógio do PIT em nanossegundos desde o timer_init
+static uint64_t pit_clock_ns() {
+    uint32_t flags = irq_save();
+    uint64_t ticks = pit_ticks + pit_elapsed();
+    irq_restore(flags);
+    return pit_ticks_to_ns(ticks);
+}
+
+// Função para converter ciclos do TSC em nanossegundos
+static inline uint64_t tsc_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+// Relógio monotônico em nanossegundos desde o timer_init. Com o TSC
+// invariante é só um rdtsc, uma multiplicação e um shift; sem ele, lê o PIT.
+uint64_t ktime_ns() {
+    if (tsc_clocksource) {
+        return tsc_base_ns + tsc_to_ns(rdtsc() - tsc_base);
     }
+    return pit_clock_ns();
+}
+
+// Função para marcar o fim de uma fase do boot. Guarda o TSC cru, então
+// vale também antes de o TSC ser calibrado.
+void boot_phase(const char* name) {
+    if (boot_phase_count < BOOT_PHASES) {
+        boot_phases[boot_phase_count].name = name;
+        boot_phases[boot_phase_count].tsc = rdtsc();
+        boot_phase_count++;
+    }
+}
+
+// Função para medir quantos ciclos do TSC cabem em TSC_CALIBRATE_COUNT ticks
+// do PIT. Usa o canal 2 (o do alto-falante), que conta sem gerar IRQ, e
+// espera o OUT2 subir na porta 0x61.
+static uint64_t tsc_measure() {
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    outb(PIT_COMMAND, PIT_ONESHOT_CH2);
+    outb(PIT_CHANNEL2, TSC_CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, TSC_CALIBRATE_COUNT >> 8);
+    
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {}
+    uint64_t cycles = rdtsc() - start;
     
-    if (vga_y >= VGA_HEIGHT) {
-        vga_y = 0;
+    outb(PIT_GATE_PORT, gate);
+    return cycles;
+}
+
+// Função para calibrar o TSC contra o PIT e, se o CPUID garante que ele é
+// invariante, passar ktime_ns para o TSC. Chamada depois do timer_init.
+void clocksource_init() {
+    uint32_t a, b, c, d;
+    
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_EDX_TSC)) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    
+    // A menor medida é a que menos sofreu com SMIs e com o emulador
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < TSC_CALIBRATE_ROUNDS; i++) {
+        uint64_t cycles = tsc_measure();
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    
+    // kHz = ciclos * 1193182 / (contagem * 1000)
+    uint64_t khz = best * PIT_FREQUENCY;
+    div64_32(&khz, TSC_CALIBRATE_COUNT * 1000);
+    tsc_khz = (uint32_t)khz;
+    
+    // ns = ciclos * 10^6 / kHz: usa o maior shift em que o multiplicador
+    // ainda cabe em 32 bits
+    tsc_shift = 32;
+    while (1) {
+        uint64_t mult = 1000000ULL << tsc_shift;
+        div64_32(&mult, tsc_khz);
+        if ((mult >> 32) == 0) {
+            tsc_mult = (uint32_t)mult;
+            break;
+        }
+        tsc_shift--;
+    }
+    
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        tsc_invariant = (d & CPUID_EDX_INVARIANT_TSC) != 0;
+    }
+    
+    // O TSC continua de onde o PIT estava, então os prazos já na fila valem
+    if (tsc_invariant) {
+        tsc_base_ns = pit_clock_ns();
+        tsc_base = rdtsc();
+        tsc_clocksource = 1;
+    }
+    irq_restore(flags);
+}
+
+// Funções da lista circular com cabeça usada pelos slots da roda
+static inline void list_init(ListNode* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const ListNode* head) {
+    return head->next == head;
+}
+
+static inline void list_add_tail(ListNode* head, ListNode* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void list_del(ListNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+// Função para marcar um softirq: ele roda na saída da IRQ atual
+static inline void softirq_raise(int n) {
+    this_cpu()->softirq_pending |= 1u << n;
+}
+
+// Função para registrar o handler de um softirq
+void softirq_install(int n, SoftirqHandler handler) {
+    softirq_handlers[n] = handler;
+}
+
+// Função para rodar os softirqs pendentes na saída de uma IRQ, já com o
+// EOI dado e as interrupções ligadas. Uma IRQ que chegue enquanto eles
+// rodam só marca o bit, e o laço a atende antes de sair.
+static void softirq_run() {
+    PerCpu* cpu = this_cpu();
+    if (cpu->softirq_active) {
+        return;
+    }
+    cpu->softirq_active = 1;
+    
+    while (cpu->softirq_pending) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        __asm__ volatile("sti" : : : "memory");
+        for (int n = 0; n < SOFTIRQ_COUNT; n++) {
+            if ((pending & (1u << n)) && softirq_handlers[n]) {
+                softirq_handlers[n]();
+            }
+        }
+        __asm__ volatile("cli" : : : "memory");
+    }
+    cpu->softirq_active = 0;
+}
+
+// Roda de timers da CPU atual
+static inline TimerWheel* this_wheel() {
+    return &timer_wheels[cpu_id()];
+}
+
+// Função para converter ns de ktime_ns no tick da roda
+static inline uint32_t ns_to_tick(uint64_t ns) {
+    return (uint32_t)(ns >> TIMER_TICK_SHIFT);
+}
+
+// Função para pôr o timer no slot que vence no tick dele: o nível 1 guarda
+// os próximos 256 ticks um por slot; cada nível acima cobre 64 vezes mais
+// com slots 64 vezes mais largos. Chamada com as interrupções desligadas.
+static void wheel_enqueue(TimerWheel* w, Timer* t) {
+    uint32_t expires = t->expires;
+    uint32_t delta = expires - w->clock;
+    ListNode* slot;
+    
+    if ((int32_t)delta < 0) {
+        // Já venceu: roda no próximo tick processado
+        slot = &w->tv1[w->clock & TVR_MASK];
+    } else if (delta < TVR_SIZE) {
+        slot = &w->tv1[expires & TVR_MASK];
+    } else {
+        int level = 0;
+        while (level < TVN_LEVELS - 1 && delta >= (1u << (TVR_BITS + (level + 1) * TVN_BITS))) {
+            level++;
+        }
+        slot = &w->tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    list_add_tail(slot, &t->entry);
+}
+
+// Função para descer os timers de um slot de nível alto para os níveis de
+// baixo (cascata), quando o nível 1 dá a volta
+static void wheel_cascade(TimerWheel* w, int level, uint32_t index) {
+    ListNode* head = &w->tvn[level][index];
+    
+    while (!list_empty(head)) {
+        Timer* t = (Timer*)head->next;
+        list_del(&t->entry);
+        wheel_enqueue(w, t);
+    }
+}
+
+// Função para achar o próximo tick com trabalho: o primeiro slot ocupado do
+// nível 1 ou a próxima volta dele (que pode descer timers dos níveis altos).
+// Olha no máximo TIMER_LOOKAHEAD ticks, mais do que cabe num one-shot do PIT.
+static uint32_t wheel_next_tick(TimerWheel* w) {
+    for (uint32_t i = 0; i < TIMER_LOOKAHEAD; i++) {
+        uint32_t tick = w->clock + i;
+        uint32_t index = tick & TVR_MASK;
+        if (index == 0 || !list_empty(&w->tv1[index])) {
+            return tick;
+        }
+    }
+    return w->clock + TIMER_LOOKAHEAD;
+}
+
+// Registradores do LAPIC (mapeado com ioremap pelo smp_init)
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / sizeof(uint32_t)];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / sizeof(uint32_t)] = value;
+}
+
+// Função para mandar uma IPI (ou INIT/SIPI) para a CPU 'apic_id'. Com as
+// interrupções desligadas: o ICR é de quem está mandando.
+static void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+}
+
+// Função para programar o one-shot do timer do LAPIC nas APs (a BSP usa o
+// PIT): vence no próximo tick com trabalho, e sem timers fica parado
+static void lapic_timer_program(TimerWheel* w) {
+    uint32_t count = 0;
+    
+    if (w->count) {
+        uint64_t now = ktime_ns();
+        w->next_tick = wheel_next_tick(w);
+        int32_t ahead = (int32_t)(w->next_tick - ns_to_tick(now));
+        count = 1;
+        if (ahead > 0) {
+            uint64_t wait = ((uint64_t)ahead << TIMER_TICK_SHIFT)
+                          - (now & ((1u << TIMER_TICK_SHIFT) - 1));
+            count = (uint32_t)mul_u64_u32_shr(wait, lapic_mult, 32) + 1;
+        }
+    }
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+// Função para programar o próximo one-shot. Com timers na roda ele vence no
+// próximo tick com trabalho. Sem nenhum, o PIT fica parado se o relógio é o
+// TSC; se é o próprio PIT, arma o máximo do contador para o relógio não
+// perder uma volta. As APs usam o timer do LAPIC. Chamada com as
+// interrupções desligadas.
+static void timer_program(TimerWheel* w) {
+    uint64_t now;
+    
+    if (cpu_id() != 0) {
+        lapic_timer_program(w);
+        return;
+    }
+    if (tsc_clocksource) {
+        if (w->count == 0) {
+            return;
+        }
+        now = ktime_ns();
+    } else {
+        // Fecha os ticks do one-shot anterior antes de trocar o contador
+        if (pit_programmed) {
+            pit_ticks += pit_elapsed();
+        }
+        now = pit_ticks_to_ns(pit_ticks);
+    }
+    
+    uint32_t count = PIT_MAX_COUNT;
+    if (w->count) {
+        w->next_tick = wheel_next_tick(w);
+        int32_t ahead = (int32_t)(w->next_tick - ns_to_tick(now));
+        if (ahead <= 0) {
+            count = 1;
+        } else {
+            // Até o início do tick: os ticks inteiros menos o que já correu do atual
+            uint64_t wait = ((uint64_t)ahead << TIMER_TICK_SHIFT)
+                          - (now & ((1u << TIMER_TICK_SHIFT) - 1));
+            count = ns_to_pit_ticks(wait);
+        }
+    }
+    
+    pit_programmed = count;
+    outb(PIT_COMMAND, PIT_ONESHOT_CH0);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+// Softirq dos timers: processa os ticks da roda até agora, com cascata a
+// cada volta do nível 1, e chama os callbacks com as interrupções ligadas
+static void timer_softirq() {
+    TimerWheel* w = this_wheel();
+    uint32_t now = ns_to_tick(ktime_ns());
+    uint32_t flags = spin_lock_irqsave(&w->lock);
+    
+    while ((int32_t)(now - w->clock) >= 0) {
+        // Roda vazia: não há o que descer nem disparar, pula direto para agora
+        if (w->count == 0) {
+            w->clock = now + 1;
+            break;
+        }
+        
+        uint32_t index = w->clock & TVR_MASK;
+        if (index == 0) {
+            for (int level = 0; level < TVN_LEVELS; level++) {
+                uint32_t slot = (w->clock >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+                wheel_cascade(w, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+        w->clock++;
+        
+        ListNode* head = &w->tv1[index];
+        while (!list_empty(head)) {
+            Timer* t = (Timer*)head->next;
+            list_del(&t->entry);
+            t->pending = 0;
+            w->count--;
+            
+            // Fora da trava: o callback pode pôr timers; timer_cancel de
+            // outra CPU espera por ele em 'running'
+            w->running = t;
+            spin_unlock_irqrestore(&w->lock, flags);
+            t->callback(t);
+            flags = spin_lock_irqsave(&w->lock);
+            w->running = 0;
+        }
+    }
+    
+    timer_program(w);
+    spin_unlock_irqrestore(&w->lock, flags);
+}
+
+// Handler da IRQ0 (e do timer do LAPIC nas APs): o trabalho fica para o
+// softirq de timers
+void timer_irq(InterruptFrame* frame) {
+    (void)frame;
+    softirq_raise(SOFTIRQ_TIMER);
+}
+
+// Função para agendar 't' para o instante 'deadline' (ns de ktime_ns) na
+// roda da CPU atual. O tick é arredondado para cima, então o callback nunca
+// roda antes do prazo.
+void timer_add(Timer* t, uint64_t deadline, TimerCallback callback) {
+    uint32_t flags = irq_save();
+    TimerWheel* w = this_wheel();
+    spin_lock(&w->lock);
+    
+    // Com a roda vazia o relógio dela pode ter ficado para trás (tickless)
+    if (w->count == 0) {
+        w->clock = ns_to_tick(ktime_ns());
+    }
+    
+    t->expires = ns_to_tick(deadline + (1u << TIMER_TICK_SHIFT) - 1);
+    t->callback = callback;
+    t->wheel = w;
+    t->pending = 1;
+    wheel_enqueue(w, t);
+    w->count++;
+    
+    // Só reprograma o PIT se o novo timer vence antes do one-shot armado
+    if (w->count == 1 || (int32_t)(t->expires - w->next_tick) < 0) {
+        timer_program(w);
+    }
+    spin_unlock_irqrestore(&w->lock, flags);
+}
+
+// Função para tirar 't' da roda em O(1) (não faz nada se já disparou). A
+// roda pode ser de outra CPU, onde ele pode estar disparando agora: aí
+// espera o callback acabar, a não ser que seja ele quem cancela.
+void timer_cancel(Timer* t) {
+    TimerWheel* w = t->wheel;
+    if (!w) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&w->lock);
+    if (t->pending) {
+        list_del(&t->entry);
+        w->count--;
+        t->pending = 0;
+    }
+    spin_unlock_irqrestore(&w->lock, flags);
+    
+    if (w != this_wheel()) {
+        while (w->running == t) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+// Callback dos timers de espera: acorda a thread que dorme nele
+static void timer_wake(Timer* t) {
+    thread_wake(t->data);
+}
+
+// Função para dormir até 'ns' nanossegundos. Esperas curtas demais para
+// valer uma IRQ leem o relógio em laço; as outras bloqueiam a thread (ou
+// dormem em hlt, sem threads).
+void ksleep_ns(uint64_t ns) {
+    uint64_t deadline = ktime_ns() + ns;
+    
+    if (ns < SLEEP_SPIN_NS) {
+        while (ktime_ns() < deadline) {
+            __asm__ volatile("pause");
+        }
+        return;
+    }
+    
+    Timer t;
+    t.data = current_thread();
+    timer_add(&t, deadline, timer_wake);
+    while (1) {
+        __asm__ volatile("cli" : : : "memory");
+        if (!t.pending) {
+            break;
+        }
+        thread_wait();
+    }
+    __asm__ volatile("sti" : : : "memory");
+    // O callback pode ainda estar rodando na CPU da roda (a thread pode ter
+    // trocado de CPU): o timer está na pilha
+    timer_cancel(&t);
+}
+
+void ksleep_us(uint32_t us) {
+    ksleep_ns((uint64_t)us * 1000);
+}
+
+void ksleep_ms(uint32_t ms) {
+    ksleep_ns((uint64_t)ms * 1000000);
+}
+
+// Função para montar as rodas de timers e ligar o PIT em one-shot na IRQ0
+// (o relógio começa em zero)
+void timer_init() {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        TimerWheel* w = &timer_wheels[cpu];
+        for (int i = 0; i < TVR_SIZE; i++) {
+            list_init(&w->tv1[i]);
+        }
+        for (int level = 0; level < TVN_LEVELS; level++) {
+            for (int i = 0; i < TVN_SIZE; i++) {
+                list_init(&w->tvn[level][i]);
+            }
+        }
+    }
+    softirq_install(SOFTIRQ_TIMER, timer_softirq);
+    
+    uint32_t flags = irq_save();
+    timer_program(this_wheel());
+    irq_install(PIT_IRQ, timer_irq);
+    irq_restore(flags);
+}
+
+// Função para ler um registrador da CMOS (o índice e o dado precisam sair
+// juntos: quem chama fica com as interrupções desligadas se a IRQ8 estiver ativa)
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_INDEX, reg);
+    return inb(CMOS_DATA);
+}
+
+// Função para escrever um registrador da CMOS
+static void cmos_write(uint8_t reg, uint8_t val) {
+    outb(CMOS_INDEX, reg);
+    outb(CMOS_DATA, val);
+}
+
+static inline uint8_t bcd_to_bin(uint8_t val) {
+    return (val & 0x0F) + (val >> 4) * 10;
+}
+
+// Registradores lidos de uma vez, na ordem de rtc_read
+static const uint8_t rtc_regs[RTC_REG_COUNT] = {
+    RTC_SECONDS, RTC_MINUTES, RTC_HOURS, RTC_DAY, RTC_MONTH, RTC_YEAR, RTC_CENTURY
+};
+
+// Função para ler todos os registradores de data/hora fora de uma atualização
+static void rtc_read_raw(uint8_t* regs) {
+    while (cmos_read(RTC_STATUS_A) & RTC_A_UIP) {}
+    for (int i = 0; i < RTC_REG_COUNT; i++) {
+        regs[i] = cmos_read(rtc_regs[i]);
+    }
+}
+
+// Dias desde 01/01/1970 (days_from_civil: sem tabela de meses nem laço)
+static uint32_t days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Função para converter segundos desde 1970 em data e hora (UTC)
+void epoch_to_datetime(uint32_t epoch, DateTime* dt) {
+    uint32_t days = epoch / 86400;
+    uint32_t secs = epoch % 86400;
+    
+    dt->hour = secs / 3600;
+    dt->minute = (secs / 60) % 60;
+    dt->second = secs % 60;
+    dt->weekday = (days + 4) % 7;       // 01/01/1970 foi uma quinta
+    
+    // civil_from_days: o inverso de days_from_civil
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    
+    dt->day = doy - (153 * mp + 2) / 5 + 1;
+    dt->month = mp < 10 ? mp + 3 : mp - 9;
+    dt->year = yoe + era * 400 + (dt->month <= 2);
+}
+
+// Função para ler a data e a hora da CMOS. Repete até duas leituras
+// seguidas baterem (uma atualização pode cair no meio) e converte BCD e o
+// modo de 12 horas. Devolve os segundos desde 1970.
+static uint32_t rtc_read() {
+    uint8_t regs[RTC_REG_COUNT];
+    uint8_t again[RTC_REG_COUNT];
+    int same;
+    
+    rtc_read_raw(again);
+    do {
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            regs[i] = again[i];
+        }
+        rtc_read_raw(again);
+        same = 1;
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            if (regs[i] != again[i]) {
+                same = 0;
+            }
+        }
+    } while (!same);
+    
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    int pm = regs[2] & RTC_HOUR_PM;
+    regs[2] &= ~RTC_HOUR_PM;
+    
+    if (!(status_b & RTC_B_BINARY)) {
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            regs[i] = bcd_to_bin(regs[i]);
+        }
+    }
+    
+    // 12 AM é 0h e 12 PM é 12h
+    if (!(status_b & RTC_B_24H)) {
+        regs[2] %= 12;
+        if (pm) {
+            regs[2] += 12;
+        }
+    }
+    
+    // O registrador de século não é padrão: sem um valor plausível, 20xx
+    uint32_t century = regs[6] >= 19 && regs[6] <= 21 ? regs[6] : 20;
+    uint32_t year = century * 100 + regs[5];
+    
+    return days_from_civil(year, regs[4], regs[3]) * 86400
+         + regs[2] * 3600 + regs[1] * 60 + regs[0];
+}
+
+// Handler da IRQ8: ler o registrador C reconhece a IRQ (sem isso o RTC
+// não gera a próxima); conta só as periódicas
+void rtc_irq(InterruptFrame* frame) {
+    (void)frame;
+    if (cmos_read(RTC_STATUS_C) & RTC_C_PF) {
+        rtc_ticks++;
+    }
+}
+
+// Função para ler o RTC uma vez no boot. Daqui em diante a hora sai do
+// relógio monotônico e nunca mais volta à CMOS.
+void rtc_init() {
+    uint32_t flags = irq_save();
+    rtc_boot_epoch = rtc_read();
+    rtc_boot_ns = ktime_ns();
+    irq_install(RTC_IRQ, rtc_irq);
+    irq_restore(flags);
+}
+
+// Função para obter os segundos desde 1970 (UTC) agora
+uint32_t rtc_epoch() {
+    uint64_t seconds = ktime_ns() - rtc_boot_ns;
+    div64_32(&seconds, 1000000000);
+    return rtc_boot_epoch + (uint32_t)seconds;
+}
+
+// Função para ligar ou desligar a IRQ periódica do RTC (RTC_PERIODIC_HZ):
+// uma segunda fonte de tempo, independente do PIT e do TSC
+void rtc_periodic(int enable) {
+    uint32_t flags = irq_save();
+    uint8_t status_a = cmos_read(RTC_STATUS_A);
+    cmos_write(RTC_STATUS_A, (status_a & 0xF0) | RTC_PERIODIC_RATE);
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    cmos_write(RTC_STATUS_B, enable ? (status_b | RTC_B_PIE) : (status_b & ~RTC_B_PIE));
+    cmos_read(RTC_STATUS_C);
+    irq_restore(flags);
+}
+
+// Função para inicializar a COM1: 115200 8N1 com as FIFOs ligadas
+void serial_init() {
+    outb(COM1_PORT + SERIAL_IER, 0x00);    // Sem interrupções por enquanto
+    outb(COM1_PORT + SERIAL_LCR, 0x80);    // DLAB para programar o divisor
+    outb(COM1_PORT + 0, 0x01);             // Divisor 1 = 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + SERIAL_LCR, 0x03);    // 8 bits, sem paridade, 1 stop bit
+    outb(COM1_PORT + SERIAL_FCR, 0xC7);    // Liga e limpa as FIFOs
+    outb(COM1_PORT + SERIAL_MCR, 0x0B);    // DTR, RTS e OUT2 (OUT2 libera a IRQ)
+    
+    // Sem UART a porta lê 0xFF; os bits 6-7 do IIR dizem se a FIFO existe
+    if (inb(COM1_PORT + SERIAL_LSR) == 0xFF) {
+        return;
+    }
+    uint8_t iir = inb(COM1_PORT + SERIAL_IIR);
+    serial_fifo_size = (iir & 0xC0) == 0xC0 ? SERIAL_FIFO_SIZE : 1;
+    serial_present = 1;
+    irq_install(SERIAL_IRQ, serial_irq);
+}
+
+// Função para encher a FIFO de TX a partir do anel (THR precisa estar vazio)
+static void serial_fill_fifo() {
+    for (int i = 0; i < serial_fifo_size && serial_tx_tail != serial_tx_head; i++) {
+        outb(COM1_PORT + SERIAL_THR, serial_tx[serial_tx_tail & (SERIAL_TX_BUFFER - 1)]);
+        serial_tx_tail++;
+    }
+}
+
+// Função para esvaziar o anel por polling: um teste de LSR a cada FIFO cheia.
+// Usada com as interrupções desligadas (boot, anel cheio).
+static void serial_drain_polled() {
+    while (serial_tx_tail != serial_tx_head) {
+        while (!(inb(COM1_PORT + SERIAL_LSR) & SERIAL_LSR_THRE));
+        serial_fill_fifo();
+    }
+}
+
+// Handler da IRQ4: enche a FIFO e desliga a interrupção quando o anel esvazia
+void serial_irq(InterruptFrame* frame) {
+    (void)frame;
+    inb(COM1_PORT + SERIAL_IIR);           // Reconhece a interrupção
+    
+    spin_lock(&serial_lock);
+    if (inb(COM1_PORT + SERIAL_LSR) & SERIAL_LSR_THRE) {
+        serial_fill_fifo();
+        if (serial_tx_tail == serial_tx_head) {
+            serial_ier &= ~SERIAL_IER_THRI;
+            outb(COM1_PORT + SERIAL_IER, serial_ier);
+        }
+    }
+    spin_unlock(&serial_lock);
+}
+
+// Função para enfileirar um byte (não transmite; veja serial_kick)
+static void serial_queue(char c) {
+    if (serial_tx_head - serial_tx_tail == SERIAL_TX_BUFFER) {
+        // Anel cheio: esvazia na hora para não perder log
+        uint32_t flags = spin_lock_irqsave(&serial_lock);
+        serial_drain_polled();
+        spin_unlock_irqrestore(&serial_lock, flags);
+    }
+    uint32_t head = serial_tx_head;
+    serial_tx[head & (SERIAL_TX_BUFFER - 1)] = c;
+    // O byte precisa estar no anel antes de head avançar
+    __asm__ volatile("" : : : "memory");
+    serial_tx_head = head + 1;
+}
+
+// Função para enviar um caractere da tela para a serial ('\n' vira "\r\n")
+static inline void serial_putchar(char c) {
+    if (!serial_present || serial_mute) {
+        return;
+    }
+    if (c == '\n') {
+        serial_queue('\r');
+    }
+    serial_queue(c);
+}
+
+// Função para começar a transmitir o que está no anel. Com interrupções
+// ligadas só habilita a IRQ de THR vazio (o 16550 a dispara na hora se o
+// THR já está vazio); sem elas esvazia por polling.
+void serial_kick() {
+    if (!serial_present || serial_tx_tail == serial_tx_head) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    if (flags & EFLAGS_IF) {
+        if (!(serial_ier & SERIAL_IER_THRI)) {
+            serial_ier |= SERIAL_IER_THRI;
+            outb(COM1_PORT + SERIAL_IER, serial_ier);
+        }
+    } else {
+        serial_drain_polled();
+    }
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+// Copia 'count' palavras de 32 bits de uma vez (rep movsl)
+static inline void vga_copy32(volatile void* dst, const void* src, size_t count) {
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// Marca as colunas [start, end) da linha y do console como sujas
+static inline void console_mark_dirty(Console* c, size_t y, size_t start, size_t end) {
+    if (c->dirty_rows & (1u << y)) {
+        if (start < c->dirty_start[y]) c->dirty_start[y] = start;
+        if (end > c->dirty_end[y]) c->dirty_end[y] = end;
+    } else {
+        c->dirty_rows |= 1u << y;
+        c->dirty_start[y] = start;
+        c->dirty_end[y] = end;
+    }
+}
+
+// Marca a tela inteira do console como suja
+static void console_mark_all_dirty(Console* c) {
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        console_mark_dirty(c, y, 0, VGA_WIDTH);
+    }
+}
+
+// Programa o CRTC para começar a tela na linha 'origin' da memória de texto
+static void vga_set_start(size_t origin) {
+    uint16_t pos = origin * VGA_WIDTH;
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH);
+    outb(VGA_CRTC_DATA, pos >> 8);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    vga_hw_origin = origin;
+}
+
+// Copia as faixas sujas do console para a memória de vídeo. Consoles que não
+// estão na tela guardam as faixas sujas até voltarem a ser mostrados.
+static void console_flush(Console* c) {
+    // Enquanto o histórico está na tela, a saída nova fica só na shadow
+    if (c != con_visible || c->scrollback_view) {
+        return;
+    }
+    
+    while (c->dirty_rows) {
+        size_t y = __builtin_ctz(c->dirty_rows);
+        c->dirty_rows &= c->dirty_rows - 1;
+        
+        // Alinha a faixa em pares de células para copiar 32 bits por vez
+        size_t start = c->dirty_start[y] & ~1u;
+        size_t end = (c->dirty_end[y] + 1) & ~1u;
+        size_t offset = (c->origin + y) * VGA_WIDTH + start;
+        vga_copy32(vga_buffer + offset, vga_shadow + offset, (end - start) / 2);
+    }
+    
+    // Só move a janela depois que o conteúdo novo já está na VGA
+    if (vga_hw_origin != c->origin) {
+        vga_set_start(c->origin);
+    }
+}
+
+// Função para pegar o console: threads de outras CPUs escrevem nele ao
+// mesmo tempo. A trava é recursiva na mesma CPU (vga_write chama
+// vga_putchar, e uma IRQ pode escrever por cima de quem ela interrompeu) e
+// proíbe a troca de thread enquanto está pega.
+static void console_lock() {
+    preempt_disable();
+    int cpu = cpu_id();
+    if (console_owner != cpu) {
+        spin_lock(&console_spinlock);
+        console_owner = cpu;
+    }
+    console_depth++;
+}
+
+static void console_unlock() {
+    if (--console_depth == 0) {
+        console_owner = -1;
+        spin_unlock(&console_spinlock);
+    }
+    preempt_enable();
+}
+
+// Copia as faixas sujas do console atual para a memória de vídeo
+void vga_flush() {
+    console_lock();
+    console_flush(con);
+    console_unlock();
+    serial_kick();
+}
+
+// Agrupa várias escritas em um único flush (banners, ajuda, etc.)
+void vga_batch_begin() {
+    console_lock();
+    vga_batch_depth++;
+    console_unlock();
+}
+
+void vga_batch_end() {
+    console_lock();
+    if (--vga_batch_depth == 0) {
+        vga_flush();
+    }
+    console_unlock();
+}
+
+// Grava uma célula na shadow (e na VGA se estiver em modo direto)
+static inline void vga_put_cell(size_t index, uint16_t cell) {
+    vga_shadow[index] = cell;
+    if (vga_writethrough && con == con_visible) {
+        vga_buffer[index] = cell;
+    }
+}
+
+// Função para limpar a tela
+void vga_clear() {
+    console_lock();
+    uint16_t blank = (uint16_t)' ' | (uint16_t)con->color << 8;
+    for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
+        vga_put_cell(con->origin * VGA_WIDTH + i, blank);
+    }
+    console_mark_all_dirty(con);
+    con->x = 0;
+    con->y = 0;
+    console_unlock();
+}
+
+// Função para definir cor
+void vga_set_color(uint8_t color) {
+    console_lock();
+    con->color = color;
+    console_unlock();
+}
+
+// Guarda a linha que está saindo do topo da tela no anel de histórico
+static inline void scrollback_push(Console* c, const uint16_t* row) {
+    uint16_t* dst = c->scrollback + (c->scrollback_head & (SCROLLBACK_ROWS - 1)) * VGA_WIDTH;
+    vga_copy32(dst, row, VGA_WIDTH / 2);
+    c->scrollback_head++;
+    if (c->scrollback_count < SCROLLBACK_ROWS) {
+        c->scrollback_count++;
+    }
+}
+
+// Desenha na VGA a tela do console deslocada 'scrollback_view' linhas para cima
+static void scrollback_render(Console* c) {
+    volatile uint16_t* screen = vga_buffer + c->origin * VGA_WIDTH;
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        const uint16_t* src;
+        if (y < c->scrollback_view) {
+            // A linha mais recente do anel fica logo acima da tela ao vivo
+            uint32_t line = c->scrollback_head - c->scrollback_view + y;
+            src = c->scrollback + (line & (SCROLLBACK_ROWS - 1)) * VGA_WIDTH;
+        } else {
+            src = vga_shadow + (c->origin + y - c->scrollback_view) * VGA_WIDTH;
+        }
+        vga_copy32(screen + y * VGA_WIDTH, src, VGA_WIDTH / 2);
+    }
+    if (vga_hw_origin != c->origin) {
+        vga_set_start(c->origin);
+    }
+}
+
+// Move a visualização do histórico do console na tela;
+// 'lines' > 0 sobe (PgUp), < 0 desce (PgDn)
+void scrollback_scroll(int lines) {
+    Console* c = con_visible;
+    int view = (int)c->scrollback_view + lines;
+    if (view < 0) {
+        view = 0;
+    }
+    if (view > (int)c->scrollback_count) {
+        view = c->scrollback_count;
+    }
+    if ((uint32_t)view == c->scrollback_view) {
+        return;
+    }
+    
+    console_lock();
+    c->scrollback_view = view;
+    if (c->scrollback_view == 0) {
+        // De volta ao vivo: a shadow tem tudo, basta copiar a janela inteira
+        console_mark_all_dirty(c);
+        console_flush(c);
+    } else {
+        scrollback_render(c);
+    }
+    console_unlock();
+}
+
+// Mostra o console 'n'. Consoles ficam em fatias separadas da memória de
+// texto, então basta copiar as linhas que ele sujou em segundo plano (no
+// máximo uma tela) e trocar o endereço inicial no CRTC.
+void console_switch(int n) {
+    Console* c = &consoles[n];
+    if (c == con_visible) {
+        return;
+    }
+    
+    console_lock();
+    uint64_t start = rdtsc();
+    con_visible = c;
+    if (c->scrollback_view) {
+        scrollback_render(c);
+    } else {
+        console_flush(c);
+    }
+    console_switch_cycles = (uint32_t)(rdtsc() - start);
+    console_unlock();
+}
+
+// Inicializa os consoles, cada um com sua fatia da memória de texto
+void console_init() {
+    for (int i = 0; i < NUM_CONSOLES; i++) {
+        Console* c = &consoles[i];
+        c->base = i * CONSOLE_MEM_ROWS;
+        c->origin = c->base;
+        c->color = VGA_LIGHT_GREY | (VGA_BLACK << 4);
+    }
+}
+
+// Trata Alt+F1..F4 (troca de console) sobre a tecla já decodificada.
+// Retorna 1 se a tecla foi consumida.
+static int console_hotkey(uint8_t key) {
+    if ((keyboard_decoder.mods & MOD_ALT) && key >= KEY_F1 && key < KEY_F1 + NUM_CONSOLES) {
+        console_switch(key - KEY_F1);
+        return 1;
+    }
+    return 0;
+}
+
+// Rola a tela uma linha. Normalmente só avança a origem do CRTC (O(1));
+// só copia quando a janela chega ao fim da fatia do console.
+static void vga_scroll() {
+    scrollback_push(con, vga_shadow + con->origin * VGA_WIDTH);
+    
+    if (con->origin + VGA_HEIGHT < con->base + CONSOLE_MEM_ROWS) {
+        con->origin++;
+        
+        // As linhas sujas sobem junto com a janela
+        con->dirty_rows >>= 1;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            con->dirty_start[y] = con->dirty_start[y + 1];
+            con->dirty_end[y] = con->dirty_end[y + 1];
+        }
+    } else {
+        // Fim da fatia: traz as 24 linhas de baixo para o início
+        uint16_t* dst = vga_shadow + con->base * VGA_WIDTH;
+        uint16_t* src = vga_shadow + (con->origin + 1) * VGA_WIDTH;
+        for (size_t i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
+            dst[i] = src[i];
+        }
+        con->origin = con->base;
+        con->dirty_rows = 0;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            console_mark_dirty(con, y, 0, VGA_WIDTH);
+        }
+    }
+    
+    // Limpa a nova última linha
+    uint16_t* row = vga_shadow + (con->origin + VGA_HEIGHT - 1) * VGA_WIDTH;
+    for (size_t x = 0; x < VGA_WIDTH; x++) {
+        row[x] = (uint16_t)' ' | (uint16_t)con->color << 8;
+    }
+    console_mark_dirty(con, VGA_HEIGHT - 1, 0, VGA_WIDTH);
+    
+    if (vga_writethrough) {
+        vga_flush();
+    }
+}
+
+// Vai para o início da próxima linha, rolando a tela se preciso
+static void vga_newline() {
+    con->x = 0;
+    con->y++;
+    if (con->y >= VGA_HEIGHT) {
+        vga_scroll();
+        con->y = VGA_HEIGHT - 1;
+    }
+}
+
+// Função para colocar caractere na tela
+void vga_putchar(char c) {
+    console_lock();
+    serial_putchar(c);
+    
+    if (c == '\n') {
+        vga_newline();
+        if (vga_batch_depth == 0) {
+            vga_flush();
+        }
+    } else {
+        if (con->x >= VGA_WIDTH) {
+            vga_newline();
+        }
+        
+        const size_t index = (con->origin + con->y) * VGA_WIDTH + con->x;
+        vga_put_cell(index, (uint16_t)c | (uint16_t)con->color << 8);
+        if (!vga_writethrough || con != con_visible) {
+            console_mark_dirty(con, con->y, con->x, con->x + 1);
+        }
+        con->x++;
+    }
+    console_unlock();
+}
+
+// Escreve 'len' bytes na tela de uma vez, interpretando os escapes de cor
+void vga_write(const char* buf, size_t len) {
+    console_lock();
+    vga_batch_begin();
+    for (size_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == KC_ESCAPE && i + 1 < len) {
+            char d = buf[++i];
+            uint8_t fg = (d >= 'A') ? d - 'A' + 10 : d - '0';
+            vga_set_color((fg & 0x0F) | (VGA_BLACK << 4));
+            continue;
+        }
+        vga_putchar(c);
+    }
+    vga_batch_end();
+    console_unlock();
+}
+
+// Função para exibir string
+void vga_puts(const char* str) {
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
+    }
+    vga_write(str, len);
+}
+
+// Pares "00".."99": cada divisão por 100 gera dois dígitos de uma vez
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Escreve n em decimal de trás para frente terminando em 'end'.
+// Retorna o início dos dígitos.
+static char* fmt_u32(char* end, uint32_t n) {
+    while (n >= 100) {
+        uint32_t q = n / 100;
+        uint32_t r = (n - q * 100) * 2;
+        end -= 2;
+        end[0] = digit_pairs[r];
+        end[1] = digit_pairs[r + 1];
+        n = q;
+    }
+    if (n >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[n * 2];
+        end[1] = digit_pairs[n * 2 + 1];
+    } else {
+        *--end = '0' + n;
+    }
+    return end;
+}
+
+static char* fmt_u64(char* end, uint64_t n) {
+    // Blocos de 8 dígitos enquanto o número não cabe em 32 bits
+    while (n >> 32) {
+        char* start = fmt_u32(end, div64_32(&n, 100000000));
+        end -= 8;
+        while (start > end) {
+            *--start = '0';
+        }
+    }
+    return fmt_u32(end, (uint32_t)n);
+}
+
+static char* fmt_hex(char* end, uint64_t n, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[n & 0xF];
+        n >>= 4;
+    } while (n);
+    return end;
+}
+
+// Buffer de saída do kprintf: tudo é formatado aqui e vai para a tela em um
+// único vga_write (ou em blocos, se passar de KPRINTF_BUFFER)
+typedef struct {
+    char buf[KPRINTF_BUFFER];
+    size_t len;
+} KprintfBuffer;
+
+#define FMT_LEFT 1      // '-': alinha à esquerda
+#define FMT_ZERO 2      // '0': completa com zeros
+
+static void kbuf_putc(KprintfBuffer* b, char c) {
+    // Não separa um escape de cor do seu dígito entre dois blocos
+    if (b->len == KPRINTF_BUFFER || (c == KC_ESCAPE && b->len == KPRINTF_BUFFER - 1)) {
+        vga_write(b->buf, b->len);
+        b->len = 0;
+    }
+    b->buf[b->len++] = c;
+}
+
+// Emite um campo com largura mínima; o prefixo (sinal, "0x") vem antes dos zeros
+static void kbuf_field(KprintfBuffer* b, const char* prefix, const char* s, size_t len,
+                       int width, int flags) {
+    int pad = width - (int)len;
+    for (const char* p = prefix; *p; p++) {
+        pad--;
+    }
+    if (!(flags & (FMT_LEFT | FMT_ZERO))) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+    while (*prefix) {
+        kbuf_putc(b, *prefix++);
+    }
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        while (pad-- > 0) kbuf_putc(b, '0');
+    }
+    for (size_t i = 0; i < len; i++) {
+        kbuf_putc(b, s[i]);
+    }
+    if (flags & FMT_LEFT) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+}
+
+// printf do kernel: %d %u %x %X %p %s %c %%, com 'l'/'ll', largura, '-' e '0'
+void vkprintf(const char* fmt, va_list args) {
+    KprintfBuffer b;
+    char num[24];
+    b.len = 0;
+    
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        fmt++;
+        
+        int flags = 0;
+        int width = 0;
+        int longs = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FMT_LEFT;
+            else if (*fmt == '0') flags |= FMT_ZERO;
+            else break;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+        
+        char* end = num + sizeof(num);
+        char* start;
+        const char* prefix = "";
+        uint64_t value;
+        switch (*fmt) {
+        case 'd': {
+            int64_t v = longs >= 2 ? va_arg(args, long long)
+                      : longs ? va_arg(args, long) : va_arg(args, int);
+            if (v < 0) {
+                prefix = "-";
+                value = -(uint64_t)v;
+            } else {
+                value = v;
+            }
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        }
+        case 'u':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        case 'x':
+        case 'X':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = fmt_hex(end, value, *fmt == 'X');
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void*);
+            start = fmt_hex(end, value, 0);
+            prefix = "0x";
+            flags |= FMT_ZERO;
+            width = 2 + 2 * sizeof(void*);
+            break;
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            size_t len = 0;
+            if (!str) {
+                str = "(null)";
+            }
+            while (str[len] != '\0') {
+                len++;
+            }
+            kbuf_field(&b, "", str, len, width, flags);
+            continue;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            kbuf_field(&b, "", &c, 1, width, flags);
+            continue;
+        }
+        case '\0':
+            fmt--;
+            continue;
+        default:
+            // '%%' vira '%'; conversão desconhecida é copiada como está
+            if (*fmt != '%') {
+                kbuf_putc(&b, '%');
+            }
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        kbuf_field(&b, prefix, start, end - start, width, flags);
+    }
+    
+    if (b.len) {
+        vga_write(b.buf, b.len);
+    }
+}
+
+void kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vkprintf(fmt, args);
+    va_end(args);
+}
+
+// Função para obter informações básicas do sistema
+void get_system_info(SystemInfo* info) {
+    // Informações hardcoded para simplicidade
+    const char* hostname = "Kernel-V";
+    const char* kernel_ver = "1.0.0";
+    const char* cpu = "x86_64";
+    
+    size_t i;
+    for (i = 0; hostname[i] != '\0' && i < 31; i++) {
+        info->hostname[i] = hostname[i];
+    }
+    info->hostname[i] = '\0';
+    
+    for (i = 0; kernel_ver[i] != '\0' && i < 31; i++) {
+        info->kernel_version[i] = kernel_ver[i];
+    }
+    info->kernel_version[i] = '\0';
+    
+    for (i = 0; cpu[i] != '\0' && i < 63; i++) {
+        info->cpu_info[i] = cpu[i];
+    }
+    info->cpu_info[i] = '\0';
+    
+    // 256 frames de 4 KB por MB
+    info->memory_mb = pmm_total_frames >> 8;
+    // Depois do boot os frames livres estão nas zonas do buddy de cada nó
+    uint32_t free_frames = pmm_free_frames;
+    info->node_count = numa_node_count;
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        Zone* zones = numa_nodes[node].zones;
+        uint32_t free = zones[ZONE_DMA].free_pages + zones[ZONE_NORMAL].free_pages;
+        info->node_total_mb[node] = (zones[ZONE_DMA].managed_pages + zones[ZONE_NORMAL].managed_pages) >> 8;
+        info->node_free_mb[node] = free >> 8;
+        free_frames += free;
+    }
+    info->memory_free_mb = free_frames >> 8;
+    
+    info->cpu_count = 0;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu == 0 || per_cpu[cpu].online) {
+            info->cpu_apic[info->cpu_count++] = per_cpu[cpu].apic_id;
+        }
+    }
+    
+    uint64_t uptime = ktime_ns();
+    div64_32(&uptime, 1000000000);
+    info->uptime_seconds = (uint32_t)uptime;
+}
+
+// Função para exibir informações do sistema no estilo neofetch
+void display_system_info(SystemInfo* info) {
+    kprintf(KC_LIGHT_CYAN    "                    %s@kernel-v\n"
+            KC_LIGHT_GREY    "                   ---------------\n"
+            KC_LIGHT_GREEN   "OS:                 Kernel-V %s\n"
+            KC_LIGHT_BLUE    "Kernel:             %s\n"
+            KC_LIGHT_MAGENTA "Uptime:             %us\n"
+            KC_LIGHT_RED     "Memory:             %uMB (%uMB livres)\n",
+            info->hostname, info->cpu_info, info->kernel_version,
+            info->uptime_seconds, info->memory_mb, info->memory_free_mb);
+    for (uint32_t node = 0; node < info->node_count; node++) {
+        if (info->node_total_mb[node]) {
+            kprintf("  Nó %u:             %uMB usados, %uMB livres\n", node,
+                    info->node_total_mb[node] - info->node_free_mb[node], info->node_free_mb[node]);
+        }
+    }
+    kprintf(KC_LIGHT_CYAN "CPUs:               %u online (APIC", info->cpu_count);
+    for (uint32_t cpu = 0; cpu < info->cpu_count; cpu++) {
+        kprintf(" %u", info->cpu_apic[cpu]);
+    }
+    kprintf(")\n");
+    kprintf(KC_LIGHT_BROWN "Shell:              kernel-shell\n\n");
+}
+
+// Nomes das exceções da CPU (vetores 0-31)
+static const char* const exception_names[32] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "BOUND Range Exceeded", "Invalid Opcode", "Device Not Available",
+    "Double Fault", "Coprocessor Segment Overrun", "Invalid TSS", "Segment Not Present",
+    "Stack-Segment Fault", "General Protection", "Page Fault", "Reserved",
+    "x87 Floating-Point", "Alignment Check", "Machine Check", "SIMD Floating-Point",
+    "Virtualization", "Control Protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security", "Reserved"
+};
+
+// Tela de pânico: mostra o motivo e os registradores (se houver frame) no
+// console visível e na serial, e para a CPU
+void panic(const char* reason, InterruptFrame* frame) {
+    uint32_t cr0, cr2, cr3, cr4;
+    
+    __asm__ volatile("cli");
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    
+    // Toma o console e a serial mesmo se outra CPU estava no meio de uma
+    // escrita, e escreve direto, sem lote, no console que está na tela
+    console_spinlock.locked = 1;
+    console_owner = cpu_id();
+    console_depth = 1;
+    serial_lock.locked = 0;
+    con = con_visible;
+    con->scrollback_view = 0;
+    vga_batch_depth = 0;
+    vga_writethrough = 0;
+    vga_set_color(VGA_WHITE | (VGA_RED << 4));
+    vga_clear();
+    
+    kprintf("\n *** KERNEL PANIC: %s ***\n\n", reason);
+    if (frame) {
+        kprintf(" vetor %u  erro 0x%08x\n\n", frame->vector, frame->error);
+        kprintf(" EAX=%08x  EBX=%08x  ECX=%08x  EDX=%08x\n",
+                frame->eax, frame->ebx, frame->ecx, frame->edx);
+        // O pushal guarda o ESP já com EFLAGS, CS, EIP, erro e vetor (20 bytes)
+        kprintf(" ESI=%08x  EDI=%08x  EBP=%08x  ESP=%08x\n",
+                frame->esi, frame->edi, frame->ebp, frame->esp + 20);
+        kprintf(" EIP=%08x  EFLAGS=%08x  CS=%04x\n", frame->eip, frame->eflags, frame->cs);
+        kprintf(" DS=%04x  ES=%04x  FS=%04x  GS=%04x\n",
+                frame->ds, frame->es, frame->fs, frame->gs);
+    }
+    kprintf(" CR0=%08x  CR2=%08x  CR3=%08x  CR4=%08x\n\n", cr0, cr2, cr3, cr4);
+    kprintf(" Sistema parado.\n");
+    vga_flush();
+    
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+// Tarefa do double fault: o estado de quem falhou ficou salvo na TSS do
+// kernel da CPU (a tarefa do #DF carrega o GS dela)
+static void double_fault_task() {
+    Tss* task = &tss[cpu_id()];
+    InterruptFrame frame = {
+        .gs = task->gs, .fs = task->fs, .es = task->es, .ds = task->ds,
+        .edi = task->edi, .esi = task->esi, .ebp = task->ebp, .esp = task->esp - 20,    // panic soma os 20 de volta
+        .ebx = task->ebx, .edx = task->edx, .ecx = task->ecx, .eax = task->eax,
+        .vector = 8, .error = 0,
+        .eip = task->eip, .cs = task->cs, .eflags = task->eflags
+    };
+    panic(exception_names[8], &frame);
+}
+
+// Ponto comum de todas as interrupções: IRQs (do PIC ou do LAPIC) levam o
+// EOI antes do handler (que roda com o IF desligado) e depois rodam os
+// softirqs; exceções sem handler viram pânico
+void interrupt_dispatch(InterruptFrame* frame) {
+    uint32_t vector = frame->vector;
+    InterruptHandler handler = interrupt_handlers[vector];
+    
+    if (vector >= IRQ_BASE) {
+        if (vector >= LAPIC_VECTOR_BASE) {
+            // A espúria do LAPIC não leva EOI
+            if (vector == LAPIC_SPURIOUS_VECTOR) {
+                return;
+            }
+            lapic_write(LAPIC_EOI, 0);
+        } else {
+            int irq = vector - IRQ_BASE;
+            
+            // IRQ 7/15 sem bit no ISR é espúria: não leva EOI (a 15 ainda deve um ao mestre)
+            if ((irq == 7 || irq == 15) && !pic_in_service(irq)) {
+                if (irq == 15) {
+                    outb(PIC1_COMMAND, PIC_EOI);
+                }
+                return;
+            }
+            pic_eoi(irq);
+        }
+        if (handler) {
+            handler(frame);
+        }
+        softirq_run();
+        
+        // Troca pendente (fatia vencida ou thread mais prioritária acordada):
+        // a thread que sai volta para cá quando ganhar a CPU e segue para o iret
+        RunQueue* rq = this_rq();
+        if (rq->need_resched && rq->current && rq->preempt_count == 0 && !this_cpu()->softirq_active) {
+            rq->preemptions++;
+            schedule();
+        }
+        return;
+    }
+    
+    if (handler) {
+        handler(frame);
+        return;
+    }
+    panic(exception_names[vector], frame);
+}
+
+// Índice do primeiro bit ligado de x (x != 0)
+static inline uint32_t bsf(uint32_t x) {
+    uint32_t bit;
+    __asm__("bsfl %1, %0" : "=r"(bit) : "rm"(x));
+    return bit;
+}
+
+// Função para percorrer o mapa de memória do multiboot: preenche a próxima
+// região a partir de '*cursor' (0 na primeira chamada) e devolve 0 no fim.
+// Sem mmap, o GRUB só informa mem_upper: vira uma região acima de 1 MB.
+static int mmap_next(MultibootInfo* mbi, uint32_t* cursor, uint64_t* start, uint64_t* end, uint32_t* type) {
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        if (*cursor >= mbi->mmap_length) {
+            return 0;
+        }
+        MultibootMmapEntry* entry = (MultibootMmapEntry*)(mbi->mmap_addr + *cursor);
+        *start = entry->addr;
+        *end = entry->addr + entry->len;
+        *type = entry->type;
+        *cursor += entry->size + sizeof(entry->size);
+        return 1;
+    }
+    if (*cursor == 0 && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+        *start = PMM_LOW_MEMORY;
+        *end = PMM_LOW_MEMORY + (uint64_t)mbi->mem_upper * 1024;
+        *type = MULTIBOOT_MEMORY_AVAILABLE;
+        *cursor = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Função para marcar os frames de [start, end) como livres ou usados. Os
+// livres arredondam para dentro (só frames inteiros de RAM) e os usados para
+// fora; o miolo é escrito uma palavra de 32 frames por vez.
+static void pmm_mark(uint64_t start, uint64_t end, int free) {
+    uint64_t limit = (uint64_t)pmm_words * 32;
+    uint64_t first, last;
+    
+    if (free) {
+        first = (start + FRAME_SIZE - 1) >> FRAME_SHIFT;
+        last = end >> FRAME_SHIFT;
+    } else {
+        first = start >> FRAME_SHIFT;
+        last = (end + FRAME_SIZE - 1) >> FRAME_SHIFT;
+    }
+    if (last > limit) {
+        last = limit;
+    }
+    
+    uint32_t frame = (uint32_t)first;
+    while (frame < last && (frame & 31)) {
+        if (free) {
+            pmm_bitmap[frame >> 5] |= 1u << (frame & 31);
+        } else {
+            pmm_bitmap[frame >> 5] &= ~(1u << (frame & 31));
+        }
+        frame++;
+    }
+    while (frame + 32 <= last) {
+        pmm_bitmap[frame >> 5] = free ? 0xFFFFFFFF : 0;
+        frame += 32;
+    }
+    while (frame < last) {
+        if (free) {
+            pmm_bitmap[frame >> 5] |= 1u << (frame & 31);
+        } else {
+            pmm_bitmap[frame >> 5] &= ~(1u << (frame & 31));
+        }
+        frame++;
+    }
+}
+
+// Função para achar onde pôr o bitmap: o primeiro trecho de RAM utilizável
+// com 'bytes' livres depois do kernel e fora das estruturas do multiboot
+static uint32_t pmm_place_bitmap(MultibootInfo* mbi, uint32_t bytes) {
+    uint64_t reserved[3][2] = {
+        { 0, (uint32_t)kernel_end },
+        { (uint32_t)mbi, (uint32_t)mbi + sizeof(MultibootInfo) },
+        { 0, 0 },
+    };
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        reserved[2][0] = mbi->mmap_addr;
+        reserved[2][1] = (uint64_t)mbi->mmap_addr + mbi->mmap_length;
+    }
+    uint32_t cursor = 0;
+    uint64_t start, end;
+    uint32_t type;
+    
+    while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+        if (type != MULTIBOOT_MEMORY_AVAILABLE) {
+            continue;
+        }
+        if (end > PMM_MAX_ADDRESS) {
+            end = PMM_MAX_ADDRESS;
+        }
+        
+        // Empurra o candidato para depois de tudo que ele cobrir
+        uint64_t candidate = (start + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+        int moved = 1;
+        while (moved) {
+            moved = 0;
+            for (int i = 0; i < 3; i++) {
+                if (candidate < reserved[i][1] && candidate + bytes > reserved[i][0]) {
+                    candidate = (reserved[i][1] + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+                    moved = 1;
+                }
+            }
+        }
+        if (candidate + bytes <= end) {
+            return (uint32_t)candidate;
+        }
+    }
+    return 0;
+}
+
+// Função para montar o alocador de frames a partir do mapa de memória do
+// GRUB: um bit por frame até a maior RAM utilizável (abaixo de 4 GB)
+void pmm_init(MultibootInfo* mbi) {
+    uint32_t cursor = 0;
+    uint64_t start, end;
+    uint32_t type;
+    uint64_t top = 0;
+    
+    while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+        if (type == MULTIBOOT_MEMORY_AVAILABLE && end > top) {
+            top = end;
+        }
+    }
+    if (top > PMM_MAX_ADDRESS) {
+        top = PMM_MAX_ADDRESS;
+    }
+    
+    pmm_words = (uint32_t)((top >> FRAME_SHIFT) + 31) / 32;
+    uint32_t bytes = pmm_words * sizeof(uint32_t);
+    pmm_bitmap = (uint32_t*)pmm_place_bitmap(mbi, bytes);
+    if (!pmm_bitmap) {
+        panic("Sem memória para o bitmap de frames", 0);
+    }
+    
+    // Tudo começa usado; a RAM do mapa vira livre e o resto do mapa (que
+    // pode se sobrepor a ela) volta a ser reservado
+    for (uint32_t i = 0; i < pmm_words; i++) {
+        pmm_bitmap[i] = 0;
+    }
+    cursor = 0;
+    while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+        if (type == MULTIBOOT_MEMORY_AVAILABLE) {
+            pmm_mark(start, end, 1);
+        }
+    }
+    cursor = 0;
+    while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+        if (type != MULTIBOOT_MEMORY_AVAILABLE) {
+            pmm_mark(start, end, 0);
+        }
+    }
+    
+    // A RAM utilizável é o que sobrou livre antes das reservas do kernel
+    for (uint32_t i = 0; i < pmm_words; i++) {
+        for (uint32_t word = pmm_bitmap[i]; word; word &= word - 1) {
+            pmm_total_frames++;
+        }
+    }
+    
+    // Primeiro MB, kernel, estruturas do multiboot e o próprio bitmap
+    pmm_mark(0, (uint32_t)kernel_end, 0);
+    pmm_mark((uint32_t)mbi, (uint32_t)mbi + sizeof(MultibootInfo), 0);
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        pmm_mark(mbi->mmap_addr, (uint64_t)mbi->mmap_addr + mbi->mmap_length, 0);
+    }
+    pmm_mark((uint32_t)pmm_bitmap, (uint32_t)pmm_bitmap + bytes, 0);
+    
+    for (uint32_t i = 0; i < pmm_words; i++) {
+        for (uint32_t word = pmm_bitmap[i]; word; word &= word - 1) {
+            pmm_free_frames++;
+        }
+    }
+}
+
+// Função para reservar no bitmap 'count' frames seguidos (usada só no boot,
+// antes de o buddy assumir a memória). Devolve o endereço ou 0.
+static uint32_t pmm_alloc_run(uint32_t count) {
+    uint32_t run = 0;
+    
+    for (uint32_t frame = 0; frame < pmm_words * 32; frame++) {
+        if (pmm_bitmap[frame >> 5] & (1u << (frame & 31))) {
+            if (++run == count) {
+                uint32_t first = frame + 1 - count;
+                pmm_mark((uint64_t)first << FRAME_SHIFT, (uint64_t)(frame + 1) << FRAME_SHIFT, 0);
+                pmm_free_frames -= count;
+                return first << FRAME_SHIFT;
+            }
+        } else {
+            run = 0;
+        }
+    }
+    return 0;
+}
+
+// Comparação de strings do shell (definida mais abaixo)
+int strncmp(const char* s1, const char* s2, size_t n);
+
+// Função para conferir o checksum de uma estrutura ACPI (a soma dos bytes é 0)
+static int acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// Função para procurar o RSDP em 'length' bytes a partir de 'start' (fica
+// alinhado a 16 bytes)
+static AcpiRsdp* acpi_scan_rsdp(uint32_t start, uint32_t length) {
+    for (uint32_t address = start; address < start + length; address += 16) {
+        AcpiRsdp* rsdp = (AcpiRsdp*)address;
+        if (strncmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, ACPI_RSDP_V1_LENGTH)) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+// Função para achar o RSDP uma vez só, antes da paginação: a BDA fica na
+// página 0, que o mapa de páginas deixa de fora. Sem RSDP o resultado
+// negativo também fica guardado.
+void acpi_init() {
+    if (acpi_probed || paging_enabled) {
+        return;
+    }
+    acpi_probed = 1;
+    
+    // Primeiro KB da EBDA (segmento guardado na BDA) e depois a ROM da BIOS
+    volatile uint16_t* bda_ebda = (volatile uint16_t*)ACPI_BDA_EBDA;
+    __asm__ volatile("" : "+r"(bda_ebda));
+    uint32_t ebda = (uint32_t)*bda_ebda << 4;
+    if (ebda) {
+        acpi_rsdp = acpi_scan_rsdp(ebda, 1024);
+    }
+    if (!acpi_rsdp) {
+        acpi_rsdp = acpi_scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END - ACPI_BIOS_START);
+    }
+}
+
+// Função para achar uma tabela ACPI pela assinatura, pela RSDT (ou XSDT,
+// quando ela existe e cabe em 32 bits). Os endereços são físicos: depois
+// da paginação só valem dentro do mapa identidade.
+static AcpiHeader* acpi_find_table(const char* signature) {
+    acpi_init();
+    AcpiRsdp* rsdp = acpi_rsdp;
+    if (!rsdp) {
+        return 0;
+    }
+    
+    int wide = rsdp->revision >= 2 && rsdp->xsdt && rsdp->xsdt < PMM_MAX_ADDRESS;
+    AcpiHeader* root = (AcpiHeader*)(wide ? (uint32_t)rsdp->xsdt : rsdp->rsdt);
+    if (!acpi_checksum(root, root->length)) {
+        return 0;
+    }
+    
+    uint32_t entry_size = wide ? 8 : 4;
+    uint32_t count = (root->length - sizeof(AcpiHeader)) / entry_size;
+    uint8_t* entries = (uint8_t*)(root + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t* entry = (uint32_t*)(entries + i * entry_size);
+        if (wide && entry[1]) {
+            continue;
+        }
+        AcpiHeader* table = (AcpiHeader*)entry[0];
+        if (strncmp(table->signature, signature, 4) == 0 && acpi_checksum(table, table->length)) {
+            return table;
+        }
+    }
+    return 0;
+}
+
+// Função para achar (ou criar) o nó de um domínio de proximidade do SRAT.
+// Devolve -1 se passar de MAX_NUMNODES.
+static int numa_pxm_node(uint32_t pxm) {
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        if (numa_nodes[node].pxm == pxm) {
+            return node;
+        }
+    }
+    if (numa_node_count == MAX_NUMNODES) {
+        return -1;
+    }
+    numa_nodes[numa_node_count].pxm = pxm;
+    return numa_node_count++;
+}
+
+// Função para ler o SRAT: cada faixa de memória habilitada vira uma
+// NumaRange e cada CPU conta no seu nó. A CPU do boot (pelo APIC ID do
+// CPUID) define o nó local.
+static void numa_parse_srat(AcpiHeader* srat, uint32_t boot_apic) {
+    uint8_t* entry = (uint8_t*)srat + ACPI_SRAT_ENTRIES;
+    uint8_t* end = (uint8_t*)srat + srat->length;
+    
+    numa_node_count = 0;
+    while (entry + 2 <= end && entry[1] && entry + entry[1] <= end) {
+        if (entry[0] == SRAT_CPU && entry[1] >= sizeof(SratCpu)) {
+            SratCpu* cpu = (SratCpu*)entry;
+            uint32_t pxm = cpu->pxm_low | ((uint32_t)cpu->pxm_high[0] << 8) |
+                           ((uint32_t)cpu->pxm_high[1] << 16) | ((uint32_t)cpu->pxm_high[2] << 24);
+            int node = (cpu->flags & SRAT_ENABLED) ? numa_pxm_node(pxm) : -1;
+            if (node >= 0) {
+                numa_nodes[node].cpus++;
+                apic_node[cpu->apic_id] = node;
+                if (cpu->apic_id == boot_apic) {
+                    cpu_node[0] = node;
+                }
+            }
+        } else if (entry[0] == SRAT_X2APIC && entry[1] >= sizeof(SratX2apic)) {
+            SratX2apic* cpu = (SratX2apic*)entry;
+            int node = (cpu->flags & SRAT_ENABLED) ? numa_pxm_node(cpu->pxm) : -1;
+            if (node >= 0) {
+                numa_nodes[node].cpus++;
+                if (cpu->x2apic_id < sizeof(apic_node)) {
+                    apic_node[cpu->x2apic_id] = node;
+                }
+                if (cpu->x2apic_id == boot_apic) {
+                    cpu_node[0] = node;
+                }
+            }
+        } else if (entry[0] == SRAT_MEMORY && entry[1] >= sizeof(SratMemory)) {
+            SratMemory* memory = (SratMemory*)entry;
+            int node = (memory->flags & SRAT_ENABLED) ? numa_pxm_node(memory->pxm) : -1;
+            uint64_t start = memory->base;
+            uint64_t stop = memory->base + memory->length_bytes;
+            if (stop > PMM_MAX_ADDRESS) {
+                stop = PMM_MAX_ADDRESS;
+            }
+            if (node >= 0 && start < stop && numa_range_count < NUMA_MAX_RANGES) {
+                NumaRange* range = &numa_ranges[numa_range_count++];
+                range->start_pfn = start >> FRAME_SHIFT;
+                range->end_pfn = stop >> FRAME_SHIFT;
+                range->node = node;
+            }
+        }
+        entry += entry[1];
+    }
+    if (numa_node_count == 0) {
+        numa_node_count = 1;
+    }
+}
+
+// Função para montar as distâncias: do SLIT quando existe (indexado pelos
+// domínios de proximidade), senão 10 para o próprio nó e 20 para os outros.
+// Cada nó ganha a lista de fallback do buddy, do mais perto ao mais longe.
+static void numa_build_fallback(AcpiHeader* slit) {
+    uint32_t localities = 0;
+    uint8_t* matrix = 0;
+    
+    if (slit && slit->length >= ACPI_SLIT_MATRIX) {
+        localities = *(uint32_t*)((uint8_t*)slit + sizeof(AcpiHeader));
+        matrix = (uint8_t*)slit + ACPI_SLIT_MATRIX;
+        if (ACPI_SLIT_MATRIX + localities * localities > slit->length) {
+            localities = 0;
+        }
+    }
+    
+    for (uint32_t a = 0; a < numa_node_count; a++) {
+        for (uint32_t b = 0; b < numa_node_count; b++) {
+            uint32_t pa = numa_nodes[a].pxm;
+            uint32_t pb = numa_nodes[b].pxm;
+            if (pa < localities && pb < localities) {
+                numa_distance[a][b] = matrix[pa * localities + pb];
+            } else {
+                numa_distance[a][b] = a == b ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+            }
+        }
+    }
+    
+    // Ordenação por inserção: no máximo MAX_NUMNODES nós
+    for (uint32_t a = 0; a < numa_node_count; a++) {
+        uint8_t* order = numa_nodes[a].fallback;
+        for (uint32_t i = 0; i < numa_node_count; i++) {
+            uint32_t j = i;
+            while (j > 0 && numa_distance[a][order[j - 1]] > numa_distance[a][i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+}
+
+// Função para descobrir a topologia NUMA pelo SRAT e SLIT do ACPI (antes da
+// paginação: as tabelas são lidas pelo endereço físico). Sem SRAT toda a
+// memória e a CPU ficam no nó 0.
+void numa_init() {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    
+    numa_node_count = 1;
+    numa_nodes[0].fallback[0] = 0;
+    AcpiHeader* srat = acpi_find_table("SRAT");
+    if (srat) {
+        numa_parse_srat(srat, b >> 24);
+    }
+    numa_build_fallback(acpi_find_table("SLIT"));
+}
+
+// Nó de um frame segundo o SRAT (frames fora das faixas ficam no nó 0)
+static uint32_t numa_pfn_node(uint32_t pfn) {
+    for (uint32_t i = 0; i < numa_range_count; i++) {
+        if (pfn >= numa_ranges[i].start_pfn && pfn < numa_ranges[i].end_pfn) {
+            return numa_ranges[i].node;
+        }
+    }
+    return 0;
+}
+
+// Função para achar a zona de um frame (o nó vem do mem_map)
+static inline Zone* pfn_zone(uint32_t pfn) {
+    return &numa_nodes[mem_map[pfn].node].zones[pfn < ZONE_DMA_LIMIT_PFN ? ZONE_DMA : ZONE_NORMAL];
+}
+
+// Função para pôr um bloco livre na lista da sua ordem
+static inline void buddy_list_add(Zone* zone, uint32_t pfn, uint32_t order) {
+    Page* page = &mem_map[pfn];
+    page->order = order;
+    page->flags = PAGE_FREE;
+    list_add_tail(&zone->free_area[order], &page->list);
+    zone->free_count[order]++;
+}
+
+// Função para tirar um bloco livre da lista da sua ordem
+static inline void buddy_list_del(Zone* zone, uint32_t pfn) {
+    Page* page = &mem_map[pfn];
+    list_del(&page->list);
+    zone->free_count[page->order]--;
+    page->flags = 0;
+}
+
+// Função para devolver um bloco à zona, juntando com o buddy (o bloco
+// vizinho de mesmo tamanho, que difere só no bit 'order') enquanto ele
+// também estiver livre: no máximo BUDDY_MAX_ORDER passos
+static void buddy_merge(Zone* zone, uint32_t pfn, uint32_t order) {
+    zone->free_pages += 1u << order;
+    
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= mem_map_pages || pfn_zone(buddy) != zone) {
+            break;
+        }
+        Page* page = &mem_map[buddy];
+        if (!(page->flags & PAGE_FREE) || page->order != order) {
+            break;
+        }
+        buddy_list_del(zone, buddy);
+        zone->merges++;
+        pfn &= ~(1u << order);
+        order++;
+    }
+    buddy_list_add(zone, pfn, order);
+}
+
+// Função para alocar 2^order páginas contíguas numa zona: pega o menor bloco
+// livre que caiba e divide ao meio, devolvendo as metades de cima às listas
+static uint32_t zone_alloc(Zone* zone, uint32_t order) {
+    uint32_t current = order;
+    
+    while (current <= BUDDY_MAX_ORDER && list_empty(&zone->free_area[current])) {
+        current++;
+    }
+    if (current > BUDDY_MAX_ORDER) {
+        return 0;
+    }
+    
+    Page* page = (Page*)zone->free_area[current].next;
+    uint32_t pfn = page - mem_map;
+    buddy_list_del(zone, pfn);
+    
+    while (current > order) {
+        current--;
+        buddy_list_add(zone, pfn + (1u << current), current);
+        zone->splits++;
+    }
+    page->order = order;
+    zone->free_pages -= 1u << order;
+    zone->allocs++;
+    return pfn;
+}
+
+// Função para alocar 2^order páginas físicas contíguas (ordens 0 a 10)
+// preferindo o nó 'node'. Os nós são tentados na ordem de distância do SLIT
+// (só o próprio com GFP_THISNODE) e, em cada um, sem GFP_DMA, a zona normal
+// e depois a DMA. Devolve o endereço físico do bloco (alinhado ao próprio
+// tamanho) ou 0.
+uint32_t buddy_alloc_node(uint32_t order, int gfp, uint32_t node) {
+    if (order > BUDDY_MAX_ORDER || node >= numa_node_count) {
+        return 0;
+    }
+    uint32_t flags = spin_lock_irqsave(&buddy_lock);
+    uint32_t pfn = 0;
+    uint32_t tries = (gfp & GFP_THISNODE) ? 1 : numa_node_count;
+    
+    for (uint32_t i = 0; i < tries && !pfn; i++) {
+        NumaNode* candidate = &numa_nodes[numa_nodes[node].fallback[i]];
+        if (!(gfp & GFP_DMA)) {
+            pfn = zone_alloc(&candidate->zones[ZONE_NORMAL], order);
+        }
+        if (!pfn) {
+            pfn = zone_alloc(&candidate->zones[ZONE_DMA], order);
+        }
+    }
+    if (!pfn) {
+        numa_nodes[node].zones[gfp & GFP_DMA ? ZONE_DMA : ZONE_NORMAL].failures++;
+    }
+    spin_unlock_irqrestore(&buddy_lock, flags);
+    return pfn << FRAME_SHIFT;
+}
+
+// Função para alocar 2^order páginas no nó da CPU atual (ou no mais perto)
+uint32_t buddy_alloc(uint32_t order, int gfp) {
+    return buddy_alloc_node(order, gfp, numa_node_id());
+}
+
+// Função para liberar um bloco de buddy_alloc (com a mesma ordem)
+void buddy_free(uint32_t address, uint32_t order) {
+    uint32_t pfn = address >> FRAME_SHIFT;
+    uint32_t flags = spin_lock_irqsave(&buddy_lock);
+    
+    if (pfn >= mem_map_pages || (mem_map[pfn].flags & PAGE_FREE)) {
+        panic("Bloco do buddy liberado duas vezes ou fora da RAM", 0);
+    }
+    Zone* zone = pfn_zone(pfn);
+    zone->frees++;
+    buddy_merge(zone, pfn, order);
+    spin_unlock_irqrestore(&buddy_lock, flags);
+}
+
+// Páginas livres de um nó
+static uint32_t node_free_pages(uint32_t node) {
+    return numa_nodes[node].zones[ZONE_DMA].free_pages + numa_nodes[node].zones[ZONE_NORMAL].free_pages;
+}
+
+// Páginas livres em todas as zonas
+uint32_t buddy_free_pages() {
+    uint32_t free = 0;
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        free += node_free_pages(node);
+    }
+    return free;
+}
+
+// Função para passar a memória do bitmap do boot para o buddy: o mem_map
+// sai do próprio bitmap e cada trecho livre vira blocos alinhados, da
+// maior ordem que couber. Depois disso pmm_alloc_frame usa o buddy.
+void buddy_init() {
+    static const char* const zone_names[ZONE_COUNT] = { "DMA", "Normal" };
+    uint32_t frames = pmm_words * 32;
+    
+    if (!frames) {
+        return;
+    }
+    
+    uint32_t bytes = frames * sizeof(Page);
+    mem_map = (Page*)pmm_alloc_run((bytes + FRAME_SIZE - 1) >> FRAME_SHIFT);
+    if (!mem_map) {
+        panic("Sem memória para o mem_map do buddy", 0);
+    }
+    mem_map_pages = frames;
+    for (uint32_t pfn = 0; pfn < frames; pfn++) {
+        mem_map[pfn].flags = 0;
+        mem_map[pfn].order = 0;
+        mem_map[pfn].node = numa_pfn_node(pfn);
+    }
+    
+    // O intervalo de cada zona é o que ela recebe abaixo
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            Zone* zone = &numa_nodes[node].zones[z];
+            zone->name = zone_names[z];
+            zone->start_pfn = frames;
+            zone->end_pfn = 0;
+            for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+                list_init(&zone->free_area[order]);
+            }
+        }
+    }
+    
+    // O limite das zonas (16 MB) é múltiplo do maior bloco (4 MB); o dos
+    // nós pode não ser, então o bloco também para onde o nó muda
+    uint32_t pfn = 0;
+    while (pfn < frames) {
+        uint32_t word = pmm_bitmap[pfn >> 5];
+        if (!(pfn & 31) && word == 0) {
+            pfn += 32;
+            continue;
+        }
+        if (!(word & (1u << (pfn & 31)))) {
+            pfn++;
+            continue;
+        }
+        
+        uint32_t order = 0;
+        while (order < BUDDY_MAX_ORDER && !(pfn & (1u << order))) {
+            uint32_t next = order + 1;
+            uint32_t last = pfn + (1u << next);
+            if (last > frames) {
+                break;
+            }
+            // O bloco inteiro precisa estar livre no bitmap e no mesmo nó
+            int all_free = 1;
+            for (uint32_t f = pfn + (1u << order); f < last; f++) {
+                if (!(pmm_bitmap[f >> 5] & (1u << (f & 31))) || mem_map[f].node != mem_map[pfn].node) {
+                    all_free = 0;
+                    break;
+                }
+            }
+            if (!all_free) {
+                break;
+            }
+            order = next;
+        }
+        
+        Zone* zone = pfn_zone(pfn);
+        zone->managed_pages += 1u << order;
+        if (pfn < zone->start_pfn) {
+            zone->start_pfn = pfn;
+        }
+        if (pfn + (1u << order) > zone->end_pfn) {
+            zone->end_pfn = pfn + (1u << order);
+        }
+        buddy_merge(zone, pfn, order);
+        pfn += 1u << order;
+    }
+    
+    // O bitmap deixa de ter frames livres: agora eles são do buddy
+    pmm_mark(0, (uint64_t)frames << FRAME_SHIFT, 0);
+    pmm_free_frames = 0;
+    buddy_ready = 1;
+}
+
+// Índice do bit mais alto ligado de x (x != 0)
+static inline uint32_t bsr(uint32_t x) {
+    uint32_t bit;
+    __asm__("bsrl %1, %0" : "=r"(bit) : "rm"(x));
+    return bit;
+}
+
+// Função para criar um slab novo: um bloco do buddy com o descritor no
+// início e os objetos depois dele, deslocados pela cor da vez para slabs
+// vizinhos não disputarem as mesmas linhas de cache. Com a trava da cache.
+static Slab* slab_grow(KmemCache* cache) {
+    uint32_t address = buddy_alloc(cache->order, 0);
+    if (!address) {
+        return 0;
+    }
+    
+    Slab* slab = (Slab*)address;
+    uint32_t pfn = address >> FRAME_SHIFT;
+    for (uint32_t i = 0; i < (1u << cache->order); i++) {
+        mem_map[pfn + i].flags = PAGE_SLAB;
+        mem_map[pfn + i].slab = slab;
+    }
+    
+    slab->cache = cache;
+    slab->color = cache->color_next;
+    slab->inuse = 0;
+    cache->color_next += CACHE_LINE;
+    if (cache->color_next > cache->color_max) {
+        cache->color_next = 0;
+    }
+    
+    // Lista de livres dentro dos próprios objetos
+    uint8_t* object = (uint8_t*)slab + SLAB_HEADER + slab->color;
+    slab->free = 0;
+    for (uint32_t i = cache->per_slab; i > 0; i--) {
+        void** node = (void**)(object + (i - 1) * cache->size);
+        *node = slab->free;
+        slab->free = node;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+// Função para tirar um objeto da camada de slabs: parciais primeiro, depois
+// um vazio guardado e só então um slab novo. Com a trava da cache.
+static void* slab_alloc_object(KmemCache* cache) {
+    Slab* slab;
+    
+    if (!list_empty(&cache->partial)) {
+        slab = (Slab*)cache->partial.next;
+    } else if (!list_empty(&cache->empty)) {
+        slab = (Slab*)cache->empty.next;
+        list_del(&slab->list);
+        list_add_tail(&cache->partial, &slab->list);
+        cache->empty_slabs--;
+    } else {
+        slab = slab_grow(cache);
+        if (!slab) {
+            return 0;
+        }
+        list_add_tail(&cache->partial, &slab->list);
+    }
+    
+    void** object = slab->free;
+    slab->free = *object;
+    slab->inuse++;
+    if (slab->inuse == cache->per_slab) {
+        list_del(&slab->list);
+        list_add_tail(&cache->full, &slab->list);
+    }
+    cache->active++;
+    return object;
+}
+
+// Função para devolver um objeto ao seu slab. Guarda um slab vazio para a
+// próxima alocação e devolve os outros ao buddy. Com a trava da cache.
+static void slab_free_object(KmemCache* cache, Slab* slab, void* object) {
+    *(void**)object = slab->free;
+    slab->free = object;
+    
+    if (slab->inuse == cache->per_slab) {
+        list_del(&slab->list);
+        list_add_tail(&cache->partial, &slab->list);
+    }
+    slab->inuse--;
+    cache->active--;
+    
+    if (slab->inuse == 0) {
+        list_del(&slab->list);
+        if (cache->empty_slabs < SLAB_KEEP_EMPTY) {
+            list_add_tail(&cache->empty, &slab->list);
+            cache->empty_slabs++;
+            return;
+        }
+        uint32_t pfn = (uint32_t)slab >> FRAME_SHIFT;
+        for (uint32_t i = 0; i < (1u << cache->order); i++) {
+            mem_map[pfn + i].flags = 0;
+        }
+        cache->slabs--;
+        buddy_free((uint32_t)slab, cache->order);
+    }
+}
+
+// Função para criar uma cache de objetos de 'size' bytes. O slab tem o menor
+// tamanho em que cabem SLAB_MIN_OBJECTS objetos, e a sobra vira cores.
+KmemCache* kmem_cache_create(const char* name, uint32_t size, uint32_t flags) {
+    if (kmem_cache_count == KMEM_MAX_CACHES) {
+        return 0;
+    }
+    KmemCache* cache = &kmem_caches[kmem_cache_count++];
+    
+    size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+    cache->name = name;
+    cache->size = size;
+    cache->flags = flags;
+    cache->order = 0;
+    while (((FRAME_SIZE << cache->order) - SLAB_HEADER) / size < SLAB_MIN_OBJECTS) {
+        cache->order++;
+    }
+    
+    uint32_t bytes = (FRAME_SIZE << cache->order) - SLAB_HEADER;
+    cache->per_slab = bytes / size;
+    cache->color_max = (bytes - cache->per_slab * size) & ~(CACHE_LINE - 1);
+    cache->color_next = 0;
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    list_init(&cache->depot_full);
+    list_init(&cache->depot_empty);
+    return cache;
+}
+
+// Caminho lento do alloc: troca o magazine carregado pelo anterior se ele
+// estiver cheio, senão troca um vazio por um cheio do depot; sem magazines
+// cheios, vai à camada de slabs
+static void* kmem_cache_alloc_slow(KmemCache* cache) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    CpuCache* cpu = &cache->cpu[cpu_id()];
+    void* object;
+    
+    if (cache->flags & CACHE_NO_MAGAZINES) {
+        object = slab_alloc_object(cache);
+    } else if (cpu->previous && cpu->previous->rounds) {
+        Magazine* full = cpu->previous;
+        cpu->previous = cpu->loaded;
+        cpu->loaded = full;
+        object = full->objects[--full->rounds];
+    } else if (!list_empty(&cache->depot_full)) {
+        Magazine* full = (Magazine*)cache->depot_full.next;
+        list_del(&full->list);
+        cache->depot_full_count--;
+        if (cpu->previous) {
+            list_add_tail(&cache->depot_empty, &cpu->previous->list);
+            cache->depot_empty_count++;
+        }
+        cpu->previous = cpu->loaded;
+        cpu->loaded = full;
+        object = full->objects[--full->rounds];
+    } else {
+        object = slab_alloc_object(cache);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return object;
+}
+
+// Função para alocar um objeto da cache. O caminho comum tira do magazine
+// da CPU só com as interrupções desligadas: sem trava e sem tocar em linhas
+// de cache de outra CPU.
+void* kmem_cache_alloc(KmemCache* cache) {
+    uint32_t flags = irq_save();
+    CpuCache* cpu = &cache->cpu[cpu_id()];
+    Magazine* magazine = cpu->loaded;
+    
+    if (magazine && magazine->rounds) {
+        void* object = magazine->objects[--magazine->rounds];
+        cpu->alloc_hits++;
+        irq_restore(flags);
+        return object;
+    }
+    irq_restore(flags);
+    return kmem_cache_alloc_slow(cache);
+}
+
+// Caminho lento do free: troca com o anterior se ele estiver vazio, senão
+// manda o anterior (cheio) ao depot e carrega um vazio. Sem magazine vazio
+// (nem memória para um novo), o objeto volta direto ao slab.
+static void kmem_cache_free_slow(KmemCache* cache, void* object) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    CpuCache* cpu = &cache->cpu[cpu_id()];
+    Slab* slab = mem_map[(uint32_t)object >> FRAME_SHIFT].slab;
+    
+    if (cache->flags & CACHE_NO_MAGAZINES) {
+        slab_free_object(cache, slab, object);
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return;
+    }
+    if (cpu->previous && cpu->previous->rounds == 0) {
+        Magazine* empty = cpu->previous;
+        cpu->previous = cpu->loaded;
+        cpu->loaded = empty;
+        empty->objects[empty->rounds++] = object;
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return;
+    }
+    
+    Magazine* empty = 0;
+    if (!list_empty(&cache->depot_empty)) {
+        empty = (Magazine*)cache->depot_empty.next;
+        list_del(&empty->list);
+        cache->depot_empty_count--;
+    } else {
+        // A cache de magazines não usa magazines, então não há recursão
+        spin_unlock_irqrestore(&cache->lock, flags);
+        empty = kmem_cache_alloc(magazine_cache);
+        flags = spin_lock_irqsave(&cache->lock);
+        // Com a trava solta a thread pode ter migrado (ou uma IRQ ter mexido
+        // nos magazines): só vale a CPU em que estamos agora
+        cpu = &cache->cpu[cpu_id()];
+        if (empty) {
+            empty->rounds = 0;
+            if (cpu->loaded && cpu->loaded->rounds < MAGAZINE_SIZE) {
+                list_add_tail(&cache->depot_empty, &empty->list);
+                cache->depot_empty_count++;
+                cpu->loaded->objects[cpu->loaded->rounds++] = object;
+                spin_unlock_irqrestore(&cache->lock, flags);
+                return;
+            }
+        }
+    }
+    
+    if (!empty) {
+        slab_free_object(cache, slab, object);
+    } else {
+        if (cpu->previous && cpu->previous->rounds) {
+            list_add_tail(&cache->depot_full, &cpu->previous->list);
+            cache->depot_full_count++;
+        } else if (cpu->previous) {
+            list_add_tail(&cache->depot_empty, &cpu->previous->list);
+            cache->depot_empty_count++;
+        }
+        cpu->previous = cpu->loaded;
+        cpu->loaded = empty;
+        empty->objects[empty->rounds++] = object;
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+// Função para devolver um objeto à cache (caminho comum igual ao do alloc)
+void kmem_cache_free(KmemCache* cache, void* object) {
+    uint32_t flags = irq_save();
+    CpuCache* cpu = &cache->cpu[cpu_id()];
+    Magazine* magazine = cpu->loaded;
+    
+    if (magazine && magazine->rounds < MAGAZINE_SIZE) {
+        magazine->objects[magazine->rounds++] = object;
+        cpu->free_hits++;
+        irq_restore(flags);
+        return;
+    }
+    irq_restore(flags);
+    kmem_cache_free_slow(cache, object);
+}
+
+// Função para alocar 'size' bytes. Até KMALLOC_MAX_SIZE sai da cache de
+// potência de 2 que couber; acima disso, páginas inteiras do buddy.
+void* kmalloc(uint32_t size) {
+    if (size == 0 || !kmalloc_caches[0]) {
+        return 0;
+    }
+    if (size <= KMALLOC_MAX_SIZE) {
+        uint32_t shift = size <= KMALLOC_MIN_SIZE ? KMALLOC_MIN_SHIFT : bsr(size - 1) + 1;
+        return kmem_cache_alloc(kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+    }
+    
+    uint32_t pages = (size + FRAME_SIZE - 1) >> FRAME_SHIFT;
+    uint32_t order = pages == 1 ? 0 : bsr(pages - 1) + 1;
+    uint32_t address = buddy_alloc(order, 0);
+    if (address) {
+        mem_map[address >> FRAME_SHIFT].flags = PAGE_LARGE;
+    }
+    return (void*)address;
+}
+
+// Função para liberar memória de kmalloc: o Page do endereço diz se ela
+// veio de um slab (e de qual cache) ou direto do buddy
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    Page* page = &mem_map[(uint32_t)ptr >> FRAME_SHIFT];
+    
+    if (page->flags & PAGE_SLAB) {
+        kmem_cache_free(((Slab*)page->slab)->cache, ptr);
+    } else if (page->flags & PAGE_LARGE) {
+        page->flags = 0;
+        buddy_free((uint32_t)ptr, page->order);
+    } else {
+        panic("kfree de um ponteiro que não veio do kmalloc", 0);
+    }
+}
+
+// Função para criar a cache de magazines e as de kmalloc (16 B a 2 KB)
+void slab_init() {
+    static const char* const names[KMALLOC_CACHES] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k"
+    };
+    
+    if (!buddy_ready) {
+        return;
+    }
+    magazine_cache = kmem_cache_create("magazine", sizeof(Magazine), CACHE_NO_MAGAZINES);
+    for (int i = 0; i < KMALLOC_CACHES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(names[i], KMALLOC_MIN_SIZE << i, 0);
+    }
+}
+
+// Função para alocar um frame físico de 4 KB. Pula palavras inteiras sem
+// bit livre, começando onde a última busca parou, e acha o bit com bsf.
+// Devolve o endereço físico ou 0 sem memória (o frame 0 nunca é livre).
+uint32_t pmm_alloc_frame() {
+    // Depois do boot os frames livres são do buddy; sem memória nele, o
+    // estoque de frames zerados ainda serve
+    if (buddy_ready) {
+        uint32_t address = buddy_alloc(0, 0);
+        if (!address) {
+            uint32_t flags = spin_lock_irqsave(&zero_pool_lock);
+            if (zero_pool_count) {
+                address = zero_pool[--zero_pool_count];
+            }
+            spin_unlock_irqrestore(&zero_pool_lock, flags);
+        }
+        return address;
+    }
+    
+    uint32_t flags = irq_save();
+    uint32_t index = pmm_hint;
+    
+    for (uint32_t n = 0; n < pmm_words; n++) {
+        if (pmm_bitmap[index]) {
+            uint32_t bit = bsf(pmm_bitmap[index]);
+            pmm_bitmap[index] &= ~(1u << bit);
+            pmm_hint = index;
+            pmm_free_frames--;
+            irq_restore(flags);
+            return ((index << 5) + bit) << FRAME_SHIFT;
+        }
+        if (++index == pmm_words) {
+            index = 0;
+        }
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Função para devolver um frame. A dica volta para trás se ele estiver
+// antes dela, para a próxima busca reaproveitar memória baixa primeiro.
+void pmm_free_frame(uint32_t address) {
+    if (buddy_ready) {
+        buddy_free(address, 0);
+        return;
+    }
+    
+    uint32_t frame = address >> FRAME_SHIFT;
+    uint32_t index = frame >> 5;
+    uint32_t mask = 1u << (frame & 31);
+    uint32_t flags = irq_save();
+    
+    if (index >= pmm_words || (pmm_bitmap[index] & mask)) {
+        panic("Frame liberado duas vezes ou fora da RAM", 0);
+    }
+    pmm_bitmap[index] |= mask;
+    pmm_free_frames++;
+    if (index < pmm_hint) {
+        pmm_hint = index;
+    }
+    irq_restore(flags);
+}
+
+// Função para zerar um frame com escritas normais: ele fica na cache, pronto
+// para quem vai usá-lo em seguida
+static inline void zero_frame(uint32_t address) {
+    uint32_t count = FRAME_SIZE / sizeof(uint32_t);
+    __asm__ volatile("rep stosl" : "+D"(address), "+c"(count) : "a"(0) : "memory");
+}
+
+// Função para zerar um frame com movnti: as escritas vão para a memória sem
+// passar pela cache, então zerar no idle não expulsa as linhas do shell.
+// Sem SSE2 usa rep stosl.
+static void zero_frame_nt(uint32_t address) {
+    if (!zero_nt) {
+        zero_frame(address);
+        return;
+    }
+    for (uint32_t p = address; p < address + FRAME_SIZE; p += 16) {
+        __asm__ volatile("movnti %1, (%0)\n"
+                         "movnti %1, 4(%0)\n"
+                         "movnti %1, 8(%0)\n"
+                         "movnti %1, 12(%0)"
+                         : : "r"(p), "r"(0) : "memory");
+    }
+    // As escritas não temporais não seguem a ordem das outras
+    __asm__ volatile("sfence" : : : "memory");
+}
+
+// Função para alocar um frame zerado: tira do estoque do idle e, com ele
+// vazio, aloca e zera na hora. Devolve o endereço físico ou 0.
+uint32_t pmm_alloc_zeroed() {
+    uint32_t flags = spin_lock_irqsave(&zero_pool_lock);
+    if (zero_pool_count) {
+        uint32_t address = zero_pool[--zero_pool_count];
+        zero_hits++;
+        spin_unlock_irqrestore(&zero_pool_lock, flags);
+        return address;
+    }
+    zero_misses++;
+    spin_unlock_irqrestore(&zero_pool_lock, flags);
+    
+    uint32_t address = pmm_alloc_frame();
+    if (address) {
+        zero_frame(address);
+    }
+    return address;
+}
+
+// Função do laço ocioso: zera um frame para o estoque. Devolve 1 se fez
+// trabalho (o chamador olha de novo se há o que fazer antes de dormir) e 0
+// com o estoque cheio ou pouca memória livre no nó.
+int zero_pool_refill() {
+    if (!buddy_ready || zero_pool_count >= ZERO_POOL_SIZE ||
+        node_free_pages(numa_node_id()) < ZERO_POOL_RESERVE) {
+        return 0;
+    }
+    uint32_t address = buddy_alloc(0, 0);
+    if (!address) {
+        return 0;
+    }
+    
+    uint64_t start = ktime_ns();
+    zero_frame_nt(address);
+    uint64_t elapsed = ktime_ns() - start;
+    
+    // Uma IRQ ou o idle de outra CPU pode ter consumido ou enchido o
+    // estoque enquanto zerava
+    uint32_t flags = spin_lock_irqsave(&zero_pool_lock);
+    if (zero_pool_count < ZERO_POOL_SIZE) {
+        zero_pool[zero_pool_count++] = address;
+        zero_refills++;
+        zero_refill_ns += elapsed;
+        address = 0;
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, flags);
+    if (address) {
+        buddy_free(address, 0);
+    }
+    return 1;
+}
+
+// Função para escolher como o idle zera os frames
+void zero_pool_init() {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    zero_nt = (d & CPUID_EDX_SSE2) != 0;
+}
+
+// Troca de contexto: empilha os registradores que quem chama espera
+// preservados (ebp, ebx, esi, edi), guarda o esp em *prev_esp e continua na
+// pilha de 'next_esp'. O resto já foi salvo pela convenção de chamada, ou
+// está no InterruptFrame quando a troca vem da saída de uma IRQ.
+void switch_to(uint32_t* prev_esp, uint32_t next_esp);
+__asm__(
+    ".pushsection .text\n"
+    ".globl switch_to\n"
+    "switch_to:\n"
+    "    movl 4(%esp), %eax\n"              // prev_esp
+    "    movl 8(%esp), %edx\n"              // next_esp
+    "    pushl %ebp\n"
+    "    pushl %ebx\n"
+    "    pushl %esi\n"
+    "    pushl %edi\n"
+    "    movl %esp, (%eax)\n"
+    "    movl %edx, %esp\n"
+    "    popl %edi\n"
+    "    popl %esi\n"
+    "    popl %ebx\n"
+    "    popl %ebp\n"
+    "    ret\n"
+    ".popsection\n"
+);
+
+// Deques Chase-Lev: o dono põe e tira no fundo sem trava; as outras CPUs
+// tiram do topo com um cmpxchg, e só o último item disputa o topo com o
+// dono. Quem é o dono (uma CPU) fica a cargo de quem chama.
+
+// Função para pôr 'item' no fundo do deque. Devolve 0 com ele cheio.
+static int deque_push(Deque* d, void* item) {
+    int32_t bottom = d->bottom;
+    if (bottom - d->top >= DEQUE_SIZE) {
+        return 0;
+    }
+    d->slots[bottom & (DEQUE_SIZE - 1)] = item;
+    // O item precisa estar no slot antes de o fundo andar
+    __asm__ volatile("" : : : "memory");
+    d->bottom = bottom + 1;
+    return 1;
+}
+
+// Função para tirar o item mais novo, do fundo (só o dono)
+static void* deque_pop(Deque* d) {
+    int32_t bottom = d->bottom - 1;
+    void* item = 0;
+    
+    d->bottom = bottom;
+    // A escrita do fundo tem que ser vista antes da leitura do topo
+    __sync_synchronize();
+    int32_t top = d->top;
+    if (top <= bottom) {
+        item = d->slots[bottom & (DEQUE_SIZE - 1)];
+        if (top == bottom) {
+            if (!__sync_bool_compare_and_swap(&d->top, top, top + 1)) {
+                item = 0;
+            }
+            d->bottom = bottom + 1;
+        }
+    } else {
+        d->bottom = bottom + 1;
+    }
+    return item;
+}
+
+// Função para tirar o item mais velho, do topo (de qualquer CPU, sem
+// trava). Devolve 0 se o deque está vazio ou se outra CPU levou o item.
+static void* deque_steal(Deque* d) {
+    int32_t top = d->top;
+    int32_t bottom = d->bottom;
+    
+    if (top >= bottom) {
+        return 0;
+    }
+    void* item = d->slots[top & (DEQUE_SIZE - 1)];
+    if (!__sync_bool_compare_and_swap(&d->top, top, top + 1)) {
+        return 0;
+    }
+    return item;
+}
+
+// Itens no deque (lido de outra CPU, só uma estimativa)
+static inline int32_t deque_size(Deque* d) {
+    return d->bottom - d->top;
+}
+
+// Função para pôr uma thread pronta, já fora de qualquer CPU, na fila 'rq'
+// (a da CPU atual, a não ser para as presas). As livres vão para o fundo
+// do deque da sua prioridade, onde outra CPU pode roubá-las; as presas, e
+// as que não cabem no deque, para a lista travada. Com as interrupções
+// desligadas.
+static void rq_enqueue(RunQueue* rq, Thread* t) {
+    if (!t->pinned && deque_push(&rq->ready[t->priority], t)) {
+        return;
+    }
+    spin_lock(&rq->lock);
+    list_add_tail(&rq->queues[t->priority], &t->run);
+    rq->mask |= 1u << t->priority;
+    spin_unlock(&rq->lock);
+}
+
+// Diz se a CPU tem threads prontas de prioridade 'priority'
+static inline int rq_ready(RunQueue* rq, int priority) {
+    return (rq->mask & (1u << priority)) || deque_size(&rq->ready[priority]) > 0;
+}
+
+// Prioridade mais alta com threads prontas na CPU, ou -1
+static int rq_top_priority(RunQueue* rq) {
+    for (int priority = THREAD_PRIORITIES - 1; priority >= 0; priority--) {
+        if (rq_ready(rq, priority)) {
+            return priority;
+        }
+    }
+    return -1;
+}
+
+// Diz se outra CPU tem threads livres prontas que esta poderia roubar
+static int rq_stealable() {
+    uint32_t self = cpu_id();
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu == self) {
+            continue;
+        }
+        for (int priority = 0; priority < THREAD_PRIORITIES; priority++) {
+            if (deque_size(&run_queues[cpu].ready[priority]) > 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Função para tirar a thread pronta mais velha de prioridade 'priority' da
+// CPU: a lista travada e depois o topo do deque, que o dono também lê pelo
+// topo para manter o rodízio por ordem de chegada
+static Thread* rq_take(RunQueue* rq, int priority) {
+    if (rq->mask & (1u << priority)) {
+        // Só esta CPU tira da lista, então o bit não some no caminho
+        spin_lock(&rq->lock);
+        ListNode* head = &rq->queues[priority];
+        Thread* t = (Thread*)head->next;
+        list_del(&t->run);
+        if (list_empty(head)) {
+            rq->mask &= ~(1u << priority);
+        }
+        spin_unlock(&rq->lock);
+        return t;
+    }
+    
+    Deque* ready = &rq->ready[priority];
+    while (deque_size(ready) > 0) {
+        Thread* t = deque_steal(ready);
+        if (t) {
+            return t;
+        }
+    }
+    return 0;
+}
+
+// Função para roubar uma thread livre de prioridade 'min' ou maior das
+// outras CPUs, a mais prioritária primeiro e a partir da vizinha (cada
+// ladrão começa num lugar diferente)
+static Thread* rq_steal(RunQueue* rq, int min) {
+    uint32_t self = cpu_id();
+    for (int priority = THREAD_PRIORITIES - 1; priority >= min; priority--) {
+        for (uint32_t i = 1; i < NR_CPUS; i++) {
+            Deque* ready = &run_queues[(self + i) & (NR_CPUS - 1)].ready[priority];
+            while (deque_size(ready) > 0) {
+                Thread* t = deque_steal(ready);
+                if (t) {
+                    rq->steals++;
+                    return t;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Função para tirar a próxima thread de prioridade 'min' ou maior: a mais
+// prioritária da CPU e, sem nenhuma, uma roubada de outra CPU. Devolve 0
+// se não há nenhuma.
+static Thread* rq_pick(RunQueue* rq, int min) {
+    for (int priority = THREAD_PRIORITIES - 1; priority >= min; priority--) {
+        Thread* t = rq_take(rq, priority);
+        if (t) {
+            return t;
+        }
+    }
+    return rq_steal(rq, min);
+}
+
+// Função para acordar uma CPU ociosa depois de deixar threads livres no
+// deque: ela sai do hlt e rouba uma
+static void sched_kick_idle() {
+    if (!lapic) {
+        return;
+    }
+    // O fundo novo do deque precisa ser visto antes da leitura da máscara
+    // (a ociosa liga o bit e depois olha os deques)
+    __sync_synchronize();
+    uint32_t idle = sched_idle_mask & ~(1u << cpu_id());
+    if (!idle) {
+        return;
+    }
+    uint32_t cpu = bsf(idle);
+    if (__sync_fetch_and_and(&sched_idle_mask, ~(1u << cpu)) & (1u << cpu)) {
+        lapic_send_ipi(per_cpu[cpu].apic_id, LAPIC_RESCHED_VECTOR);
+    }
+}
+
+// Callback do fim da fatia de tempo: a troca acontece na saída da IRQ
+static void sched_slice_expired(Timer* t) {
+    (void)t;
+    this_rq()->need_resched = 1;
+}
+
+// Função para armar a fatia de 'next': só há o que dividir se outra thread
+// da mesma prioridade está esperando na CPU ('waiting': a que está saindo
+// e ainda vai para a fila). Sem isso o timer fica parado.
+static void sched_arm_slice(RunQueue* rq, Thread* next, int waiting) {
+    timer_cancel(&rq->slice);
+    if (next != rq->idle && (waiting || rq_ready(rq, next->priority))) {
+        timer_add(&rq->slice, ktime_ns() + SCHED_SLICE_NS, sched_slice_expired);
+    }
+}
+
+// Função para fechar uma troca já na pilha de quem entrou. Só agora a
+// pilha de quem saiu está livre: uma thread pronta volta à fila (e pode ser
+// roubada), uma bloqueada pode ser acordada em outra CPU e uma terminada é
+// liberada (ela não podia liberar a pilha em que estava).
+static void sched_finish(RunQueue* rq) {
+    Thread* prev = rq->previous;
+    
+    rq->previous = 0;
+    if (!prev) {
+        return;
+    }
+    // O estado só muda depois de on_cpu zerar (thread_wake espera por ele)
+    int state = prev->state;
+    if (state == THREAD_DEAD) {
+        spin_lock(&threads_lock);
+        list_del(&prev->all);
+        thread_count--;
+        spin_unlock(&threads_lock);
+        kmem_cache_free(stack_cache, prev->stack);
+        kmem_cache_free(thread_cache, prev);
+        return;
+    }
+    prev->on_cpu = 0;
+    if (state == THREAD_READY) {
+        rq_enqueue(rq, prev);
+        sched_kick_idle();
+    }
+}
+
+// Função para escolher a próxima thread e trocar para ela. A atual, se
+// ainda pode rodar, só cede a CPU a uma de prioridade igual ou maior e
+// volta para a fila em sched_finish; bloqueada ou morta, só sai. Uma
+// thread livre pode voltar de switch_to em outra CPU.
+void schedule() {
+    uint32_t flags = irq_save();
+    RunQueue* rq = this_rq();
+    Thread* prev = rq->current;
+    int runnable = prev->state == THREAD_RUNNING && prev != rq->idle;
+    
+    rq->need_resched = 0;
+    Thread* next = rq_pick(rq, runnable ? prev->priority : 0);
+    if (!next) {
+        next = runnable ? prev : rq->idle;
+    }
+    
+    if (next != prev) {
+        if (prev->stack && *(uint32_t*)prev->stack != THREAD_STACK_MAGIC) {
+            panic("Estouro da pilha de uma thread", 0);
+        }
+        if (runnable) {
+            prev->state = THREAD_READY;
+        }
+        next->state = THREAD_RUNNING;
+        next->cpu = cpu_id();
+        next->on_cpu = 1;
+        
+        uint64_t now = ktime_ns();
+        prev->runtime_ns += now - rq->switch_start;
+        rq->switch_start = now;
+        rq->switches++;
+        next->switches++;
+        rq->current = next;
+        rq->previous = prev;
+        sched_arm_slice(rq, next, runnable && prev->priority == next->priority);
+        switch_to(&prev->esp, next->esp);
+        
+        // De volta a 'prev', na pilha dele, depois de outra troca (e talvez
+        // em outra CPU)
+        sched_finish(this_rq());
+    }
+    irq_restore(flags);
+}
+
+// Função para ver se a fila recebeu uma thread que passa à frente da atual:
+// a troca fica pendente e acontece assim que for permitida. Empatada com a
+// atual, a nova só precisa de uma fatia de tempo armada. A ociosa troca
+// também se há o que roubar.
+static void sched_check_wakeup(RunQueue* rq) {
+    Thread* current = rq->current;
+    int priority = rq_top_priority(rq);
+    
+    if (current == rq->idle) {
+        if (priority >= 0 || rq_stealable()) {
+            rq->need_resched = 1;
+        }
+    } else if (priority > current->priority) {
+        rq->need_resched = 1;
+    } else if (priority == current->priority && !rq->slice.pending) {
+        timer_add(&rq->slice, ktime_ns() + SCHED_SLICE_NS, sched_slice_expired);
+    }
+}
+
+// Handler da IPI de reescalonamento: outra CPU pôs uma thread presa na
+// nossa fila ou tem threads livres sobrando
+static void sched_ipi(InterruptFrame* frame) {
+    (void)frame;
+    sched_check_wakeup(this_rq());
+}
+
+// Função para acordar uma thread bloqueada (de uma IRQ, de um softirq ou de
+// outra thread, de qualquer CPU). Uma livre vai para o deque da CPU que a
+// acorda, e uma CPU ociosa é chamada para roubá-la se esta está ocupada;
+// uma presa volta à fila da CPU dela, com uma IPI se essa CPU é outra. Uma
+// thread que ainda não bloqueou guarda o aviso e o próximo thread_wait
+// volta na hora.
+void thread_wake(Thread* t) {
+    if (!t) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&t->lock);
+    int remote = -1;
+    int kick = 0;
+    if (t->state == THREAD_BLOCKED) {
+        // Ela pode ainda estar saindo da CPU em que bloqueou
+        while (t->on_cpu) {
+            __asm__ volatile("pause");
+        }
+        t->state = THREAD_READY;
+        if (t->pinned && t->cpu != (uint32_t)cpu_id()) {
+            remote = t->cpu;
+            rq_enqueue(&run_queues[remote], t);
+        } else {
+            RunQueue* rq = this_rq();
+            rq_enqueue(rq, t);
+            sched_check_wakeup(rq);
+            kick = !t->pinned && rq->current != rq->idle;
+        }
+    } else {
+        t->wakeup = 1;
+    }
+    spin_unlock(&t->lock);
+    if (remote >= 0) {
+        lapic_send_ipi(per_cpu[remote].apic_id, LAPIC_RESCHED_VECTOR);
+    } else if (kick) {
+        sched_kick_idle();
+    }
+    irq_restore(flags);
+    preempt_check();
+}
+
+// Função para esperar um evento com as interrupções desligadas, depois de
+// registrar quem vai acordar a thread: o teste da condição e o bloqueio
+// ficam atômicos (um thread_wake de outra CPU no meio fica em 'wakeup').
+// Sem threads (ou na ociosa) dorme em hlt até a próxima IRQ; o sti só vale
+// depois da instrução seguinte, então uma IRQ que chegue após o teste
+// acorda o hlt em vez de se perder.
+static void thread_wait() {
+    RunQueue* rq = this_rq();
+    Thread* current = rq->current;
+    
+    if (current && current != rq->idle) {
+        spin_lock(&current->lock);
+        if (current->wakeup) {
+            current->wakeup = 0;
+            spin_unlock(&current->lock);
+            return;
+        }
+        current->state = THREAD_BLOCKED;
+        spin_unlock(&current->lock);
+        schedule();
+    } else {
+        __asm__ volatile("sti; hlt; cli" : : : "memory");
+    }
+}
+
+// Função para devolver a CPU às outras threads prontas da mesma prioridade
+void thread_yield() {
+    schedule();
+}
+
+// Função para terminar a thread atual: a próxima libera a pilha e o TCB
+void thread_exit() {
+    irq_save();
+    this_rq()->current->state = THREAD_DEAD;
+    schedule();
+    panic("Thread terminada voltou a rodar", 0);
+}
+
+// Primeira execução de uma thread: o ret do switch_to cai aqui, ainda com
+// as interrupções desligadas pelo schedule de quem saiu
+static void thread_start() {
+    RunQueue* rq = this_rq();
+    Thread* t = rq->current;
+    
+    sched_finish(rq);
+    __asm__ volatile("sti" : : : "memory");
+    t->entry(t->arg);
+    thread_exit();
+}
+
+// Função para criar uma thread pronta para rodar 'entry(arg)', começando na
+// CPU 'cpu' e presa a ela se 'pinned'. O TCB e a pilha vêm das caches de
+// objetos (as pilhas de threads que saíram ficam nos magazines para a
+// próxima). Devolve 0 sem memória, sem escalonador ou com a CPU offline.
+static Thread* thread_spawn(uint32_t cpu, int pinned, const char* name, void (*entry)(void* arg), void* arg, int priority) {
+    if (!thread_cache || cpu >= NR_CPUS || !run_queues[cpu].idle) {
+        return 0;
+    }
+    Thread* t = kmem_cache_alloc(thread_cache);
+    uint8_t* stack = kmem_cache_alloc(stack_cache);
+    if (!t || !stack) {
+        if (t) {
+            kmem_cache_free(thread_cache, t);
+        }
+        if (stack) {
+            kmem_cache_free(stack_cache, stack);
+        }
+        return 0;
+    }
+    
+    t->stack = stack;
+    t->entry = entry;
+    t->arg = arg;
+    t->name = name;
+    t->priority = priority;
+    t->state = THREAD_BLOCKED;
+    t->switches = 0;
+    t->runtime_ns = 0;
+    t->cpu = cpu;
+    t->pinned = pinned;
+    t->on_cpu = 0;
+    t->lock.locked = 0;
+    t->wakeup = 0;
+    *(uint32_t*)stack = THREAD_STACK_MAGIC;
+    
+    // Pilha como switch_to a deixaria: edi, esi, ebx, ebp e o retorno
+    uint32_t* sp = (uint32_t*)(stack + THREAD_STACK_SIZE);
+    *--sp = 0;                              // Retorno de thread_start (nunca usado)
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;                              // ebp
+    *--sp = 0;                              // ebx
+    *--sp = 0;                              // esi
+    *--sp = 0;                              // edi
+    t->esp = (uint32_t)sp;
+    
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    t->id = thread_next_id++;
+    list_add_tail(&all_threads, &t->all);
+    thread_count++;
+    spin_unlock_irqrestore(&threads_lock, flags);
+    
+    thread_wake(t);
+    return t;
+}
+
+// Função para criar uma thread presa à CPU 'cpu' (nunca é roubada)
+Thread* thread_create_on(uint32_t cpu, const char* name, void (*entry)(void* arg), void* arg, int priority) {
+    return thread_spawn(cpu, 1, name, entry, arg, priority);
+}
+
+// Função para criar uma thread livre: começa no deque da CPU atual e
+// qualquer CPU ociosa pode roubá-la
+Thread* thread_create(const char* name, void (*entry)(void* arg), void* arg, int priority) {
+    return thread_spawn(cpu_id(), 0, name, entry, arg, priority);
+}
+
+// Função para montar a fila de prontas da CPU 'cpu' com o contexto atual
+// como thread ociosa ('stack' é a pilha dele, 0 na do boot da BSP)
+static void sched_init_cpu(int cpu, uint8_t* stack) {
+    RunQueue* rq = &run_queues[cpu];
+    for (int priority = 0; priority < THREAD_PRIORITIES; priority++) {
+        list_init(&rq->queues[priority]);
+    }
+    Thread* idle = &idle_threads[cpu];
+    idle->name = "idle";
+    idle->stack = stack;
+    idle->priority = THREAD_PRIO_LOW;
+    idle->state = THREAD_RUNNING;
+    idle->cpu = cpu;
+    idle->pinned = 1;
+    idle->on_cpu = 1;
+    
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    idle->id = thread_next_id++;
+    list_add_tail(&all_threads, &idle->all);
+    thread_count++;
+    spin_unlock_irqrestore(&threads_lock, flags);
+    
+    rq->idle = idle;
+    rq->switch_start = ktime_ns();
+    rq->current = idle;
+}
+
+// Função para ligar o escalonador: o contexto do boot vira a thread ociosa
+// da CPU e threads e pilhas passam a vir de caches próprias. Sem o buddy
+// não há onde criar threads e o kernel segue numa linha só.
+int sched_init() {
+    if (!buddy_ready) {
+        return 0;
+    }
+    thread_cache = kmem_cache_create("thread", sizeof(Thread), 0);
+    stack_cache = kmem_cache_create("thread-stack", THREAD_STACK_SIZE, 0);
+    if (!thread_cache || !stack_cache) {
+        thread_cache = 0;
+        return 0;
+    }
+    
+    list_init(&all_threads);
+    sched_init_cpu(cpu_id(), 0);
+    return 1;
+}
+
+// Laço da thread ociosa: enquanto nenhuma thread está pronta nesta CPU nem
+// sobrando em outra, zera frames para o estoque e, sem mais o que zerar,
+// dorme em hlt até a próxima IRQ (ou a IPI de quem deixou threads livres)
+static void cpu_idle() {
+    RunQueue* rq = this_rq();
+    uint32_t bit = 1u << cpu_id();
+    
+    while (1) {
+        if (rq_top_priority(rq) >= 0 || rq_stealable()) {
+            schedule();
+            continue;
+        }
+        if (zero_pool_refill()) {
+            continue;
+        }
+        __asm__ volatile("cli" : : : "memory");
+        // Liga o bit antes de olhar as filas de novo: um push depois disso
+        // acha o bit e manda a IPI
+        __sync_fetch_and_or(&sched_idle_mask, bit);
+        if (rq_top_priority(rq) < 0 && !rq_stealable()) {
+            __asm__ volatile("sti; hlt" : : : "memory");
+        }
+        __sync_fetch_and_and(&sched_idle_mask, ~bit);
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+// Deques de trabalho: cada CPU empilha e tira do fundo da sua sem trava; as
+// ociosas roubam do topo das outras. O dono é a CPU, não uma thread: push e
+// pop rodam com a troca de thread proibida.
+
+// Função para pôr um item no fundo do deque da CPU atual. Devolve 0 com o
+// deque cheio (quem chama roda o item na hora).
+static int work_push(Work* work) {
+    preempt_disable();
+    int ok = deque_push(&work_deques[cpu_id()].deque, work);
+    preempt_enable();
+    return ok;
+}
+
+// Função para tirar o item mais novo do deque da CPU atual
+static Work* work_pop() {
+    preempt_disable();
+    Work* work = deque_pop(&work_deques[cpu_id()].deque);
+    preempt_enable();
+    return work;
+}
+
+// Função para roubar o item mais velho do deque de 'victim' (com a troca
+// proibida por quem chama). Devolve 0 se ele está vazio ou se outro ladrão
+// ganhou.
+static Work* work_steal(uint32_t victim) {
+    Deque* deque = &work_deques[victim].deque;
+    if (deque_size(deque) <= 0) {
+        return 0;
+    }
+    Work* work = deque_steal(deque);
+    if (!work) {
+        work_deques[cpu_id()].steal_misses++;
+        return 0;
+    }
+    work_deques[cpu_id()].steals++;
+    return work;
+}
+
+// Diz se algum deque tem trabalho
+static int work_pending() {
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (deque_size(&work_deques[cpu].deque) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Função para achar trabalho: primeiro o próprio deque, depois roubando das
+// outras CPUs a partir da vizinha (cada ladrão começa num lugar diferente)
+static Work* work_find() {
+    Work* work = work_pop();
+    if (work) {
+        return work;
+    }
+    preempt_disable();
+    uint32_t self = cpu_id();
+    for (uint32_t i = 1; i < NR_CPUS && !work; i++) {
+        work = work_steal((self + i) & (NR_CPUS - 1));
+    }
+    preempt_enable();
+    return work;
+}
+
+// Função para acordar um worker ocioso depois de um push, se há algum entre
+// as CPUs liberadas para o trabalho
+static void work_kick() {
+    // O fundo novo precisa ser visto antes da leitura da máscara (o worker
+    // liga o bit e depois olha os deques)
+    __sync_synchronize();
+    uint32_t idle = work_idle_mask & work_cpu_mask;
+    if (!idle) {
+        return;
+    }
+    uint32_t cpu = bsf(idle);
+    if (__sync_fetch_and_and(&work_idle_mask, ~(1u << cpu)) & (1u << cpu)) {
+        thread_wake(work_threads[cpu]);
+    }
+}
+
+// Função para rodar um item, contado na CPU que o rodou
+static inline void work_run(Work* work) {
+    preempt_disable();
+    work_deques[cpu_id()].executed++;
+    preempt_enable();
+    work->run(work);
+}
+
+// Thread de trabalho de uma CPU: roda o que achar e, sem nada em nenhum
+// deque (ou com a CPU fora de work_cpu_mask), bloqueia até um work_kick
+static void work_thread(void* arg) {
+    uint32_t cpu = (uint32_t)arg;
+    uint32_t bit = 1u << cpu;
+    
+    while (1) {
+        if (work_cpu_mask & bit) {
+            Work* work = work_find();
+            if (work) {
+                work_run(work);
+                continue;
+            }
+        }
+        
+        // Liga o bit antes de olhar os deques: um push depois disso acha o
+        // bit e acorda (o aviso fica guardado se ainda não bloqueou)
+        __sync_fetch_and_or(&work_idle_mask, bit);
+        if ((work_cpu_mask & bit) && work_pending()) {
+            __sync_fetch_and_and(&work_idle_mask, ~bit);
+            continue;
+        }
+        __asm__ volatile("cli" : : : "memory");
+        thread_wait();
+        __asm__ volatile("sti" : : : "memory");
+        __sync_fetch_and_and(&work_idle_mask, ~bit);
+    }
+}
+
+// Item de parallel_for: parte ao meio enquanto o trecho passa do grão,
+// deixando a metade de cima no deque para quem quiser roubar, e roda o resto
+static void parallel_run(Work* work) {
+    ParallelJob* job = work->data;
+    uint32_t begin = work->begin;
+    uint32_t end = work->end;
+    
+    while (end - begin > job->grain) {
+        uint32_t middle = begin + (end - begin) / 2;
+        Work* half = kmem_cache_alloc(work_cache);
+        if (!half) {
+            break;
+        }
+        half->run = parallel_run;
+        half->data = job;
+        half->begin = middle;
+        half->end = end;
+        if (!work_push(half)) {
+            kmem_cache_free(work_cache, half);
+            break;
+        }
+        work_kick();
+        end = middle;
+    }
+    
+    job->func(begin, end, job->arg);
+    kmem_cache_free(work_cache, work);
+    // Depois disso o job (na pilha de quem chamou) pode sumir
+    __sync_fetch_and_sub(&job->remaining, end - begin);
+}
+
+// Função para rodar func(begin, end, arg) sobre trechos de [0, count) em
+// todas as CPUs liberadas, com trechos de até 'grain' índices. Quem chama
+// também trabalha e só volta quando todos os trechos terminaram. Sem
+// escalonador (ou sem memória) roda tudo aqui mesmo.
+void parallel_for(uint32_t count, uint32_t grain, ParallelFunc func, void* arg) {
+    Work* root = work_cache ? kmem_cache_alloc(work_cache) : 0;
+    if (!root) {
+        func(0, count, arg);
+        return;
+    }
+    
+    ParallelJob job = { func, arg, grain ? grain : 1, count };
+    root->run = parallel_run;
+    root->data = &job;
+    root->begin = 0;
+    root->end = count;
+    work_run(root);
+    
+    // Ajuda até o último trecho acabar; sem o que fazer, cede a CPU (um
+    // worker desta CPU pode estar com um trecho)
+    while (job.remaining) {
+        Work* work = work_find();
+        if (work) {
+            work_run(work);
+        } else {
+            thread_yield();
+        }
+    }
+}
+
+// Função para criar uma thread de trabalho em cada CPU online, depois do
+// smp_init. Sem elas parallel_for roda só em quem chama.
+void work_init() {
+    work_cache = kmem_cache_create("work", sizeof(Work), 0);
+    if (!work_cache) {
+        return;
+    }
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu == 0 || per_cpu[cpu].online) {
+            work_threads[cpu] = thread_create_on(cpu, "kworker", work_thread, (void*)cpu, THREAD_PRIO_NORMAL);
+        }
+    }
+    work_cpu_mask = (1u << cpus_online) - 1;
+}
+
+// Função para liberar só 'cpus' CPUs para o trabalho, a começar por 'first'
+// (os benchmarks usam a CPU do shell)
+static void work_limit(uint32_t first, uint32_t cpus) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < cpus; i++) {
+        mask |= 1u << ((first + i) % cpus_online);
+    }
+    work_cpu_mask = mask;
+}
+
+// Função para invalidar a tradução de uma página no TLB
+static inline void invlpg(uint32_t virt) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// Função para esvaziar o TLB inteiro, inclusive as páginas globais
+static void tlb_flush_all() {
+    uint32_t cr3, cr4;
+    
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+    }
+}
+
+// Função para mapear uma página de 4 KB. A tabela de páginas sai do
+// alocador de frames quando o diretório ainda não tem uma para 'virt'.
+// Devolve 0 se a faixa já é uma página de 4 MB ou falta memória.
+static int map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t* pde = &page_directory[virt >> LARGE_PAGE_SHIFT];
+    
+    if (*pde & PTE_LARGE) {
+        return 0;
+    }
+    if (!(*pde & PTE_PRESENT)) {
+        uint32_t table = pmm_alloc_zeroed();
+        if (!table) {
+            return 0;
+        }
+        *pde = table | PTE_PRESENT | PTE_WRITE;
+        page_tables++;
+    }
+    
+    uint32_t* table = (uint32_t*)(*pde & ~(FRAME_SIZE - 1));
+    table[(virt >> FRAME_SHIFT) & 1023] = (phys & ~(FRAME_SIZE - 1)) | flags | PTE_PRESENT;
+    invlpg(virt);
+    return 1;
+}
+
+// Função para mapear registradores de um dispositivo sem cache, numa faixa
+// própria do espaço virtual. Devolve o endereço virtual de 'phys' ou 0.
+void* ioremap(uint32_t phys, uint32_t size) {
+    if (!paging_enabled) {
+        return (void*)phys;
+    }
+    
+    uint32_t offset = phys & (FRAME_SIZE - 1);
+    uint32_t pages = (offset + size + FRAME_SIZE - 1) >> FRAME_SHIFT;
+    uint32_t flags = irq_save();
+    
+    if (pages > (IOREMAP_END - ioremap_next) >> FRAME_SHIFT) {
+        irq_restore(flags);
+        return 0;
+    }
+    uint32_t virt = ioremap_next;
+    for (uint32_t i = 0; i < pages; i++) {
+        if (!map_page(virt + (i << FRAME_SHIFT), phys - offset + (i << FRAME_SHIFT),
+                      PTE_WRITE | PTE_PCD | PTE_PWT)) {
+            irq_restore(flags);
+            return 0;
+        }
+    }
+    ioremap_next += pages << FRAME_SHIFT;
+    irq_restore(flags);
+    return (void*)(virt + offset);
+}
+
+// Handler do #PF: diz o que o acesso tentou fazer e para no pânico, que
+// mostra o endereço (CR2)
+static void page_fault(InterruptFrame* frame) {
+    static const char* const reasons[4] = {
+        "Page Fault: leitura de página ausente",
+        "Page Fault: escrita em página ausente",
+        "Page Fault: leitura proibida",
+        "Page Fault: escrita em página só de leitura",
+    };
+    uint32_t address;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(address));
+    
+    const char* reason = reasons[((frame->error & PF_PRESENT) ? 2 : 0) | ((frame->error & PF_WRITE) ? 1 : 0)];
+    if (frame->error & PF_RESERVED) {
+        reason = "Page Fault: bit reservado na tabela de páginas";
+    } else if (frame->error & PF_FETCH) {
+        reason = "Page Fault: execução fora do código mapeado";
+    } else if (!(frame->error & PF_PRESENT) && address < FRAME_SIZE) {
+        reason = "Page Fault: ponteiro nulo";
+    } else if (!(frame->error & PF_PRESENT) && address - (uint32_t)kernel_stack_guard < FRAME_SIZE) {
+        reason = "Page Fault: estouro da pilha do kernel";
+    }
+    panic(reason, frame);
+}
+
+// Função para ligar a paginação. A RAM (até o fim do mapa do multiboot,
+// em múltiplos de 4 MB) fica mapeada em identidade com páginas de 4 MB,
+// e os primeiros 4 MB do kernel aparecem de novo em KERNEL_VIRTUAL_BASE.
+// Só os primeiros 4 MB usam páginas de 4 KB: a página 0 e a de guarda da
+// pilha ficam de fora, e a janela da VGA é write-combining (com PAT) ou
+// uncached.
+void paging_init(MultibootInfo* mbi) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_EDX_PSE) || (uint32_t)kernel_end > LARGE_PAGE_SIZE) {
+        return;
+    }
+    
+    // Entrada 1 do PAT (só PWT na PTE) vira write-combining
+    uint32_t vga_flags = PTE_PCD | PTE_PWT;
+    if (d & CPUID_EDX_PAT) {
+        uint64_t pat = rdmsr(MSR_PAT);
+        pat = (pat & ~0xFF00ULL) | ((uint64_t)PAT_WC << 8);
+        __asm__ volatile("wbinvd" : : : "memory");
+        wrmsr(MSR_PAT, pat);
+        vga_flags = PTE_PWT;
+        pat_wc = 1;
+    }
+    uint32_t global = (d & CPUID_EDX_PGE) ? PTE_GLOBAL : 0;
+    
+    // Maior endereço de RAM ou de tabelas ACPI no mapa, abaixo do alias
+    uint64_t top = LARGE_PAGE_SIZE;
+    if (mbi) {
+        uint32_t cursor = 0;
+        uint64_t start, end;
+        uint32_t type;
+        while (mmap_next(mbi, &cursor, &start, &end, &type)) {
+            if ((type == MULTIBOOT_MEMORY_AVAILABLE || type == MULTIBOOT_MEMORY_ACPI ||
+                 type == MULTIBOOT_MEMORY_NVS) && end > top) {
+                top = end;
+            }
+        }
+    }
+    if (top > KERNEL_VIRTUAL_BASE) {
+        top = KERNEL_VIRTUAL_BASE;
+    }
+    identity_top = (uint32_t)((top + LARGE_PAGE_SIZE - 1) & ~(uint64_t)(LARGE_PAGE_SIZE - 1));
+    
+    for (uint32_t i = 0; i < 1024; i++) {
+        uint32_t phys = i << FRAME_SHIFT;
+        uint32_t flags = PTE_PRESENT | PTE_WRITE | global;
+        if (phys >= VGA_WINDOW_START && phys < VGA_WINDOW_END) {
+            flags |= vga_flags;
+        }
+        low_page_table[i] = phys | flags;
+    }
+    low_page_table[0] = 0;
+    low_page_table[(uint32_t)kernel_stack_guard >> FRAME_SHIFT] = 0;
+    
+    page_directory[0] = (uint32_t)low_page_table | PTE_PRESENT | PTE_WRITE;
+    for (uint32_t i = 1; i < identity_top >> LARGE_PAGE_SHIFT; i++) {
+        page_directory[i] = (i << LARGE_PAGE_SHIFT) | PTE_PRESENT | PTE_WRITE | PTE_LARGE | global;
+    }
+    page_directory[KERNEL_VIRTUAL_BASE >> LARGE_PAGE_SHIFT] = page_directory[0];
+    
+    // O double fault troca de tarefa e carrega o CR3 da TSS dele
+    double_fault_tss[0].cr3 = (uint32_t)page_directory;
+    interrupt_install(14, page_fault);
+    
+    uint32_t cr0, cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PSE | (global ? CR4_PGE : 0);
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+    __asm__ volatile("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG | CR0_WP) : "memory");
+    paging_enabled = 1;
+}
+
+// Função para ler uma palavra por página de 'pages' páginas a partir de
+// 'base', TLB_BENCH_ROUNDS vezes, com o TLB vazio no começo. O deslocamento
+// dentro da página muda a cada uma para as leituras não caírem no mesmo
+// conjunto da cache.
+static uint64_t tlb_walk(uint32_t base, uint32_t pages) {
+    uint32_t sum = 0;
+    
+    tlb_flush_all();
+    uint64_t start = ktime_ns();
+    for (int round = 0; round < TLB_BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < pages; i++) {
+            sum += *(volatile uint32_t*)(base + (i << FRAME_SHIFT) + ((i * CACHE_LINE) & (FRAME_SIZE - 1)));
+        }
+    }
+    uint64_t elapsed = ktime_ns() - start;
+    __asm__ volatile("" : : "r"(sum));
+    return elapsed;
+}
+
+// Microbenchmark do TLB: a mesma RAM (a partir de 4 MB) lida pelo mapa
+// identidade de 4 MB e por uma janela de páginas de 4 KB. Com 4096 páginas
+// o TLB de 4 KB não dá conta e a diferença é o custo das faltas.
+void tlb_bench() {
+    static int window_ready = 0;
+    
+    if (!paging_enabled) {
+        kprintf(KC_WHITE "Paginação desligada (CPU sem PSE)\n");
+        return;
+    }
+    uint32_t pages = (identity_top - LARGE_PAGE_SIZE) >> FRAME_SHIFT;
+    if (pages > TLB_BENCH_PAGES) {
+        pages = TLB_BENCH_PAGES;
+    }
+    if (pages == 0) {
+        kprintf(KC_WHITE "Sem RAM acima de 4 MB para o teste\n");
+        return;
+    }
+    if (!window_ready) {
+        for (uint32_t i = 0; i < pages; i++) {
+            uint32_t offset = i << FRAME_SHIFT;
+            if (!map_page(TLB_BENCH_BASE + offset, LARGE_PAGE_SIZE + offset, PTE_WRITE)) {
+                kprintf(KC_WHITE "Sem memória para as tabelas de páginas\n");
+                return;
+            }
+        }
+        window_ready = 1;
+    }
+    
+    // Uma volta para aquecer a cache de dados com as mesmas linhas
+    tlb_walk(LARGE_PAGE_SIZE, pages);
+    uint64_t large_ns = tlb_walk(LARGE_PAGE_SIZE, pages);
+    uint64_t small_ns = tlb_walk(TLB_BENCH_BASE, pages);
+    
+    uint32_t accesses = pages * TLB_BENCH_ROUNDS;
+    uint64_t large_ps = large_ns * 1000;
+    uint64_t small_ps = small_ns * 1000;
+    div64_32(&large_ps, accesses);
+    div64_32(&small_ps, accesses);
+    kprintf(KC_WHITE "%u páginas x %d voltas, uma leitura por página:\n", pages, TLB_BENCH_ROUNDS);
+    kprintf("  páginas de 4 MB: %4u.%03u ns/leitura\n",
+            (uint32_t)large_ps / 1000, (uint32_t)large_ps % 1000);
+    kprintf("  páginas de 4 KB: %4u.%03u ns/leitura\n",
+            (uint32_t)small_ps / 1000, (uint32_t)small_ps % 1000);
+    if (small_ps > large_ps) {
+        uint32_t miss = (uint32_t)(small_ps - large_ps);
+        kprintf("  custo da falta de TLB: ~%u.%03u ns\n", miss / 1000, miss % 1000);
+    }
+}
+
+// Função para mostrar o mapa de páginas
+void paging_report() {
+    if (!paging_enabled) {
+        kprintf(KC_WHITE "Paginação desligada (CPU sem PSE)\n");
+        return;
+    }
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    
+    kprintf(KC_WHITE "Identidade: 0x00000000-0x%08x (%u páginas de 4 MB + 4 KB no início)\n",
+            identity_top - 1, (identity_top >> LARGE_PAGE_SHIFT) - 1);
+    kprintf("Alias:      0x%08x -> 0x00000000 (4 MB)\n", KERNEL_VIRTUAL_BASE);
+    kprintf("Guardas:    0x00000000 (nulo), 0x%08x (pilha)\n", (uint32_t)kernel_stack_guard);
+    kprintf("VGA:        %s\n", pat_wc ? "write-combining (PAT)" : "uncached");
+    kprintf("Globais:    %s\n", (cr4 & CR4_PGE) ? "sim" : "não");
+    kprintf("ioremap:    %u KB usados, %u tabelas de 4 KB\n",
+            (ioremap_next - IOREMAP_BASE) >> 10, page_tables);
+    
+    // Escreve pelo alias e lê pela identidade
+    static volatile uint32_t probe = 0;
+    volatile uint32_t* alias = (volatile uint32_t*)((uint32_t)&probe + KERNEL_VIRTUAL_BASE);
+    *alias = (uint32_t)ktime_ns();
+    kprintf("Alias ok:   %s\n", probe == *alias ? "sim" : "não");
+}
+
+// Trampolim das APs: a SIPI começa em modo real em CS = página << 8, IP = 0.
+// Carrega a GDT da BSP, entra em modo protegido, liga a paginação com o
+// mesmo diretório e chama ap_main(cpu) na pilha que a BSP deixou nos dados
+// do fim. Roda da cópia em SMP_TRAMPOLINE, então só usa endereços relativos
+// ao início (EBX guarda a base linear).
+extern char smp_trampoline[];
+extern char smp_trampoline_gdtr[];
+extern char smp_trampoline_jump[];
+extern char smp_trampoline32[];
+extern char smp_trampoline_data[];
+extern char smp_trampoline_end[];
+
+__asm__(
+    ".pushsection .text\n"
+    ".code16\n"
+    "smp_trampoline:\n"
+    ".set SMP_DATA, smp_trampoline_data - smp_trampoline\n"
+    "    cli\n"
+    "    movw %cs, %ax\n"
+    "    movw %ax, %ds\n"
+    "    xorl %ebx, %ebx\n"
+    "    movw %ax, %bx\n"
+    "    shll $4, %ebx\n"                    // Base linear do trampolim
+    "    lgdtl smp_trampoline_gdtr - smp_trampoline\n"
+    "    movl %cr0, %eax\n"
+    "    orl $1, %eax\n"                     // PE
+    "    movl %eax, %cr0\n"
+    "    ljmpl *(smp_trampoline_jump - smp_trampoline)\n"
+    ".code32\n"
+    "smp_trampoline32:\n"
+    "    movw $0x10, %ax\n"                 // GDT_KERNEL_DATA
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    movw %ax, %ss\n"
+    "    movl SMP_DATA + 4(%ebx), %eax\n"
+    "    movl %eax, %cr4\n"
+    "    movl SMP_DATA + 0(%ebx), %eax\n"
+    "    movl %eax, %cr3\n"
+    "    movl %cr0, %eax\n"
+    "    orl $0x80010000, %eax\n"            // CR0_PG | CR0_WP
+    "    movl %eax, %cr0\n"
+    "    movl SMP_DATA + 8(%ebx), %esp\n"
+    "    xorl %ebp, %ebp\n"
+    "    pushl SMP_DATA + 12(%ebx)\n"
+    "    call *SMP_DATA + 16(%ebx)\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+    ".align 4\n"
+    "smp_trampoline_gdtr:\n"
+    "    .word 0\n"
+    "    .long 0\n"
+    ".align 4\n"
+    "smp_trampoline_jump:\n"
+    "    .long 0\n"                         // Endereço de smp_trampoline32 na cópia
+    "    .word 0\n"                         // GDT_KERNEL_CODE
+    ".align 4\n"
+    "smp_trampoline_data:\n"
+    "    .skip 20\n"                        // SmpTrampolineData
+    "smp_trampoline_end:\n"
+    ".popsection\n"
+);
+
+// Função para ligar o LAPIC da CPU atual: o vetor espúrio, e o timer em
+// one-shot (divisor 16) parado até a roda ter um prazo
+static void lapic_init_cpu() {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+// Função para medir a frequência do timer do LAPIC contra o TSC e guardar o
+// multiplicador ns -> contagem de lapic_timer_program
+static void lapic_calibrate() {
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t start = ktime_ns();
+    while (ktime_ns() - start < LAPIC_CALIBRATE_NS) {
+        __asm__ volatile("pause");
+    }
+    uint32_t counted = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    
+    // mult = contagens por ns << 32
+    uint64_t mult = ((uint64_t)counted << 32);
+    div64_32(&mult, LAPIC_CALIBRATE_NS);
+    lapic_mult = (uint32_t)mult;
+}
+
+// Entrada das APs: já em modo protegido com paginação, na pilha própria.
+// Monta GDT/TSS e o GS per-CPU, liga o LAPIC e vira a thread ociosa da CPU.
+static void ap_main(uint32_t cpu) {
+    gdt_init(cpu);
+    idt_load();
+    if (pat_wc) {
+        wrmsr(MSR_PAT, smp_pat);
+    }
+    lapic_init_cpu();
+    
+    PerCpu* self = this_cpu();
+    cpu_node[cpu] = apic_node[self->apic_id & 0xFF];
+    sched_init_cpu(cpu, self->stack);
+    
+    // A BSP espera por este aviso antes de acordar a próxima
+    __sync_synchronize();
+    self->online = 1;
+    __sync_fetch_and_add(&cpus_online, 1);
+    
+    __asm__ volatile("sti");
+    cpu_idle();
+}
+
+// Função para acordar a AP 'apic_id' como CPU 'cpu': INIT, espera 10 ms e
+// até duas SIPIs apontando para o trampolim. Devolve 1 se ela ficou online.
+static int smp_boot_ap(uint32_t cpu, uint32_t apic_id) {
+    uint8_t* stack = kmem_cache_alloc(stack_cache);
+    if (!stack) {
+        return 0;
+    }
+    *(uint32_t*)stack = THREAD_STACK_MAGIC;
+    
+    PerCpu* target = &per_cpu[cpu];
+    target->apic_id = apic_id;
+    target->stack = stack;
+    target->online = 0;
+    
+    SmpTrampolineData* data = (SmpTrampolineData*)(SMP_TRAMPOLINE + (smp_trampoline_data - smp_trampoline));
+    data->stack = (uint32_t)(stack + THREAD_STACK_SIZE);
+    data->cpu = cpu;
+    __sync_synchronize();
+    
+    uint32_t flags = irq_save();
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT);
+    irq_restore(flags);
+    ksleep_ms(10);
+    
+    for (int sipi = 0; sipi < 2 && !target->online; sipi++) {
+        flags = irq_save();
+        lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE >> FRAME_SHIFT));
+        irq_restore(flags);
+        ksleep_us(200);
+    }
+    for (int ms = 0; ms < SMP_BOOT_TIMEOUT_MS && !target->online; ms++) {
+        ksleep_ms(1);
+    }
+    // Sem resposta a pilha fica com ela: a AP ainda pode acordar mais tarde
+    return target->online;
+}
+
+// Função para ligar as outras CPUs: acha as APs no MADT, copia o trampolim
+// para a página baixa e acorda uma de cada vez. Precisa do TSC como relógio
+// (as APs leem o tempo sem falar com o PIT) e do escalonador, que dá as
+// pilhas e as threads ociosas.
+void smp_init() {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    AcpiHeader* madt = acpi_find_table("APIC");
+    if (!madt || !(d & CPUID_EDX_APIC) || !tsc_clocksource || !thread_cache || !paging_enabled) {
+        return;
+    }
+    
+    // Endereço do LAPIC (um override de 64 bits tem prioridade)
+    uint8_t* entry = (uint8_t*)madt + MADT_ENTRIES;
+    uint8_t* end = (uint8_t*)madt + madt->length;
+    uint64_t lapic_phys = *(uint32_t*)((uint8_t*)madt + sizeof(AcpiHeader));
+    for (uint8_t* e = entry; e + 2 <= end && e[1] && e + e[1] <= end; e += e[1]) {
+        if (e[0] == MADT_LAPIC_OVERRIDE && e[1] >= 12) {
+            lapic_phys = *(uint64_t*)(e + 4);
+        }
+    }
+    if (lapic_phys >> 32) {
+        return;
+    }
+    lapic = ioremap((uint32_t)lapic_phys, FRAME_SIZE);
+    if (!lapic) {
+        return;
+    }
+    
+    this_cpu()->apic_id = lapic_read(LAPIC_ID) >> 24;
+    interrupt_install(LAPIC_TIMER_VECTOR, timer_irq);
+    interrupt_install(LAPIC_RESCHED_VECTOR, sched_ipi);
+    lapic_init_cpu();
+    lapic_calibrate();
+    if (pat_wc) {
+        smp_pat = rdmsr(MSR_PAT);
+    }
+    
+    // Cópia do trampolim e os dados comuns a todas as APs
+    uint8_t* trampoline = (uint8_t*)SMP_TRAMPOLINE;
+    for (uint32_t i = 0; i < (uint32_t)(smp_trampoline_end - smp_trampoline); i++) {
+        trampoline[i] = smp_trampoline[i];
+    }
+    DescriptorPointer* gdtr = (DescriptorPointer*)(trampoline + (smp_trampoline_gdtr - smp_trampoline));
+    gdtr->limit = sizeof(gdt[0]) - 1;
+    gdtr->base = (uint32_t)gdt[0];
+    uint8_t* jump = trampoline + (smp_trampoline_jump - smp_trampoline);
+    *(uint32_t*)jump = SMP_TRAMPOLINE + (smp_trampoline32 - smp_trampoline);
+    *(uint16_t*)(jump + 4) = GDT_KERNEL_CODE;
+    SmpTrampolineData* data = (SmpTrampolineData*)(trampoline + (smp_trampoline_data - smp_trampoline));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(data->cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(data->cr4));
+    data->entry = (uint32_t)ap_main;
+    
+    uint32_t cpu = 1;
+    for (uint8_t* e = entry; e + 2 <= end && e[1] && e + e[1] <= end && cpu < NR_CPUS; e += e[1]) {
+        MadtLapic* lapic_entry = (MadtLapic*)e;
+        if (e[0] != MADT_LAPIC || e[1] < sizeof(MadtLapic) ||
+            !(lapic_entry->flags & (MADT_ENABLED | MADT_ONLINE_CAPABLE)) ||
+            lapic_entry->apic_id == this_cpu()->apic_id) {
+            continue;
+        }
+        if (!smp_boot_ap(cpu, lapic_entry->apic_id)) {
+            break;
+        }
+        cpu++;
+    }
+}
+
+// Handler da IRQ1: guarda o scancode no anel (ou conta a perda se cheio)
+void keyboard_irq(InterruptFrame* frame) {
+    (void)frame;
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    uint32_t head = keyboard_head;
+    
+    if (head - keyboard_tail < KEYBOARD_RING_SIZE) {
+        keyboard_ring[head & (KEYBOARD_RING_SIZE - 1)] = scancode;
+        // O scancode precisa estar no anel antes de head avançar
+        __asm__ volatile("" : : : "memory");
+        keyboard_head = head + 1;
+        // O head novo precisa ser visto antes da leitura do waiter
+        __sync_synchronize();
+        thread_wake(keyboard_waiter);
+    } else {
+        keyboard_dropped++;
+    }
+}
+
+// Função para ligar a IRQ1 do teclado
+void keyboard_init() {
+    // Descarta um byte que já esteja no controlador: com a saída cheia o
+    // 8042 não gera outra borda e a IRQ1 nunca chegaria
+    while (inb(KEYBOARD_STATUS_PORT) & 0x01) {
+        inb(KEYBOARD_DATA_PORT);
+    }
+    irq_install(KEYBOARD_IRQ, keyboard_irq);
+}
+
+// Função para verificar se há tecla disponível
+int keyboard_available() {
+    return keyboard_head != keyboard_tail;
+}
+
+// Função para ler tecla do teclado: bloqueia até a IRQ1 trazer um scancode
+uint8_t read_keyboard() {
+    while (1) {
+        __asm__ volatile("cli" : : : "memory");
+        // A IRQ1 pode vir em outra CPU: o waiter é publicado antes de olhar
+        // o anel, e ela o lê depois de avançar o head
+        keyboard_waiter = this_rq()->current;
+        __sync_synchronize();
+        if (keyboard_available()) {
+            break;
+        }
+        thread_wait();
+    }
+    keyboard_waiter = 0;
+    __asm__ volatile("sti" : : : "memory");
+    
+    uint8_t scancode = keyboard_ring[keyboard_tail & (KEYBOARD_RING_SIZE - 1)];
+    keyboard_tail++;
+    return scancode;
+}
+
+// Função para esperar uma tecla por até 'ms' milissegundos: acorda com a
+// IRQ1 ou com o timer. Retorna 1 se há tecla no anel.
+int keyboard_wait_ms(uint32_t ms) {
+    Timer t;
+    t.data = current_thread();
+    timer_add(&t, ktime_ns() + (uint64_t)ms * 1000000, timer_wake);
+    while (1) {
+        __asm__ volatile("cli" : : : "memory");
+        keyboard_waiter = this_rq()->current;
+        __sync_synchronize();
+        if (keyboard_available() || !t.pending) {
+            break;
+        }
+        thread_wait();
+    }
+    keyboard_waiter = 0;
+    __asm__ volatile("sti" : : : "memory");
+    timer_cancel(&t);
+    return keyboard_available();
+}
+
+// Função para comparar strings
+int strcmp(const char* s1, const char* s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+}
+
+// Função para comparar no máximo 'n' caracteres
+int strncmp(const char* s1, const char* s2, size_t n) {
+    while (n && *s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+}
+
+// Função para ler um número decimal sem sinal (para no primeiro não-dígito)
+uint32_t parse_uint(const char* str) {
+    uint32_t value = 0;
+    while (*str >= '0' && *str <= '9') {
+        value = value * 10 + (*str - '0');
+        str++;
+    }
+    return value;
+}
+
+// Função para obter tamanho da string
+size_t strlen(const char* str) {
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+// Função para copiar string
+void strcpy(char* dest, const char* src) {
+    while (*src) {
+        *dest = *src;
+        dest++;
+        src++;
+    }
+    *dest = '\0';
+}
+
+// Função para mostrar o clocksource e quanto durou cada fase do boot
+void boot_report() {
+    if (tsc_clocksource) {
+        kprintf(KC_WHITE "Clocksource: tsc, %u kHz (invariante)\n", tsc_khz);
+    } else if (tsc_khz) {
+        kprintf(KC_WHITE "Clocksource: pit (TSC de %u kHz não é invariante)\n", tsc_khz);
+    } else {
+        kprintf(KC_WHITE "Clocksource: pit (sem TSC)\n");
+        return;
+    }
+    
+    for (int i = 1; i < boot_phase_count; i++) {
+        uint64_t us = tsc_to_ns(boot_phases[i].tsc - boot_phases[i - 1].tsc);
+        div64_32(&us, 1000);
+        kprintf(KC_LIGHT_GREY "  %-10s %8u us\n", boot_phases[i].name, (uint32_t)us);
+    }
+    if (boot_phase_count > 1) {
+        uint64_t us = tsc_to_ns(boot_phases[boot_phase_count - 1].tsc - boot_phases[0].tsc);
+        div64_32(&us, 1000);
+        kprintf(KC_LIGHT_CYAN "  %-10s %8u us\n", "total", (uint32_t)us);
+    }
+}
+
+// Fragmentação da ordem 'order': % da memória livre em blocos menores que
+// ela, que não servem para um pedido desse tamanho
+static uint32_t buddy_unusable_percent(uint32_t order) {
+    uint32_t free = buddy_free_pages();
+    uint32_t usable = 0;
+    
+    if (!free) {
+        return 0;
+    }
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            for (uint32_t o = order; o <= BUDDY_MAX_ORDER; o++) {
+                usable += numa_nodes[node].zones[z].free_count[o] << o;
+            }
+        }
+    }
+    return (free - usable) * 100 / free;
+}
+
+// Função para mostrar o estado de cada zona do buddy
+void buddy_report() {
+    if (!buddy_ready) {
+        kprintf(KC_WHITE "Buddy desligado (sem mapa de memória do GRUB)\n");
+        return;
+    }
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            Zone* zone = &numa_nodes[node].zones[z];
+            if (!zone->managed_pages) {
+                continue;
+            }
+            kprintf(KC_WHITE "Nó %u %-6s %7u páginas, %7u livres\n" KC_LIGHT_GREY "  livres por ordem:",
+                    node, zone->name, zone->managed_pages, zone->free_pages);
+            for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+                kprintf(" %u", zone->free_count[order]);
+            }
+            kprintf("\n  allocs %u  frees %u  splits %u  merges %u  falhas %u\n",
+                    zone->allocs, zone->frees, zone->splits, zone->merges, zone->failures);
+        }
+    }
+    kprintf(KC_LIGHT_CYAN "Fragmentação: ordem 4 %u%%, ordem 10 %u%%\n",
+            buddy_unusable_percent(4), buddy_unusable_percent(BUDDY_MAX_ORDER));
+}
+
+// Benchmark do buddy: aloca blocos de ordens 0-3 sorteadas, libera um sim e
+// um não (o pior caso para juntar buddies) e depois o resto, medindo o
+// custo médio de cada fase e a fragmentação no meio
+void buddy_bench() {
+    static uint32_t blocks[BUDDY_BENCH_BLOCKS];
+    static uint8_t orders[BUDDY_BENCH_BLOCKS];
+    uint32_t seed = 0x2545F491;
+    uint32_t before = buddy_unusable_percent(BUDDY_MAX_ORDER);
+    
+    if (!buddy_ready) {
+        kprintf(KC_WHITE "Buddy desligado (sem mapa de memória do GRUB)\n");
+        return;
+    }
+    
+    uint64_t start = ktime_ns();
+    for (int i = 0; i < BUDDY_BENCH_BLOCKS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        orders[i] = seed & 3;
+        blocks[i] = buddy_alloc(orders[i], 0);
+    }
+    uint64_t alloc_ns = ktime_ns() - start;
+    
+    start = ktime_ns();
+    for (int i = 1; i < BUDDY_BENCH_BLOCKS; i += 2) {
+        if (blocks[i]) {
+            buddy_free(blocks[i], orders[i]);
+        }
+    }
+    uint64_t free_odd_ns = ktime_ns() - start;
+    uint32_t fragmented = buddy_unusable_percent(4);
+    
+    start = ktime_ns();
+    for (int i = 0; i < BUDDY_BENCH_BLOCKS; i += 2) {
+        if (blocks[i]) {
+            buddy_free(blocks[i], orders[i]);
+        }
+    }
+    uint64_t free_even_ns = ktime_ns() - start;
+    
+    div64_32(&alloc_ns, BUDDY_BENCH_BLOCKS);
+    div64_32(&free_odd_ns, BUDDY_BENCH_BLOCKS / 2);
+    div64_32(&free_even_ns, BUDDY_BENCH_BLOCKS / 2);
+    kprintf(KC_WHITE "%d blocos de ordem 0-3:\n"
+            "  alloc:               %5u ns/op\n"
+            "  free (sem juntar):   %5u ns/op\n"
+            "  free (juntando):     %5u ns/op\n"
+            "  fragmentação ordem 4 com metade livre: %u%%\n"
+            "  fragmentação ordem 10 antes/depois: %u%% / %u%%\n",
+            BUDDY_BENCH_BLOCKS, (uint32_t)alloc_ns, (uint32_t)free_odd_ns,
+            (uint32_t)free_even_ns, fragmented, before, buddy_unusable_percent(BUDDY_MAX_ORDER));
+}
+
+// Função para medir a banda de escrita e leitura de 'bytes' a partir de
+// 'base' em MB/s, NUMA_BENCH_ROUNDS voltas de cada
+static void numa_bandwidth(uint32_t base, uint32_t bytes, uint32_t* write_mbps, uint32_t* read_mbps) {
+    volatile uint32_t* words = (volatile uint32_t*)base;
+    uint32_t count = bytes / sizeof(uint32_t);
+    uint32_t sum = 0;
+    
+    uint64_t start = ktime_ns();
+    for (int round = 0; round < NUMA_BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < count; i++) {
+            words[i] = i;
+        }
+    }
+    uint64_t write_us = ktime_ns() - start;
+    
+    start = ktime_ns();
+    for (int round = 0; round < NUMA_BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < count; i++) {
+            sum += words[i];
+        }
+    }
+    uint64_t read_us = ktime_ns() - start;
+    __asm__ volatile("" : : "r"(sum));
+    
+    div64_32(&write_us, 1000);
+    div64_32(&read_us, 1000);
+    uint64_t write_mb = (uint64_t)(bytes >> 20) * NUMA_BENCH_ROUNDS * 1000000;
+    uint64_t read_mb = write_mb;
+    if (write_us) {
+        div64_32(&write_mb, (uint32_t)write_us);
+    }
+    if (read_us) {
+        div64_32(&read_mb, (uint32_t)read_us);
+    }
+    *write_mbps = write_us ? (uint32_t)write_mb : 0;
+    *read_mbps = read_us ? (uint32_t)read_mb : 0;
+}
+
+// Benchmark NUMA: a CPU atual escreve e lê NUMA_BENCH_BLOCKS blocos de 4 MB
+// de cada nó (alocados só nele), mostrando a banda local e a remota
+void numa_bench() {
+    static uint32_t blocks[NUMA_BENCH_BLOCKS];
+    uint32_t local = numa_node_id();
+    
+    if (!buddy_ready) {
+        kprintf(KC_WHITE "Buddy desligado (sem mapa de memória do GRUB)\n");
+        return;
+    }
+    kprintf(KC_WHITE "CPU %d no nó %u, %u MB por nó, %d voltas:\n",
+            cpu_id(), local, (NUMA_BENCH_BLOCKS << (BUDDY_MAX_ORDER + FRAME_SHIFT)) >> 20,
+            NUMA_BENCH_ROUNDS);
+    
+    for (uint32_t node = 0; node < numa_node_count; node++) {
+        uint32_t write_total = 0, read_total = 0;
+        int got = 0;
+        
+        for (int i = 0; i < NUMA_BENCH_BLOCKS; i++) {
+            blocks[i] = buddy_alloc_node(BUDDY_MAX_ORDER, GFP_THISNODE, node);
+            if (!blocks[i]) {
+                continue;
+            }
+            uint32_t write_mbps, read_mbps;
+            numa_bandwidth(blocks[i], 1u << (BUDDY_MAX_ORDER + FRAME_SHIFT), &write_mbps, &read_mbps);
+            write_total += write_mbps;
+            read_total += read_mbps;
+            got++;
+        }
+        for (int i = 0; i < NUMA_BENCH_BLOCKS; i++) {
+            if (blocks[i]) {
+                buddy_free(blocks[i], BUDDY_MAX_ORDER);
+            }
+        }
+        
+        if (!got) {
+            kprintf(KC_LIGHT_GREY "  nó %u: sem blocos de 4 MB livres\n", node);
+            continue;
+        }
+        kprintf(KC_LIGHT_GREY "  nó %u (%s, distância %2u): escrita %5u MB/s, leitura %5u MB/s\n",
+                node, node == local ? "local " : "remoto", numa_distance[local][node],
+                write_total / got, read_total / got);
+    }
+}
+
+// Função para listar as threads (como um ps)
+void thread_report() {
+    static const char* states[] = { "rodando", "pronta", "bloqueada", "terminada" };
+    RunQueue* rq = this_rq();
+    
+    if (!rq->current) {
+        kprintf(KC_WHITE "Escalonador desligado (sem buddy)\n");
+        return;
+    }
+    
+    // Com a trava as outras CPUs não tiram da lista as threads que terminam
+    preempt_disable();
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    kprintf(KC_WHITE "  ID NOME          CPU PRIO ESTADO      TROCAS    CPU ms\n");
+    for (ListNode* n = all_threads.next; n != &all_threads; n = n->next) {
+        Thread* t = (Thread*)((uint8_t*)n - offsetof(Thread, all));
+        uint64_t ms = t->runtime_ns;
+        div64_32(&ms, 1000000);
+        kprintf(KC_LIGHT_GREY "  %2u %-13s %3u %4d %-10s %7u %9u\n",
+                t->id, t->name, t->cpu, t->priority, states[t->state], t->switches, (uint32_t)ms);
+    }
+    uint32_t switches = 0, preemptions = 0, steals = 0;
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        switches += run_queues[cpu].switches;
+        preemptions += run_queues[cpu].preemptions;
+        steals += run_queues[cpu].steals;
+    }
+    kprintf(KC_LIGHT_GREY "%u threads em %u CPUs, %u trocas de contexto (%u na saída de IRQs), %u roubadas\n",
+            thread_count, cpus_online, switches, preemptions, steals);
+    spin_unlock_irqrestore(&threads_lock, flags);
+    preempt_enable();
+}
+
+// Trechos do parbench: zerar páginas e somar as palavras delas
+static void parallel_bench_zero(uint32_t begin, uint32_t end, void* arg) {
+    uint32_t base = (uint32_t)arg;
+    for (uint32_t page = begin; page < end; page++) {
+        zero_frame(base + (page << FRAME_SHIFT));
+    }
+}
+
+static void parallel_bench_sum(uint32_t begin, uint32_t end, void* arg) {
+    ParallelSum* sum = arg;
+    uint32_t* words = (uint32_t*)(sum->base + (begin << FRAME_SHIFT));
+    uint32_t count = (end - begin) * (FRAME_SIZE / sizeof(uint32_t));
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += words[i];
+    }
+    __sync_fetch_and_add(&sum->total, total);
+}
+
+// Função para medir PARALLEL_BENCH_ROUNDS voltas de um parallel_for sobre
+// as páginas do buffer, em us
+static uint32_t parallel_bench_pass(uint32_t pages, ParallelFunc func, void* arg) {
+    uint64_t start = ktime_ns();
+    for (int round = 0; round < PARALLEL_BENCH_ROUNDS; round++) {
+        parallel_for(pages, PARALLEL_BENCH_GRAIN, func, arg);
+    }
+    uint64_t elapsed = ktime_ns() - start;
+    div64_32(&elapsed, 1000);
+    return elapsed ? (uint32_t)elapsed : 1;
+}
+
+// Benchmark do parallel_for: zera e soma um bloco de 4 MB com 1, 2, 4 e 8
+// CPUs (até as que estão online) e mostra a vazão, o ganho sobre uma CPU e
+// os roubos entre os deques. O shell, que também trabalha, fica preso à
+// sua CPU, e ela é a primeira das liberadas em cada medida.
+void parallel_bench() {
+    if (!work_cache) {
+        kprintf(KC_WHITE "Escalonador desligado (sem buddy)\n");
+        return;
+    }
+    uint32_t base = buddy_alloc(PARALLEL_BENCH_ORDER, 0);
+    if (!base) {
+        kprintf(KC_WHITE "Sem memória para o buffer do benchmark\n");
+        return;
+    }
+    uint32_t flags = irq_save();
+    Thread* self = this_rq()->current;
+    self->pinned = 1;
+    uint32_t home = self->cpu;
+    irq_restore(flags);
+    uint32_t pages = 1u << PARALLEL_BENCH_ORDER;
+    uint32_t words = pages * (FRAME_SIZE / sizeof(uint32_t));
+    uint32_t expected = (uint32_t)(((uint64_t)words * (words - 1)) >> 1);
+    uint32_t total_mb = (pages >> 8) * PARALLEL_BENCH_ROUNDS;
+    uint32_t zero_base = 0, sum_base = 0;
+    
+    kprintf(KC_WHITE "parallel_for em %u MB, %d voltas, trechos de %u KB (%u CPUs online):\n",
+            pages >> 8, PARALLEL_BENCH_ROUNDS, PARALLEL_BENCH_GRAIN * (FRAME_SIZE >> 10), cpus_online);
+    kprintf("  CPUs   zerar MB/s  ganho    somar MB/s  ganho   roubos\n");
+    for (uint32_t cpus = 1; cpus <= NR_CPUS && cpus <= cpus_online; cpus <<= 1) {
+        work_limit(home, cpus);
+        uint32_t steals = 0;
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            steals -= work_deques[cpu].steals;
+        }
+        
+        // O padrão da soma é escrito fora da medida
+        uint32_t* data = (uint32_t*)base;
+        for (uint32_t i = 0; i < words; i++) {
+            data[i] = i;
+        }
+        ParallelSum sum = { base, 0 };
+        uint32_t sum_us = parallel_bench_pass(pages, parallel_bench_sum, &sum);
+        uint32_t zero_us = parallel_bench_pass(pages, parallel_bench_zero, (void*)base);
+        
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            steals += work_deques[cpu].steals;
+        }
+        if (cpus == 1) {
+            zero_base = zero_us;
+            sum_base = sum_us;
+        }
+        uint64_t zero_rate = (uint64_t)total_mb * 1000000;
+        uint64_t sum_rate = (uint64_t)total_mb * 1000000;
+        div64_32(&zero_rate, zero_us);
+        div64_32(&sum_rate, sum_us);
+        uint32_t zero_gain = zero_base * 100 / zero_us;
+        uint32_t sum_gain = sum_base * 100 / sum_us;
+        kprintf(KC_LIGHT_GREY "  %4u %12u %3u.%02ux %12u %3u.%02ux %8u%s\n",
+                cpus, (uint32_t)zero_rate, zero_gain / 100, zero_gain % 100,
+                (uint32_t)sum_rate, sum_gain / 100, sum_gain % 100, steals,
+                sum.total == expected * PARALLEL_BENCH_ROUNDS ? "" : KC_LIGHT_RED "  soma errada!");
     }
-    
-    const size_t index = vga_y * VGA_WIDTH + vga_x;
-    vga_buffer[index] = (uint16_t)c | (uint16_t)vga_color << 8;
-    vga_x++;
-    cursor_x = vga_x;
-    cursor_y = vga_y;
+    work_cpu_mask = (1u << cpus_online) - 1;
+    self->pinned = 0;
+    buddy_free(base, PARALLEL_BENCH_ORDER);
 }
 
-// Função para exibir string
-void vga_puts(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+// Thread do schedbench: só devolve a CPU até mandarem parar
+static volatile int sched_bench_stop = 0;
+
+static void sched_bench_thread(void* arg) {
+    (void)arg;
+    while (!sched_bench_stop) {
+        thread_yield();
     }
 }
 
-// Função para exibir número
-void vga_putint(uint32_t num) {
-    if (num == 0) {
-        vga_putchar('0');
-        return;
-    }
-    
-    char buffer[32];
-    int i = 0;
-    
-    while (num > 0) {
-        buffer[i++] = '0' + (num % 10);
-        num /= 10;
+// Benchmark do escalonador: o shell e uma thread da mesma prioridade passam
+// a CPU um para o outro com thread_yield, duas trocas de contexto por volta.
+// Os dois ficam presos à CPU do shell enquanto isso (senão uma CPU ociosa
+// roubaria um deles e não haveria troca).
+void sched_bench() {
+    uint32_t flags = irq_save();
+    RunQueue* rq = this_rq();
+    Thread* self = rq->current;
+    if (self && self != rq->idle) {
+        self->pinned = 1;
     }
+    irq_restore(flags);
     
-    while (--i >= 0) {
-        vga_putchar(buffer[i]);
+    if (!self || self == rq->idle) {
+        kprintf(KC_WHITE "Escalonador desligado (sem buddy)\n");
+        return;
     }
-}
-
-// Função para obter informações básicas do sistema
-void get_system_info(SystemInfo* info) {
-    // Informações hardcoded para simplicidade
-    const char* hostname = "Kernel-V";
-    const char* kernel_ver = "1.0.0";
-    const char* cpu = "x86_64";
-    
-    size_t i;
-    for (i = 0; hostname[i] != '\0' && i < 31; i++) {
-        info->hostname[i] = hostname[i];
+    sched_bench_stop = 0;
+    if (!thread_create_on(self->cpu, "schedbench", sched_bench_thread, 0, self->priority)) {
+        self->pinned = 0;
+        kprintf(KC_WHITE "Sem memória para a thread do benchmark\n");
+        return;
     }
-    info->hostname[i] = '\0';
+    thread_yield();                         // A thread nova começa e devolve a CPU
     
-    for (i = 0; kernel_ver[i] != '\0' && i < 31; i++) {
-        info->kernel_version[i] = kernel_ver[i];
+    uint32_t before = rq->switches;
+    uint64_t start = ktime_ns();
+    for (int i = 0; i < SCHED_BENCH_ROUNDS; i++) {
+        thread_yield();
     }
-    info->kernel_version[i] = '\0';
+    uint64_t elapsed = ktime_ns() - start;
+    uint32_t switches = rq->switches - before;
     
-    for (i = 0; cpu[i] != '\0' && i < 63; i++) {
-        info->cpu_info[i] = cpu[i];
-    }
-    info->cpu_info[i] = '\0';
+    sched_bench_stop = 1;
+    thread_yield();                         // Ela vê o aviso e termina
+    self->pinned = 0;
     
-    info->memory_mb = 512; // Simulado
-    info->uptime_seconds = 0;
+    div64_32(&elapsed, switches ? switches : 1);
+    kprintf(KC_WHITE "Troca de contexto (yield entre 2 threads, %u trocas): "
+            KC_LIGHT_GREEN "%u ns\n", switches, (uint32_t)elapsed);
 }
 
-// Função para exibir informações do sistema no estilo neofetch
-void display_system_info(SystemInfo* info) {
-    vga_set_color(VGA_LIGHT_CYAN | (VGA_BLACK << 4));
-    vga_puts("                    ");
-    vga_puts(info->hostname);
-    vga_puts("@kernel-v\n");
-    
-    vga_set_color(VGA_LIGHT_GREY | (VGA_BLACK << 4));
-    vga_puts("                   ---------------\n");
-    
-    vga_set_color(VGA_LIGHT_GREEN | (VGA_BLACK << 4));
-    vga_puts("OS:                 Kernel-V ");
-    vga_puts(info->cpu_info);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_BLUE | (VGA_BLACK << 4));
-    vga_puts("Kernel:             ");
-    vga_puts(info->kernel_version);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_MAGENTA | (VGA_BLACK << 4));
-    vga_puts("Uptime:             ");
-    vga_putint(info->uptime_seconds);
-    vga_puts("s\n");
-    
-    vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-    vga_puts("Memory:             ");
-    vga_putint(info->memory_mb);
-    vga_puts("MB\n");
-    
-    vga_set_color(VGA_LIGHT_BROWN | (VGA_BLACK << 4));
-    vga_puts("Shell:              kernel-shell\n");
+// Função para mostrar o estoque de frames zerados: acertos dos pedidos e
+// quanto o idle leva para zerar cada frame
+void zero_pool_report() {
+    uint32_t requests = zero_hits + zero_misses;
+    uint64_t average = zero_refill_ns;
+    if (zero_refills) {
+        div64_32(&average, zero_refills);
+    }
     
-    vga_putchar('\n');
+    kprintf(KC_WHITE "Frames zerados no idle (%s):\n", zero_nt ? "movnti" : "rep stosl");
+    kprintf(KC_LIGHT_GREY "  estoque:   %u/%u frames\n"
+            "  pedidos:   %u do estoque, %u zerados na hora (%u%% de acerto)\n"
+            "  idle:      %u frames zerados, %u ns por frame\n",
+            zero_pool_count, ZERO_POOL_SIZE, zero_hits, zero_misses,
+            requests ? zero_hits * 100 / requests : 0,
+            zero_refills, (uint32_t)average);
 }
 
-// Função para ler byte de uma porta
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
+// Função para mostrar as caches de objetos (como o /proc/slabinfo)
+void slab_report() {
+    if (!kmalloc_caches[0]) {
+        kprintf(KC_WHITE "Sem heap (o buddy não subiu)\n");
+        return;
+    }
+    kprintf(KC_WHITE "cache          obj  ativos   total slabs ord cores depot     hits\n");
+    for (uint32_t i = 0; i < kmem_cache_count; i++) {
+        KmemCache* cache = &kmem_caches[i];
+        uint32_t hits = 0;
+        for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+            hits += cache->cpu[cpu].alloc_hits;
+        }
+        kprintf(KC_LIGHT_GREY "%-12s %5u %7u %7u %5u %3u %5u %2u/%-2u %8u\n",
+                cache->name, cache->size, cache->active, cache->slabs * cache->per_slab,
+                cache->slabs, cache->order, cache->color_max / CACHE_LINE + 1,
+                cache->depot_full_count, cache->depot_empty_count, hits);
+    }
 }
 
-// Função para escrever byte em uma porta
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
-}
+// Trechos do slabbench em paralelo: cada índice é um worker, com a sua linha
+// de objetos, fazendo o mesmo que a medida de uma CPU
+static void* slab_bench_objects[NR_CPUS][SLAB_BENCH_BATCH];
 
-// Função para verificar se há tecla disponível (versão melhorada)
-int keyboard_available() {
-    // Verifica se há dados disponíveis na porta 0x64
-    unsigned char status = inb(KEYBOARD_STATUS_PORT);
-    
-    // Bit 0 = Output buffer full (dados disponíveis)
-    // Bit 1 = Input buffer full (buffer de entrada cheio)
-    // Bit 2 = System flag
-    // Bit 3 = Command/data flag
-    // Bit 4 = Keyboard enabled
-    // Bit 5 = Transmit timeout
-    // Bit 6 = Receive timeout
-    // Bit 7 = Parity error
-    
-    // Retorna true se há dados para ler (bit 0 = 1)
-    return (status & 0x01) != 0;
+static void slab_bench_pairs(uint32_t begin, uint32_t end, void* arg) {
+    (void)arg;
+    for (uint32_t worker = begin; worker < end; worker++) {
+        for (int i = 0; i < SLAB_BENCH_ROUNDS; i++) {
+            kfree(kmalloc(64));
+        }
+    }
 }
 
-// Função para ler tecla do teclado (versão melhorada)
-char read_keyboard() {
-    // Aguarda até que uma tecla esteja disponível
-    while (!keyboard_available()) {
-        // Pausa muito pequena para não travar
-        for (volatile int i = 0; i < 100; i++) {}
+static void slab_bench_batches(uint32_t begin, uint32_t end, void* arg) {
+    (void)arg;
+    for (uint32_t worker = begin; worker < end; worker++) {
+        void** objects = slab_bench_objects[worker];
+        for (int round = 0; round < SLAB_BENCH_BATCH_ROUNDS; round++) {
+            for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+                objects[i] = kmalloc(64);
+            }
+            for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+                kfree(objects[i]);
+            }
+        }
     }
-    
-    // Lê o scancode da tecla
-    char scancode = inb(KEYBOARD_DATA_PORT);
-    
-    // Pausa mínima para estabilização
-    for (volatile int i = 0; i < 500; i++) {}
-    
-    return scancode;
 }
 
-// Função para comparar strings
-int strcmp(const char* s1, const char* s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
+static void slab_bench_locked(uint32_t begin, uint32_t end, void* arg) {
+    KmemCache* cache = arg;
+    for (uint32_t worker = begin; worker < end; worker++) {
+        void** objects = slab_bench_objects[worker];
+        for (int round = 0; round < SLAB_BENCH_BATCH_ROUNDS; round++) {
+            for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+                objects[i] = kmem_cache_alloc_slow(cache);
+            }
+            for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+                kmem_cache_free_slow(cache, objects[i]);
+            }
+        }
     }
-    return *(const unsigned char*)s1 - *(const unsigned char*)s2;
 }
 
-// Função para obter tamanho da string
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] != '\0') {
-        len++;
+// Função para rodar um worker do slabbench em cada uma das 'cpus' CPUs e
+// devolver o tempo de parede dividido pelos pares alloc/free de um worker:
+// o custo de um par em cada CPU, que fica igual se a cache escala
+static uint32_t slab_bench_pass(uint32_t cpus, ParallelFunc func, void* arg, uint32_t pairs) {
+    uint64_t start = ktime_ns();
+    parallel_for(cpus, 1, func, arg);
+    uint64_t elapsed = ktime_ns() - start;
+    div64_32(&elapsed, pairs);
+    return (uint32_t)elapsed;
+}
+
+// Função para medir o kmalloc(64) com 1, 2, 4 e 8 CPUs (até as online)
+// alocando ao mesmo tempo: pares no magazine, lotes pelo depot e a camada
+// de slabs com a trava disputada. O shell fica preso à sua CPU, a primeira
+// das liberadas em cada medida.
+static void slab_bench_parallel(KmemCache* cache) {
+    if (!work_cache) {
+        return;
     }
-    return len;
+    uint32_t flags = irq_save();
+    Thread* self = this_rq()->current;
+    self->pinned = 1;
+    uint32_t home = self->cpu;
+    irq_restore(flags);
+    uint32_t batch_pairs = SLAB_BENCH_BATCH * SLAB_BENCH_BATCH_ROUNDS;
+    
+    kprintf(KC_WHITE "kmalloc(64) em paralelo, ns por alloc+free em cada CPU (%u CPUs online):\n",
+            cpus_online);
+    kprintf("  CPUs   magazine   lote (depot)   slabs com trava\n");
+    for (uint32_t cpus = 1; cpus <= NR_CPUS && cpus <= cpus_online; cpus <<= 1) {
+        work_limit(home, cpus);
+        uint32_t pair_ns = slab_bench_pass(cpus, slab_bench_pairs, 0, SLAB_BENCH_ROUNDS);
+        uint32_t batch_ns = slab_bench_pass(cpus, slab_bench_batches, 0, batch_pairs);
+        cache->flags |= CACHE_NO_MAGAZINES;
+        uint32_t locked_ns = slab_bench_pass(cpus, slab_bench_locked, cache, batch_pairs);
+        cache->flags &= ~CACHE_NO_MAGAZINES;
+        kprintf(KC_LIGHT_GREY "  %4u %10u %14u %17u\n", cpus, pair_ns, batch_ns, locked_ns);
+    }
+    work_cpu_mask = (1u << cpus_online) - 1;
+    self->pinned = 0;
 }
 
-// Função para copiar string
-void strcpy(char* dest, const char* src) {
-    while (*src) {
-        *dest = *src;
-        dest++;
-        src++;
+// Microbenchmark do kmalloc com objetos de 64 bytes: pares alloc/free (sempre
+// no magazine), lotes maiores que um magazine (passam pelo depot) e a camada
+// de slabs com a trava, que é o que toda alocação pagaria sem magazines
+void slab_bench() {
+    static void* objects[SLAB_BENCH_BATCH];
+    KmemCache* cache = kmalloc_caches[2];
+    
+    if (!cache) {
+        kprintf(KC_WHITE "Sem heap (o buddy não subiu)\n");
+        return;
     }
-    *dest = '\0';
+    
+    uint64_t start = ktime_ns();
+    for (int i = 0; i < SLAB_BENCH_ROUNDS; i++) {
+        kfree(kmalloc(64));
+    }
+    uint64_t pair_ns = ktime_ns() - start;
+    
+    start = ktime_ns();
+    for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+        objects[i] = kmalloc(64);
+    }
+    uint64_t batch_alloc_ns = ktime_ns() - start;
+    start = ktime_ns();
+    for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+        kfree(objects[i]);
+    }
+    uint64_t batch_free_ns = ktime_ns() - start;
+    
+    cache->flags |= CACHE_NO_MAGAZINES;
+    start = ktime_ns();
+    for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+        objects[i] = kmem_cache_alloc_slow(cache);
+    }
+    uint64_t locked_alloc_ns = ktime_ns() - start;
+    start = ktime_ns();
+    for (int i = 0; i < SLAB_BENCH_BATCH; i++) {
+        kmem_cache_free_slow(cache, objects[i]);
+    }
+    uint64_t locked_free_ns = ktime_ns() - start;
+    cache->flags &= ~CACHE_NO_MAGAZINES;
+    
+    div64_32(&pair_ns, SLAB_BENCH_ROUNDS);
+    div64_32(&batch_alloc_ns, SLAB_BENCH_BATCH);
+    div64_32(&batch_free_ns, SLAB_BENCH_BATCH);
+    div64_32(&locked_alloc_ns, SLAB_BENCH_BATCH);
+    div64_32(&locked_free_ns, SLAB_BENCH_BATCH);
+    kprintf(KC_WHITE "kmalloc(64), 1 CPU:\n"
+            "  alloc+free no magazine:   %5u ns/par\n"
+            "  lote de %d (depot):      %5u ns/alloc %5u ns/free\n"
+            "  slabs com trava:          %5u ns/alloc %5u ns/free\n",
+            (uint32_t)pair_ns, SLAB_BENCH_BATCH, (uint32_t)batch_alloc_ns,
+            (uint32_t)batch_free_ns, (uint32_t)locked_alloc_ns, (uint32_t)locked_free_ns);
+    slab_bench_parallel(cache);
 }
 
 // Função para processar comandos
@@ -293,12 +5889,29 @@ void process_command(const char* command) {
         vga_puts("  help     - Mostra esta ajuda\n");
         vga_puts("  clear    - Limpa a tela\n");
         vga_puts("  info     - Mostra informações do sistema\n");
-        vga_puts("  date     - Mostra data/hora (simulado)\n");
+        vga_puts("  date     - Mostra data/hora (RTC, UTC)\n");
+        vga_puts("  rtc      - Conta as IRQs periódicas do RTC em 1 s\n");
         vga_puts("  test     - Testa o teclado\n");
         vga_puts("  debug    - Modo debug do teclado\n");
         vga_puts("  qemu-test- Testa se QEMU captura input\n");
+        vga_puts("  sleep N  - Dorme N segundos\n");
+        vga_puts("  bench    - Mede o custo de escrita na tela\n");
+        vga_puts("  boottime - Mostra o clocksource e o tempo de cada fase do boot\n");
+        vga_puts("  buddyinfo- Mostra as zonas e free lists do buddy\n");
+        vga_puts("  buddybench- Mede alloc/free e fragmentação do buddy\n");
+        vga_puts("  slabinfo - Mostra as caches do kmalloc\n");
+        vga_puts("  slabbench- Mede o kmalloc (ns por alocação, 1 a 8 CPUs)\n");
+        vga_puts("  paging   - Mostra o mapa de páginas\n");
+        vga_puts("  tlbbench - Mede o custo das faltas de TLB (4 MB x 4 KB)\n");
+        vga_puts("  numabench- Mede a banda da memória local e remota\n");
+        vga_puts("  zeropool - Mostra o estoque de frames zerados no idle\n");
+        vga_puts("  threads  - Lista as threads do kernel\n");
+        vga_puts("  schedbench- Mede a troca de contexto entre threads\n");
+        vga_puts("  parbench - Mede o parallel_for com 1, 2, 4 e 8 CPUs\n");
         vga_puts("  exit     - Reinicia o sistema\n");
         vga_puts("  reboot   - Reinicia o sistema\n");
+        vga_puts("  PgUp/PgDn- Rola o histórico da tela\n");
+        vga_puts("  Alt+F1-F4- Troca de console virtual\n");
     }
     else if (strcmp(command, "clear") == 0) {
         vga_clear();
@@ -314,7 +5927,20 @@ void process_command(const char* command) {
         vga_puts("kernel-v> ");
     }
     else if (strcmp(command, "date") == 0) {
-        vga_puts("Data: 13/08/2025 - Hora: 04:00:00 (simulado)\n");
+        DateTime dt;
+        epoch_to_datetime(rtc_epoch(), &dt);
+        kprintf("Data: %02u/%02u/%u - Hora: %02u:%02u:%02u (UTC)\n",
+                dt.day, dt.month, dt.year, dt.hour, dt.minute, dt.second);
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "rtc") == 0) {
+        // Compara as IRQs do RTC com um segundo medido pelo ktime_ns
+        uint32_t start = rtc_ticks;
+        rtc_periodic(1);
+        ksleep_ms(1000);
+        rtc_periodic(0);
+        kprintf("RTC: %u IRQs periódicas em 1 s (esperado %u)\n", rtc_ticks - start, RTC_PERIODIC_HZ);
         vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
         vga_puts("kernel-v> ");
     }
@@ -328,25 +5954,32 @@ void process_command(const char* command) {
     else if (strcmp(command, "debug") == 0) {
         vga_puts("Modo debug ativado!\n");
         vga_puts("Aguardando teclas... (pressione ESC para sair)\n");
+        kprintf("Sem teclas por %d segundos o modo debug sai sozinho.\n", DEBUG_IDLE_SECONDS);
         vga_puts("Se não aparecer nada, o QEMU não está capturando o teclado!\n");
         
+        vga_flush();
+        
         // Loop de debug
         while (1) {
-            if (keyboard_available()) {
-                char debug_key = inb(KEYBOARD_DATA_PORT);
-                vga_puts("[");
-                vga_putint(debug_key);
-                vga_puts("]");
-                
-                // ESC para sair
-                if (debug_key == 0x01) {
-                    vga_puts("\nSaindo do modo debug...\n");
-                    break;
-                }
+            if (!keyboard_wait_ms(DEBUG_IDLE_SECONDS * 1000)) {
+                vga_puts("\nTempo esgotado, saindo do modo debug...\n");
+                break;
+            }
+            uint8_t debug_key = read_keyboard();
+            
+            // Alt+Fn troca de console; a saída continua neste console
+            if (console_hotkey(key_decode(&keyboard_decoder, debug_key))) {
+                continue;
             }
             
-            // Pausa para não sobrecarregar
-            for (volatile int i = 0; i < 10000; i++) {}
+            kprintf("[%u]", debug_key);
+            vga_flush();
+            
+            // ESC para sair
+            if (debug_key == 0x01) {
+                vga_puts("\nSaindo do modo debug...\n");
+                break;
+            }
         }
         
         vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
@@ -356,26 +5989,20 @@ void process_command(const char* command) {
         vga_puts("Testando se o QEMU está capturando input...\n");
         vga_puts("Pressione qualquer tecla por 10 segundos...\n");
         
-        int timeout = 0;
-        while (timeout < 100) {
-            if (keyboard_available()) {
-                char test_key = inb(KEYBOARD_DATA_PORT);
-                vga_puts("Tecla detectada: [");
-                vga_putint(test_key);
-                vga_puts("] - QEMU funcionando!\n");
-                break;
-            }
+        int seconds;
+        for (seconds = 0; seconds < 10; seconds++) {
+            // Contador de timeout: um ponto por segundo
+            vga_puts(".");
+            vga_flush();
             
-            // Contador de timeout
-            if (timeout % 10 == 0) {
-                vga_puts(".");
+            if (keyboard_wait_ms(1000)) {
+                uint8_t test_key = read_keyboard();
+                kprintf("Tecla detectada: [%u] - QEMU funcionando!\n", test_key);
+                break;
             }
-            
-            timeout++;
-            for (volatile int i = 0; i < 100000; i++) {}
         }
         
-        if (timeout >= 100) {
+        if (seconds == 10) {
             vga_puts("\nNENHUMA tecla detectada! QEMU não está capturando input!\n");
             vga_puts("Tente usar: make run-console\n");
         }
@@ -383,6 +6010,101 @@ void process_command(const char* command) {
         vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
         vga_puts("kernel-v> ");
     }
+    else if (strncmp(command, "sleep ", 6) == 0) {
+        uint32_t seconds = parse_uint(command + 6);
+        if (seconds > SLEEP_MAX_SECONDS) {
+            seconds = SLEEP_MAX_SECONDS;
+        }
+        ksleep_ms(seconds * 1000);
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "buddyinfo") == 0) {
+        buddy_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "buddybench") == 0) {
+        buddy_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "slabinfo") == 0) {
+        slab_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "slabbench") == 0) {
+        slab_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "paging") == 0) {
+        paging_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "tlbbench") == 0) {
+        tlb_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "threads") == 0) {
+        thread_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "schedbench") == 0) {
+        sched_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "parbench") == 0) {
+        parallel_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "zeropool") == 0) {
+        zero_pool_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "numabench") == 0) {
+        numa_bench();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "boottime") == 0) {
+        boot_report();
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
+    else if (strcmp(command, "bench") == 0) {
+        SystemInfo sys_info;
+        get_system_info(&sys_info);
+        
+        // Antes: cada caractere é um store direto em 0xB8000
+        vga_flush();
+        vga_writethrough = 1;
+        uint64_t start = rdtsc();
+        display_system_info(&sys_info);
+        uint64_t direct_cycles = rdtsc() - start;
+        vga_writethrough = 0;
+        
+        // Depois: escreve na shadow e copia as faixas sujas em um flush
+        // (process_command já roda dentro de um lote, então o '\n' não faz flush)
+        start = rdtsc();
+        display_system_info(&sys_info);
+        vga_flush();
+        uint64_t shadow_cycles = rdtsc() - start;
+        
+        kprintf(KC_WHITE "MMIO direto:      %10llu ciclos\n"
+                "Shadow + flush:   %10llu ciclos\n"
+                "Troca de console: %10u ciclos (última Alt+Fn)\n",
+                direct_cycles, shadow_cycles, console_switch_cycles);
+        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+        vga_puts("kernel-v> ");
+    }
     else if (strcmp(command, "exit") == 0 || strcmp(command, "reboot") == 0) {
         vga_puts("Reiniciando sistema...\n");
         // Reinicia o sistema
@@ -439,8 +6161,57 @@ void kernel_init() {
 }
 
 // Função para executar o shell
+// Função para desenhar o indicador no canto superior direito do console
+// visível: teclas tratadas e quanto a anterior levou para chegar à tela
+// (só na tela, não no log serial)
+static void overlay_draw() {
+    console_lock();
+    Console* saved = con;
+    con = con_visible;
+    int old_x = con->x;
+    int old_y = con->y;
+    uint8_t old_color = con->color;
+    
+    con->x = VGA_WIDTH - 18;
+    con->y = 0;
+    serial_mute++;
+    kprintf(KC_LIGHT_RED "FRAME:%-5d %4uus", frame_counter, frame_us);
+    serial_mute--;
+    
+    con->x = old_x;
+    con->y = old_y;
+    vga_set_color(old_color);
+    console_flush(con);
+    con = saved;
+    console_unlock();
+}
+
+// Thread do indicador: redesenha a cada OVERLAY_PERIOD_MS
+static void overlay_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        overlay_draw();
+        ksleep_ms(OVERLAY_PERIOD_MS);
+    }
+}
+
+// Thread do flush do log: leva à tela e à serial a saída pendente. Comandos
+// rodam em lote (vga_batch) e sem ela a saída de um comando longo só
+// apareceria quando ele terminasse.
+static void log_flush_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        ksleep_ms(LOG_FLUSH_PERIOD_MS);
+        console_lock();
+        console_flush(con_visible);
+        console_unlock();
+        serial_kick();
+    }
+}
+
 void run_shell() {
-    char key;
+    uint8_t scancode;
+    uint8_t key;
     char ch;
     
     // Indicador de que o shell iniciou
@@ -449,175 +6220,172 @@ void run_shell() {
     vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
     vga_puts("kernel-v> ");
     
-    // Loop principal do shell - sistema fica estável aqui
+    // Os outros consoles começam com o próprio prompt
+    for (int i = NUM_CONSOLES - 1; i >= 0; i--) {
+        console_lock();
+        con = &consoles[i];
+        console_unlock();
+        if (i > 0) {
+            kprintf(KC_LIGHT_CYAN "Console %d (Alt+F1..F4 troca de console)\n", i + 1);
+            vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+            vga_puts("kernel-v> ");
+        }
+    }
+    
+    // Loop principal do shell: cada volta trata um scancode e, sem teclas,
+    // a thread fica bloqueada dentro de read_keyboard
+    uint64_t frame_start = 0;                   // Chegada da última tecla
     while (1) {
-        // Indicador visual de que o sistema está funcionando
-        static int frame_counter = 0;
+        // O shell atende sempre o console que está na tela (o overlay troca
+        // o con por um instante, com o console pego)
+        console_lock();
+        con = con_visible;
+        console_unlock();
+        
+        // Indicador visual de que o sistema está funcionando (uma volta por
+        // tecla); sem a thread do overlay o próprio shell o desenha
         frame_counter++;
+        if (!overlay_task) {
+            overlay_draw();
+        }
         
-        // Atualiza indicador a cada 50 frames (muito frequente)
-        if (frame_counter % 50 == 0) {
-            // Salva posição atual
-            int old_x = vga_x;
-            int old_y = vga_y;
-            
-            // Vai para canto superior direito
-            vga_x = VGA_WIDTH - 15;
-            vga_y = 0;
-            
-            // Mostra contador de frames
-            vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-            vga_puts("FRAME:");
-            vga_putint(frame_counter / 50);
-            
-            // Restaura posição
-            vga_x = old_x;
-            vga_y = old_y;
-            vga_set_color(vga_color);
+        // Leva o eco das teclas e os indicadores para a tela antes de dormir
+        vga_flush();
+        if (frame_start) {
+            uint64_t elapsed = ktime_ns() - frame_start;
+            div64_32(&elapsed, 1000);
+            frame_us = (uint32_t)elapsed;
         }
         
-        // Verifica teclado de forma não-bloqueante
-        if (keyboard_available()) {
-            key = inb(KEYBOARD_DATA_PORT);
-            
-            // Debug: mostra todas as teclas
-            vga_set_color(VGA_LIGHT_GREEN | (VGA_BLACK << 4));
-            vga_puts("[");
-            vga_putint(key);
-            vga_puts("]");
-            vga_set_color(vga_color);
-            
-            // Processa tecla especial
-            if (key == 0xE0) {
-                key = inb(KEYBOARD_DATA_PORT);
-                continue;
-            }
-            
-            // Converte scancode para caractere
-            if (key >= 0x02 && key <= 0x0D) {
-                ch = "1234567890-="[key - 0x02];
-            }
-            else if (key >= 0x10 && key <= 0x1B) {
-                ch = "qwertyuiop[]"[key - 0x10];
-            }
-            else if (key >= 0x1E && key <= 0x28) {
-                ch = "asdfghjkl;'"[key - 0x1E];
-            }
-            else if (key >= 0x2C && key <= 0x35) {
-                ch = "zxcvbnm,./"[key - 0x2C];
-            }
-            else if (key == 0x39) {
-                ch = ' ';
-            }
-            else if (key == 0x1C) { // Enter
-                vga_putchar('\n');
-                command_buffer[command_pos] = '\0';
-                process_command(command_buffer);
-                command_pos = 0;
-                vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
-                vga_puts("kernel-v> ");
-                continue;
-            }
-            else if (key == 0x0E) { // Backspace
-                if (command_pos > 0) {
-                    command_pos--;
-                    vga_putchar('\b');
-                    vga_putchar(' ');
-                    vga_putchar('\b');
-                }
-                continue;
-            }
-            else if (key == 0x0F) { // Tab
-                ch = '\t';
-            }
-            else if (key == 0x1A) { // [
-                ch = '[';
-            }
-            else if (key == 0x1B) { // ]
-                ch = ']';
-            }
-            else if (key == 0x27) { // ;
-                ch = ';';
-            }
-            else if (key == 0x28) { // '
-                ch = '\'';
-            }
-            else if (key == 0x33) { // ,
-                ch = ',';
-            }
-            else if (key == 0x34) { // .
-                ch = '.';
-            }
-            else if (key == 0x35) { // /
-                ch = '/';
-            }
-            else if (key == 0x0B) { // 0
-                ch = '0';
-            }
-            else if (key == 0x0C) { // -
-                ch = '-';
-            }
-            else if (key == 0x0D) { // =
-                ch = '=';
-            }
-            else {
-                // Tecla não reconhecida, mas não trava
-                continue;
+        scancode = read_keyboard();
+        frame_start = ktime_ns();
+        
+        // Debug: mostra todas as teclas
+        kprintf(KC_LIGHT_GREEN "[%u]", scancode);
+        vga_set_color(con->color);
+        
+        key = key_decode(&keyboard_decoder, scancode);
+        if (key == 0) {
+            continue;
+        }
+        
+        // Alt+Fn troca o console mostrado
+        if (console_hotkey(key)) {
+            continue;
+        }
+        
+        if (key == KEY_PAGE_UP) {
+            scrollback_scroll(VGA_HEIGHT - 1);
+            continue;
+        }
+        if (key == KEY_PAGE_DOWN) {
+            scrollback_scroll(-(VGA_HEIGHT - 1));
+            continue;
+        }
+        
+        // Qualquer outra tecla volta para a tela ao vivo
+        if (con->scrollback_view) {
+            scrollback_scroll(-(int)con->scrollback_view);
+        }
+        
+        if (key == '\n') { // Enter
+            vga_putchar('\n');
+            con->command_buffer[con->command_pos] = '\0';
+            vga_batch_begin();
+            process_command(con->command_buffer);
+            vga_batch_end();
+            con->command_pos = 0;
+            vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
+            vga_puts("kernel-v> ");
+            continue;
+        }
+        if (key == '\b') { // Backspace
+            if (con->command_pos > 0) {
+                con->command_pos--;
+                vga_putchar('\b');
+                vga_putchar(' ');
+                vga_putchar('\b');
             }
-            
-            // Adiciona caractere ao buffer e exibe na tela
-            if (command_pos < MAX_COMMAND_LENGTH - 1) {
-                command_buffer[command_pos++] = ch;
-                vga_putchar(ch);
-            }
-        }
-        else {
-            // Se não há tecla, força uma verificação mais agressiva
-            // Tenta ler diretamente da porta do teclado
-            unsigned char status = inb(KEYBOARD_STATUS_PORT);
-            if (status & 0x01) {
-                // Há dados, força a leitura
-                key = inb(KEYBOARD_DATA_PORT);
-                
-                // Debug: mostra tecla forçada
-                vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-                vga_puts("FORCE[");
-                vga_putint(key);
-                vga_puts("]");
-                vga_set_color(vga_color);
-            }
-        }
-        
-        // Pausa mínima para não travar
-        for (volatile int i = 0; i < 10; i++) {}
-        
-        // Teste adicional: mostra status do teclado a cada 100 frames
-        if (frame_counter % 100 == 0) {
-            // Salva posição atual
-            int old_x = vga_x;
-            int old_y = vga_y;
-            
-            // Vai para canto superior esquerdo
-            vga_x = 0;
-            vga_y = 1;
-            
-            // Mostra status do teclado
-            vga_set_color(VGA_LIGHT_CYAN | (VGA_BLACK << 4));
-            vga_puts("KB:");
-            vga_putint(keyboard_available());
-            
-            // Restaura posição
-            vga_x = old_x;
-            vga_y = old_y;
-            vga_set_color(vga_color);
+            continue;
+        }
+        
+        // Só texto entra na linha de comando (setas, Fn, ESC e Ctrl ficam de fora)
+        if (key >= 0x7F || (key < ' ' && key != '\t')) {
+            continue;
+        }
+        ch = key;
+        
+        // Adiciona caractere ao buffer e exibe na tela
+        if (con->command_pos < MAX_COMMAND_LENGTH - 1) {
+            con->command_buffer[con->command_pos++] = ch;
+            vga_putchar(ch);
         }
     }
 }
 
+static void shell_thread(void* arg) {
+    (void)arg;
+    run_shell();
+}
+
 // Função principal do kernel
-void kernel_main() {
+void kernel_main(uint32_t magic, MultibootInfo* mbi) {
+    boot_phase("entrada");
+    
+    // GDT/TSS e IDT primeiro: daqui em diante uma falha vira tela de pânico
+    gdt_init(0);
+    interrupts_init();
+    boot_phase("gdt+idt");
+    
+    // Log pela COM1 (rodamos sem monitor) antes de qualquer saída
+    serial_init();
+    boot_phase("serial");
+    keyboard_init();
+    boot_phase("teclado");
+    timer_init();
+    clocksource_init();
+    boot_phase("timer+tsc");
+    rtc_init();
+    boot_phase("rtc");
+    
+    // O RSDP sai da BDA, na página 0, que a paginação deixa de fora
+    acpi_init();
+    
+    // Sem o magic do GRUB não há mapa de memória e o alocador fica vazio
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        pmm_init(mbi);
+        numa_init();
+        buddy_init();
+        slab_init();
+        zero_pool_init();
+    }
+    boot_phase("pmm");
+    paging_init(magic == MULTIBOOT_BOOTLOADER_MAGIC ? mbi : 0);
+    boot_phase("paging");
+    __asm__ volatile("sti");
+    
+    console_init();
+    boot_phase("console");
+    
+    vga_batch_begin();
     kernel_init();
+    vga_batch_end();
+    boot_phase("banner");
     
-    // Inicializa o shell
+    // Com o escalonador, as APs acordam (cada uma vira a ociosa da sua
+    // fila), shell, indicador e flush do log viram threads e o boot segue
+    // como a thread ociosa da BSP; sem ele, o shell roda aqui mesmo
+    if (sched_init()) {
+        smp_init();
+        boot_phase("smp");
+        work_init();
+        preempt_disable();
+        thread_create("shell", shell_thread, 0, THREAD_PRIO_NORMAL);
+        thread_create("klogd", log_flush_thread, 0, THREAD_PRIO_HIGH);
+        overlay_task = thread_create("overlay", overlay_thread, 0, THREAD_PRIO_HIGH);
+        boot_phase("threads");
+        preempt_enable();
+        cpu_idle();
+    }
     run_shell();
 }
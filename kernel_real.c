@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdarg.h>
 #include <stddef.h>
 
 // Definir tipos se não estiverem disponíveis
@@ -37,11 +38,45 @@ typedef unsigned int uint32_t;
 #define VGA_LIGHT_YELLOW 14  // Mesmo valor do brown para simplicidade
 #define VGA_WHITE 15
 
+// Escapes de cor para vga_puts/kprintf: ESC seguido de um dígito hexa com a
+// cor do texto (fundo preto). Ex.: kprintf(KC_LIGHT_CYAN "OS: %s\n", os)
+#define KC_ESCAPE '\033'
+#define KC_BLACK "\0330"
+#define KC_BLUE "\0331"
+#define KC_GREEN "\0332"
+#define KC_CYAN "\0333"
+#define KC_RED "\0334"
+#define KC_MAGENTA "\0335"
+#define KC_BROWN "\0336"
+#define KC_LIGHT_GREY "\0337"
+#define KC_DARK_GREY "\0338"
+#define KC_LIGHT_BLUE "\0339"
+#define KC_LIGHT_GREEN "\033A"
+#define KC_LIGHT_CYAN "\033B"
+#define KC_LIGHT_RED "\033C"
+#define KC_LIGHT_MAGENTA "\033D"
+#define KC_LIGHT_BROWN "\033E"
+#define KC_LIGHT_YELLOW "\033E"
+#define KC_WHITE "\033F"
+
+// Buffer de formatação do kprintf (na pilha)
+#define KPRINTF_BUFFER 512
+
 // Endereço base da memória VGA
 #define VGA_BASE 0xB8000
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 
+// Memória de texto completa: 32 KB em 0xB8000 (16384 células, 204 linhas)
+#define VGA_MEM_CELLS 16384
+#define VGA_MEM_ROWS (VGA_MEM_CELLS / VGA_WIDTH)
+
+// Registradores do CRTC usados para rolar a tela por hardware
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CRTC_START_HIGH 0x0C
+#define VGA_CRTC_START_LOW 0x0D
+
 // Estrutura para informações do sistema
 typedef struct {
     char hostname[32];
@@ -52,15 +87,109 @@ typedef struct {
 } SystemInfo;
 
 // Variáveis globais
-static uint16_t* vga_buffer = (uint16_t*)VGA_BASE;
+static volatile uint16_t* vga_buffer = (volatile uint16_t*)VGA_BASE;
 static uint8_t vga_color = VGA_LIGHT_GREY | (VGA_BLACK << 4);
 static size_t vga_x = 0;
 static size_t vga_y = 0;
 
+// Cópia em RAM só da tela (80x25: o kernel é carregado em 0x1000 e o .bss
+// tem que terminar antes do setor de boot e da pilha, em 0x7C00), num anel
+// de linhas para rolar sem copiar. Só as faixas sujas vão para a VGA, na
+// janela de 25 linhas a partir de vga_origin nos 32 KB de texto.
+static uint16_t vga_shadow[VGA_WIDTH * VGA_HEIGHT];
+static size_t vga_shadow_top = 0;       // Linha do anel que está no topo da tela
+static size_t vga_origin = 0;           // Linha da memória no topo da tela
+static size_t vga_hw_origin = 0;        // Última origem programada no CRTC
+static uint8_t vga_dirty_start[VGA_HEIGHT];
+static uint8_t vga_dirty_end[VGA_HEIGHT];
+static uint32_t vga_dirty_rows = 0;     // Um bit por linha suja
+static int vga_batch_depth = 0;         // > 0 adia o flush do '\n'
+
+// Função para ler byte de uma porta
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Função para escrever byte em uma porta
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Copia 'count' palavras de 32 bits de uma vez (rep movsl)
+static inline void vga_copy32(volatile void* dst, const void* src, size_t count) {
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// Marca as colunas [start, end) da linha y como sujas
+static inline void vga_mark_dirty(size_t y, size_t start, size_t end) {
+    if (vga_dirty_rows & (1u << y)) {
+        if (start < vga_dirty_start[y]) vga_dirty_start[y] = start;
+        if (end > vga_dirty_end[y]) vga_dirty_end[y] = end;
+    } else {
+        vga_dirty_rows |= 1u << y;
+        vga_dirty_start[y] = start;
+        vga_dirty_end[y] = end;
+    }
+}
+
+// Linha 'y' da tela na shadow
+static inline uint16_t* vga_shadow_row(size_t y) {
+    size_t row = vga_shadow_top + y;
+    if (row >= VGA_HEIGHT) {
+        row -= VGA_HEIGHT;
+    }
+    return vga_shadow + row * VGA_WIDTH;
+}
+
+// Programa o CRTC para começar a tela na linha 'origin' da memória de texto
+static void vga_set_start(size_t origin) {
+    uint16_t pos = origin * VGA_WIDTH;
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH);
+    outb(VGA_CRTC_DATA, pos >> 8);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    vga_hw_origin = origin;
+}
+
+// Copia as faixas sujas da shadow para a memória de vídeo
+void vga_flush() {
+    while (vga_dirty_rows) {
+        size_t y = __builtin_ctz(vga_dirty_rows);
+        vga_dirty_rows &= vga_dirty_rows - 1;
+        
+        // Alinha a faixa em pares de células para copiar 32 bits por vez
+        size_t start = vga_dirty_start[y] & ~1u;
+        size_t end = (vga_dirty_end[y] + 1) & ~1u;
+        vga_copy32(vga_buffer + (vga_origin + y) * VGA_WIDTH + start,
+                   vga_shadow_row(y) + start, (end - start) / 2);
+    }
+    
+    // Só move a janela depois que o conteúdo novo já está na VGA
+    if (vga_hw_origin != vga_origin) {
+        vga_set_start(vga_origin);
+    }
+}
+
+// Agrupa várias escritas em um único flush
+void vga_batch_begin() {
+    vga_batch_depth++;
+}
+
+void vga_batch_end() {
+    if (--vga_batch_depth == 0) {
+        vga_flush();
+    }
+}
+
 // Função para limpar a tela
 void vga_clear() {
     for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+        vga_shadow[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        vga_mark_dirty(y, 0, VGA_WIDTH);
     }
     vga_x = 0;
     vga_y = 0;
@@ -71,65 +200,311 @@ void vga_set_color(uint8_t color) {
     vga_color = color;
 }
 
+// Rola a tela uma linha. Normalmente só avança a origem do CRTC e o topo
+// do anel (O(1)); só copia quando a janela chega ao fim dos 32 KB de
+// memória de texto.
+static void vga_scroll() {
+    if (vga_origin + VGA_HEIGHT < VGA_MEM_ROWS) {
+        vga_origin++;
+        
+        // As linhas sujas sobem junto com a janela
+        vga_dirty_rows >>= 1;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_dirty_start[y] = vga_dirty_start[y + 1];
+            vga_dirty_end[y] = vga_dirty_end[y + 1];
+        }
+    } else {
+        // Fim da memória: a shadow só tem a tela, então leva o que falta
+        // para a VGA e copia lá mesmo as 24 linhas de baixo para o início
+        vga_flush();
+        vga_copy32(vga_buffer, (const void*)(vga_buffer + (vga_origin + 1) * VGA_WIDTH),
+                   VGA_WIDTH * (VGA_HEIGHT - 1) / 2);
+        vga_origin = 0;
+    }
+    if (++vga_shadow_top == VGA_HEIGHT) {
+        vga_shadow_top = 0;
+    }
+    
+    // Limpa a nova última linha
+    uint16_t* row = vga_shadow_row(VGA_HEIGHT - 1);
+    for (size_t x = 0; x < VGA_WIDTH; x++) {
+        row[x] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    vga_mark_dirty(VGA_HEIGHT - 1, 0, VGA_WIDTH);
+}
+
+// Vai para o início da próxima linha, rolando a tela se preciso
+static void vga_newline() {
+    vga_x = 0;
+    vga_y++;
+    if (vga_y >= VGA_HEIGHT) {
+        vga_scroll();
+        vga_y = VGA_HEIGHT - 1;
+    }
+}
+
 // Função para colocar caractere na tela
 void vga_putchar(char c) {
     if (c == '\n') {
-        vga_x = 0;
-        vga_y++;
-        if (vga_y >= VGA_HEIGHT) {
-            // Scroll da tela
-            for (size_t i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
-                vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
-            }
-            for (size_t i = VGA_WIDTH * (VGA_HEIGHT - 1); i < VGA_WIDTH * VGA_HEIGHT; i++) {
-                vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
-            }
-            vga_y = VGA_HEIGHT - 1;
+        vga_newline();
+        if (vga_batch_depth == 0) {
+            vga_flush();
         }
         return;
     }
     
     if (vga_x >= VGA_WIDTH) {
-        vga_x = 0;
-        vga_y++;
-    }
-    
-    if (vga_y >= VGA_HEIGHT) {
-        vga_y = 0;
+        vga_newline();
     }
     
-    const size_t index = vga_y * VGA_WIDTH + vga_x;
-    vga_buffer[index] = (uint16_t)c | (uint16_t)vga_color << 8;
+    vga_shadow_row(vga_y)[vga_x] = (uint16_t)c | (uint16_t)vga_color << 8;
+    vga_mark_dirty(vga_y, vga_x, vga_x + 1);
     vga_x++;
 }
 
+// Escreve 'len' bytes na tela de uma vez, interpretando os escapes de cor
+void vga_write(const char* buf, size_t len) {
+    vga_batch_begin();
+    for (size_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == KC_ESCAPE && i + 1 < len) {
+            char d = buf[++i];
+            uint8_t fg = (d >= 'A') ? d - 'A' + 10 : d - '0';
+            vga_set_color((fg & 0x0F) | (VGA_BLACK << 4));
+            continue;
+        }
+        vga_putchar(c);
+    }
+    vga_batch_end();
+}
+
 // Função para exibir string
 void vga_puts(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
     }
+    vga_write(str, len);
 }
 
-// Função para exibir número
-void vga_putint(uint32_t num) {
-    if (num == 0) {
-        vga_putchar('0');
-        return;
+// Pares "00".."99": cada divisão por 100 gera dois dígitos de uma vez
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Divide n (64 bits) por d (32 bits) com duas instruções divl, sem depender
+// do __udivdi3 da libgcc. Retorna o resto e deixa o quociente em n.
+static inline uint32_t div64_32(uint64_t* n, uint32_t d) {
+    uint32_t hi = (uint32_t)(*n >> 32);
+    uint32_t lo = (uint32_t)*n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    *n = ((uint64_t)q_hi << 32) | q_lo;
+    return r;
+}
+
+// Escreve n em decimal de trás para frente terminando em 'end'.
+// Retorna o início dos dígitos.
+static char* fmt_u32(char* end, uint32_t n) {
+    while (n >= 100) {
+        uint32_t q = n / 100;
+        uint32_t r = (n - q * 100) * 2;
+        end -= 2;
+        end[0] = digit_pairs[r];
+        end[1] = digit_pairs[r + 1];
+        n = q;
     }
+    if (n >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[n * 2];
+        end[1] = digit_pairs[n * 2 + 1];
+    } else {
+        *--end = '0' + n;
+    }
+    return end;
+}
+
+static char* fmt_u64(char* end, uint64_t n) {
+    // Blocos de 8 dígitos enquanto o número não cabe em 32 bits
+    while (n >> 32) {
+        char* start = fmt_u32(end, div64_32(&n, 100000000));
+        end -= 8;
+        while (start > end) {
+            *--start = '0';
+        }
+    }
+    return fmt_u32(end, (uint32_t)n);
+}
+
+static char* fmt_hex(char* end, uint64_t n, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[n & 0xF];
+        n >>= 4;
+    } while (n);
+    return end;
+}
+
+// Buffer de saída do kprintf: tudo é formatado aqui e vai para a tela em um
+// único vga_write (ou em blocos, se passar de KPRINTF_BUFFER)
+typedef struct {
+    char buf[KPRINTF_BUFFER];
+    size_t len;
+} KprintfBuffer;
+
+#define FMT_LEFT 1      // '-': alinha à esquerda
+#define FMT_ZERO 2      // '0': completa com zeros
+
+static void kbuf_putc(KprintfBuffer* b, char c) {
+    // Não separa um escape de cor do seu dígito entre dois blocos
+    if (b->len == KPRINTF_BUFFER || (c == KC_ESCAPE && b->len == KPRINTF_BUFFER - 1)) {
+        vga_write(b->buf, b->len);
+        b->len = 0;
+    }
+    b->buf[b->len++] = c;
+}
+
+// Emite um campo com largura mínima; o prefixo (sinal, "0x") vem antes dos zeros
+static void kbuf_field(KprintfBuffer* b, const char* prefix, const char* s, size_t len,
+                       int width, int flags) {
+    int pad = width - (int)len;
+    for (const char* p = prefix; *p; p++) {
+        pad--;
+    }
+    if (!(flags & (FMT_LEFT | FMT_ZERO))) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+    while (*prefix) {
+        kbuf_putc(b, *prefix++);
+    }
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        while (pad-- > 0) kbuf_putc(b, '0');
+    }
+    for (size_t i = 0; i < len; i++) {
+        kbuf_putc(b, s[i]);
+    }
+    if (flags & FMT_LEFT) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+}
+
+// printf do kernel: %d %u %x %X %p %s %c %%, com 'l'/'ll', largura, '-' e '0'
+void vkprintf(const char* fmt, va_list args) {
+    KprintfBuffer b;
+    char num[24];
+    b.len = 0;
     
-    char buffer[32];
-    int i = 0;
-    
-    while (num > 0) {
-        buffer[i++] = '0' + (num % 10);
-        num /= 10;
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        fmt++;
+        
+        int flags = 0;
+        int width = 0;
+        int longs = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FMT_LEFT;
+            else if (*fmt == '0') flags |= FMT_ZERO;
+            else break;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+        
+        char* end = num + sizeof(num);
+        char* start;
+        const char* prefix = "";
+        uint64_t value;
+        switch (*fmt) {
+        case 'd': {
+            int64_t v = longs >= 2 ? va_arg(args, long long)
+                      : longs ? va_arg(args, long) : va_arg(args, int);
+            if (v < 0) {
+                prefix = "-";
+                value = -(uint64_t)v;
+            } else {
+                value = v;
+            }
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        }
+        case 'u':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        case 'x':
+        case 'X':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = fmt_hex(end, value, *fmt == 'X');
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void*);
+            start = fmt_hex(end, value, 0);
+            prefix = "0x";
+            flags |= FMT_ZERO;
+            width = 2 + 2 * sizeof(void*);
+            break;
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            size_t len = 0;
+            if (!str) {
+                str = "(null)";
+            }
+            while (str[len] != '\0') {
+                len++;
+            }
+            kbuf_field(&b, "", str, len, width, flags);
+            continue;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            kbuf_field(&b, "", &c, 1, width, flags);
+            continue;
+        }
+        case '\0':
+            fmt--;
+            continue;
+        default:
+            // '%%' vira '%'; conversão desconhecida é copiada como está
+            if (*fmt != '%') {
+                kbuf_putc(&b, '%');
+            }
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        kbuf_field(&b, prefix, start, end - start, width, flags);
     }
     
-    while (--i >= 0) {
-        vga_putchar(buffer[i]);
+    if (b.len) {
+        vga_write(b.buf, b.len);
     }
 }
 
+void kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vkprintf(fmt, args);
+    va_end(args);
+}
+
 // Função para obter informações básicas do sistema
 void get_system_info(SystemInfo* info) {
     // Informações hardcoded para simplicidade
@@ -159,38 +534,16 @@ void get_system_info(SystemInfo* info) {
 
 // Função para exibir informações do sistema no estilo neofetch
 void display_system_info(SystemInfo* info) {
-    vga_set_color(VGA_LIGHT_CYAN | (VGA_BLACK << 4));
-    vga_puts("                    ");
-    vga_puts(info->hostname);
-    vga_puts("@kernel-v\n");
-    
-    vga_set_color(VGA_LIGHT_GREY | (VGA_BLACK << 4));
-    vga_puts("                   ---------------\n");
-    
-    vga_set_color(VGA_LIGHT_GREEN | (VGA_BLACK << 4));
-    vga_puts("OS:                 Kernel-V ");
-    vga_puts(info->cpu_info);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_BLUE | (VGA_BLACK << 4));
-    vga_puts("Kernel:             ");
-    vga_puts(info->kernel_version);
-    vga_putchar('\n');
-    
-    vga_set_color(VGA_LIGHT_MAGENTA | (VGA_BLACK << 4));
-    vga_puts("Uptime:             ");
-    vga_putint(info->uptime_seconds);
-    vga_puts("s\n");
-    
-    vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-    vga_puts("Memory:             ");
-    vga_putint(info->memory_mb);
-    vga_puts("MB\n");
-    
-    vga_set_color(VGA_LIGHT_BROWN | (VGA_BLACK << 4));
-    vga_puts("Shell:              kernel-shell\n");
-    
-    vga_putchar('\n');
+    kprintf(KC_LIGHT_CYAN    "                    %s@kernel-v\n"
+            KC_LIGHT_GREY    "                   ---------------\n"
+            KC_LIGHT_GREEN   "OS:                 Kernel-V %s\n"
+            KC_LIGHT_BLUE    "Kernel:             %s\n"
+            KC_LIGHT_MAGENTA "Uptime:             %us\n"
+            KC_LIGHT_RED     "Memory:             %uMB\n"
+            KC_LIGHT_BROWN   "Shell:              kernel-shell\n"
+            "\n",
+            info->hostname, info->cpu_info, info->kernel_version,
+            info->uptime_seconds, info->memory_mb);
 }
 
 // Função para inicializar o sistema
@@ -226,7 +579,10 @@ void kernel_init() {
 
 // Função principal do kernel
 void kernel_main() {
+    // Todo o banner sai em um único flush
+    vga_batch_begin();
     kernel_init();
+    vga_batch_end();
     
     // Loop principal do sistema
     while (1) {
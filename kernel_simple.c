@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
 
 // Cabeçalho Multiboot para compatibilidade com QEMU
 #define MULTIBOOT_HEADER_MAGIC 0x1BADB002
@@ -20,6 +22,28 @@ struct multiboot_header multiboot_header = {
     MULTIBOOT_HEADER_CHECKSUM
 };
 
+void kernel_main();
+
+// Ponto de entrada: monta a pilha do kernel e chama kernel_main
+__asm__(
+    ".pushsection .bss\n"
+    ".align 16\n"
+    "kernel_stack:\n"
+    "    .skip 16384\n"                    // 16 KB de pilha
+    "kernel_stack_top:\n"
+    ".popsection\n"
+    ".pushsection .text\n"
+    ".globl _start\n"
+    "_start:\n"
+    "    movl $kernel_stack_top, %esp\n"
+    "    xorl %ebp, %ebp\n"
+    "    call kernel_main\n"
+    "1:  cli\n"
+    "    hlt\n"
+    "    jmp 1b\n"
+    ".popsection\n"
+);
+
 // Definições do VGA
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
@@ -40,20 +64,468 @@ struct multiboot_header multiboot_header = {
 #define VGA_LIGHT_YELLOW 14
 #define VGA_WHITE 15
 
+// Escapes de cor para vga_puts/kprintf: ESC seguido de um dígito hexa com a
+// cor do texto (fundo preto). Ex.: kprintf(KC_LIGHT_CYAN "OS: %s\n", os)
+#define KC_ESCAPE '\033'
+#define KC_BLACK "\0330"
+#define KC_BLUE "\0331"
+#define KC_GREEN "\0332"
+#define KC_CYAN "\0333"
+#define KC_RED "\0334"
+#define KC_MAGENTA "\0335"
+#define KC_BROWN "\0336"
+#define KC_LIGHT_GREY "\0337"
+#define KC_DARK_GREY "\0338"
+#define KC_LIGHT_BLUE "\0339"
+#define KC_LIGHT_GREEN "\033A"
+#define KC_LIGHT_CYAN "\033B"
+#define KC_LIGHT_RED "\033C"
+#define KC_LIGHT_MAGENTA "\033D"
+#define KC_LIGHT_BROWN "\033E"
+#define KC_LIGHT_YELLOW "\033E"
+#define KC_WHITE "\033F"
+
+// Buffer de formatação do kprintf (na pilha)
+#define KPRINTF_BUFFER 512
+
+// Memória de texto completa: 32 KB em 0xB8000 (16384 células, 204 linhas)
+#define VGA_MEM_CELLS 16384
+#define VGA_MEM_ROWS (VGA_MEM_CELLS / VGA_WIDTH)
+
+// Registradores do CRTC usados para rolar a tela por hardware
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CRTC_START_HIGH 0x0C
+#define VGA_CRTC_START_LOW 0x0D
+#define VGA_CRTC_CURSOR_HIGH 0x0E
+#define VGA_CRTC_CURSOR_LOW 0x0F
+
+// Relógio de tempo real (RTC) na CMOS
+#define CMOS_INDEX 0x70
+#define CMOS_DATA 0x71
+#define RTC_SECONDS 0x00
+#define RTC_MINUTES 0x02
+#define RTC_HOURS 0x04
+#define RTC_DAY 0x07
+#define RTC_MONTH 0x08
+#define RTC_YEAR 0x09
+#define RTC_CENTURY 0x32            // Não é padrão; só vale se tiver um valor plausível
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+#define RTC_STATUS_C 0x0C           // Ler reconhece a IRQ8
+#define RTC_A_UIP 0x80              // Atualização em andamento
+#define RTC_B_24H 0x02
+#define RTC_B_BINARY 0x04           // Sem ele os campos vêm em BCD
+#define RTC_B_UIE 0x10              // IRQ a cada atualização (1 Hz)
+#define RTC_B_PIE 0x40              // IRQ periódica
+#define RTC_HOUR_PM 0x80            // Bit de PM no modo de 12 horas
+#define RTC_REG_COUNT 7
+#define RTC_IRQ 8
+#define RTC_C_UF 0x10               // Registrador C: foi o fim de uma atualização
+
 // Portas do teclado
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
 
+// Controladores de interrupção 8259 (PIC)
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define IRQ_BASE 0x20               // IRQ 0-15 remapeadas para os vetores 0x20-0x2F
+
+// Seletores da GDT do kernel
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS 0x18
+#define GDT_DOUBLE_FAULT_TSS 0x20
+#define GDT_ENTRIES 5
+
+// Stubs de interrupção: 32 exceções + 16 IRQs
+#define IDT_STUBS 48
+
+// Teclas, modificadores e tabelas do scancode set 1 (comuns aos kernels)
+#include "keymap.h"
+
+// Data e hora do relógio de parede (UTC)
+typedef struct {
+    uint32_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t weekday;                    // 0 = domingo
+} DateTime;
+
 // Buffer VGA
 volatile uint16_t* vga_buffer = (volatile uint16_t*)0xB8000;
-volatile int vga_x = 0;
-volatile int vga_y = 0;
-volatile uint8_t vga_color = VGA_WHITE | (VGA_BLACK << 4);
+int vga_x = 0;
+int vga_y = 0;
+uint8_t vga_color = VGA_WHITE | (VGA_BLACK << 4);
+
+// Cópia em RAM dos 32 KB de texto; só as faixas sujas das linhas visíveis
+// vão para a VGA. A tela é uma janela de 25 linhas a partir de vga_origin.
+uint16_t vga_shadow[VGA_MEM_CELLS];
+int vga_origin = 0;             // Linha da memória no topo da tela
+int vga_hw_origin = 0;          // Última origem programada no CRTC
+int vga_hw_cursor = -1;         // Última posição do cursor no CRTC
+uint8_t vga_dirty_start[VGA_HEIGHT];
+uint8_t vga_dirty_end[VGA_HEIGHT];
+uint32_t vga_dirty_rows = 0;    // Um bit por linha suja
+int vga_batch_depth = 0;        // > 0 adia o flush do '\n'
+
+// Relógio de parede: a CMOS é lida uma vez e a IRQ8 conta os segundos
+uint32_t rtc_boot_epoch = 0;    // Segundos desde 1970 lidos no boot
+volatile uint32_t rtc_seconds = 0;  // Atualizações do RTC desde a leitura
+
+// Funções de I/O
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Pequena pausa para o PIC (escreve na porta de diagnóstico 0x80)
+static inline void io_wait() {
+    outb(0x80, 0);
+}
+
+// Descritor de segmento da GDT
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;                // Limite 19:16 e flags (4 KB, 32 bits)
+    uint8_t base_high;
+} __attribute__((packed)) GdtEntry;
+
+// Task State Segment de 32 bits
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0, ss0;                 // Pilha usada ao entrar no anel 0
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3;
+    uint32_t eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) Tss;
+
+// Entrada da IDT (interrupt ou task gate de 32 bits)
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed)) IdtEntry;
+
+// Operando de lgdt/lidt
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) DescriptorPointer;
+
+// Registradores salvos por isr_common, na ordem em que ficam na pilha
+typedef struct {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;    // pushal
+    uint32_t vector, error;
+    uint32_t eip, cs, eflags;                           // Empilhados pela CPU
+} InterruptFrame;
+
+typedef void (*InterruptHandler)(InterruptFrame* frame);
+
+static GdtEntry gdt[GDT_ENTRIES];
+static Tss tss;                             // TSS do kernel
+static Tss double_fault_tss;                // Tarefa que trata o #DF
+static uint8_t double_fault_stack[4096] __attribute__((aligned(16)));
+static IdtEntry idt[256];
+static InterruptHandler interrupt_handlers[256];
+static uint16_t pic_mask = 0xFFFF;          // Cópia das máscaras (evita ler o PIC)
+
+// Pontos de entrada gerados em assembly, logo abaixo
+extern const uint32_t isr_stub_table[IDT_STUBS];
+extern uint8_t kernel_stack_top[];
+void interrupt_dispatch(InterruptFrame* frame);
+static void double_fault_task();
+
+// Cada stub empilha um código de erro (0 quando a CPU não empilha um) e o
+// número do vetor, então todas as entradas chegam iguais em isr_common
+__asm__(
+    ".pushsection .text\n"
+    ".macro ISR_NOERR vec\n"
+    "isr\\vec:\n"
+    "    pushl $0\n"
+    "    pushl $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".macro ISR_ERR vec\n"
+    "isr\\vec:\n"
+    "    pushl $\\vec\n"
+    "    jmp isr_common\n"
+    ".endm\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,9,15,16,18,19,20,22,23,24,25,26,27,28,31\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 8,10,11,12,13,14,17,21,29,30\n"
+    "    ISR_ERR \\vec\n"
+    ".endr\n"
+    ".irp vec, 32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    ISR_NOERR \\vec\n"
+    ".endr\n"
+    "isr_common:\n"
+    "    pushal\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    pushl %fs\n"
+    "    pushl %gs\n"
+    "    movw $0x10, %ax\n"                 // GDT_KERNEL_DATA
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    cld\n"
+    "    pushl %esp\n"                      // InterruptFrame*
+    "    call interrupt_dispatch\n"
+    "    addl $4, %esp\n"
+    "    popl %gs\n"
+    "    popl %fs\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    popal\n"
+    "    addl $8, %esp\n"                   // Vetor e código de erro
+    "    iretl\n"
+    ".popsection\n"
+    ".pushsection .rodata\n"
+    ".align 4\n"
+    "isr_stub_table:\n"
+    ".irp vec, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23\n"
+    "    .long isr\\vec\n"
+    ".endr\n"
+    ".irp vec, 24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47\n"
+    "    .long isr\\vec\n"
+    ".endr\n"
+    ".popsection\n"
+);
+
+// Função para preencher um descritor da GDT
+static void gdt_set(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_mid = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = (flags & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[index].base_high = base >> 24;
+}
+
+// Função para carregar a GDT do kernel (código/dados planos de 4 GB e as
+// duas TSS) no lugar da que o GRUB deixou
+void gdt_init() {
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(GDT_KERNEL_CODE >> 3, 0, 0xFFFFF, 0x9A, 0xC0);
+    gdt_set(GDT_KERNEL_DATA >> 3, 0, 0xFFFFF, 0x92, 0xC0);
+    gdt_set(GDT_TSS >> 3, (uint32_t)&tss, sizeof(Tss) - 1, 0x89, 0x00);
+    gdt_set(GDT_DOUBLE_FAULT_TSS >> 3, (uint32_t)&double_fault_tss, sizeof(Tss) - 1, 0x89, 0x00);
+    
+    tss.ss0 = GDT_KERNEL_DATA;
+    tss.esp0 = (uint32_t)kernel_stack_top;
+    tss.iomap_base = sizeof(Tss);           // Sem bitmap de I/O
+    
+    // Tarefa do #DF: começa em double_fault_task com a pilha própria
+    double_fault_tss.eip = (uint32_t)double_fault_task;
+    double_fault_tss.esp = (uint32_t)(double_fault_stack + sizeof(double_fault_stack));
+    double_fault_tss.eflags = 0x2;
+    double_fault_tss.cs = GDT_KERNEL_CODE;
+    double_fault_tss.ds = double_fault_tss.es = double_fault_tss.ss = GDT_KERNEL_DATA;
+    double_fault_tss.fs = double_fault_tss.gs = GDT_KERNEL_DATA;
+    double_fault_tss.iomap_base = sizeof(Tss);
+    __asm__ volatile("mov %%cr3, %0" : "=r"(double_fault_tss.cr3));
+    
+    DescriptorPointer gdtr = { sizeof(gdt) - 1, (uint32_t)gdt };
+    __asm__ volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "movw %w2, %%ds\n"
+        "movw %w2, %%es\n"
+        "movw %w2, %%fs\n"
+        "movw %w2, %%gs\n"
+        "movw %w2, %%ss\n"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA) : "memory");
+    __asm__ volatile("ltr %w0" : : "r"(GDT_TSS));
+}
+
+// Função para preencher uma entrada da IDT
+static void idt_set_gate(int vector, uint32_t offset, uint16_t selector, uint8_t type_attr) {
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].selector = selector;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = type_attr;
+    idt[vector].offset_high = offset >> 16;
+}
+
+// Função para remapear o PIC para os vetores 0x20-0x2F com tudo mascarado
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11); io_wait();   // ICW1: inicialização com ICW4
+    outb(PIC2_COMMAND, 0x11); io_wait();
+    outb(PIC1_DATA, IRQ_BASE); io_wait();  // ICW2: vetor base
+    outb(PIC2_DATA, IRQ_BASE + 8); io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();      // ICW3: escravo na IRQ2
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();      // ICW4: modo 8086
+    outb(PIC2_DATA, 0x01); io_wait();
+    
+    pic_mask = 0xFFFF;
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// Função para liberar uma IRQ no PIC (as do escravo liberam também a IRQ2)
+static void pic_unmask(int irq) {
+    uint16_t mask = pic_mask & ~(1 << irq);
+    if (irq >= 8) {
+        mask &= ~(1 << 2);
+    }
+    if ((mask ^ pic_mask) & 0x00FF) {
+        outb(PIC1_DATA, mask & 0xFF);
+    }
+    if ((mask ^ pic_mask) & 0xFF00) {
+        outb(PIC2_DATA, mask >> 8);
+    }
+    pic_mask = mask;
+}
+
+// Função para avisar o fim de uma IRQ: o escravo só é tocado nas IRQs 8-15
+static inline void pic_eoi(int irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// Função para ver se a IRQ está em serviço (ISR do PIC), para achar as espúrias
+static int pic_in_service(int irq) {
+    uint16_t port = irq >= 8 ? PIC2_COMMAND : PIC1_COMMAND;
+    outb(port, 0x0B);                      // OCW3: próxima leitura devolve o ISR
+    return (inb(port) >> (irq & 7)) & 1;
+}
+
+// Função para registrar o handler de um vetor (exceções)
+void interrupt_install(int vector, InterruptHandler handler) {
+    interrupt_handlers[vector] = handler;
+}
+
+// Função para registrar o handler de uma IRQ e liberá-la no PIC
+void irq_install(int irq, InterruptHandler handler) {
+    interrupt_handlers[IRQ_BASE + irq] = handler;
+    pic_unmask(irq);
+}
+
+// Função para carregar a IDT e remapear o PIC (interrupções ainda desligadas)
+void interrupts_init() {
+    for (int i = 0; i < IDT_STUBS; i++) {
+        idt_set_gate(i, isr_stub_table[i], GDT_KERNEL_CODE, 0x8E);  // Interrupt gate, DPL 0
+    }
+    
+    // O #DF troca de tarefa: roda com pilha própria mesmo se a do kernel estourou
+    idt_set_gate(8, 0, GDT_DOUBLE_FAULT_TSS, 0x85);                 // Task gate
+    
+    DescriptorPointer idtr = { sizeof(idt) - 1, (uint32_t)idt };
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+    
+    pic_remap();
+}
+
+
+// Copia 'count' palavras de 32 bits de uma vez (rep movsl)
+static inline void vga_copy32(volatile void* dst, const void* src, int count) {
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// Marca as colunas [start, end) da linha y como sujas
+static inline void vga_mark_dirty(int y, int start, int end) {
+    if (vga_dirty_rows & (1u << y)) {
+        if (start < vga_dirty_start[y]) vga_dirty_start[y] = start;
+        if (end > vga_dirty_end[y]) vga_dirty_end[y] = end;
+    } else {
+        vga_dirty_rows |= 1u << y;
+        vga_dirty_start[y] = start;
+        vga_dirty_end[y] = end;
+    }
+}
+
+// Programa o CRTC para começar a tela na linha 'origin' da memória de texto
+static void vga_set_start(int origin) {
+    uint16_t pos = origin * VGA_WIDTH;
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH);
+    outb(VGA_CRTC_DATA, pos >> 8);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_START_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    vga_hw_origin = origin;
+}
+
+// Posiciona o cursor de hardware (endereço absoluto na memória de texto)
+static void vga_set_cursor(int pos) {
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_HIGH);
+    outb(VGA_CRTC_DATA, pos >> 8);
+    outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_LOW);
+    outb(VGA_CRTC_DATA, pos & 0xFF);
+    vga_hw_cursor = pos;
+}
+
+// Copia as faixas sujas da shadow para a memória de vídeo
+void vga_flush() {
+    while (vga_dirty_rows) {
+        int y = __builtin_ctz(vga_dirty_rows);
+        vga_dirty_rows &= vga_dirty_rows - 1;
+        
+        // Alinha a faixa em pares de células para copiar 32 bits por vez
+        int start = vga_dirty_start[y] & ~1;
+        int end = (vga_dirty_end[y] + 1) & ~1;
+        int offset = (vga_origin + y) * VGA_WIDTH + start;
+        vga_copy32(vga_buffer + offset, vga_shadow + offset, (end - start) / 2);
+    }
+    
+    // Só move a janela depois que o conteúdo novo já está na VGA
+    if (vga_hw_origin != vga_origin) {
+        vga_set_start(vga_origin);
+    }
+    
+    // O cursor acompanha a posição de escrita
+    int cursor = (vga_origin + vga_y) * VGA_WIDTH + vga_x;
+    if (cursor != vga_hw_cursor) {
+        vga_set_cursor(cursor);
+    }
+}
+
+// Agrupa várias escritas em um único flush
+void vga_batch_begin() {
+    vga_batch_depth++;
+}
+
+void vga_batch_end() {
+    if (--vga_batch_depth == 0) {
+        vga_flush();
+    }
+}
 
 // Funções VGA básicas
 void vga_clear() {
+    uint16_t* screen = vga_shadow + vga_origin * VGA_WIDTH;
     for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+        screen[i] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        vga_mark_dirty(y, 0, VGA_WIDTH);
     }
     vga_x = 0;
     vga_y = 0;
@@ -63,68 +535,539 @@ void vga_set_color(uint8_t color) {
     vga_color = color;
 }
 
+// Rola a tela uma linha. Normalmente só avança a origem do CRTC (O(1));
+// só copia quando a janela chega ao fim dos 32 KB de memória de texto.
+static void vga_scroll() {
+    if (vga_origin + VGA_HEIGHT < VGA_MEM_ROWS) {
+        vga_origin++;
+        
+        // As linhas sujas sobem junto com a janela
+        vga_dirty_rows >>= 1;
+        for (int y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_dirty_start[y] = vga_dirty_start[y + 1];
+            vga_dirty_end[y] = vga_dirty_end[y + 1];
+        }
+    } else {
+        // Fim da memória: traz as 24 linhas de baixo para o início
+        uint16_t* src = vga_shadow + (vga_origin + 1) * VGA_WIDTH;
+        for (int i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
+            vga_shadow[i] = src[i];
+        }
+        vga_origin = 0;
+        vga_dirty_rows = 0;
+        for (int y = 0; y < VGA_HEIGHT - 1; y++) {
+            vga_mark_dirty(y, 0, VGA_WIDTH);
+        }
+    }
+    
+    // Limpa a nova última linha
+    uint16_t* row = vga_shadow + (vga_origin + VGA_HEIGHT - 1) * VGA_WIDTH;
+    for (int x = 0; x < VGA_WIDTH; x++) {
+        row[x] = (uint16_t)' ' | (uint16_t)vga_color << 8;
+    }
+    vga_mark_dirty(VGA_HEIGHT - 1, 0, VGA_WIDTH);
+}
+
+// Vai para o início da próxima linha, rolando a tela se preciso
+static void vga_newline() {
+    vga_x = 0;
+    vga_y++;
+    if (vga_y >= VGA_HEIGHT) {
+        vga_scroll();
+        vga_y = VGA_HEIGHT - 1;
+    }
+}
+
 void vga_putchar(char c) {
     if (c == '\n') {
-        vga_x = 0;
-        vga_y++;
-        if (vga_y >= VGA_HEIGHT) {
-            vga_y = 0;
+        vga_newline();
+        if (vga_batch_depth == 0) {
+            vga_flush();
         }
         return;
     }
     
     if (vga_x >= VGA_WIDTH) {
-        vga_x = 0;
-        vga_y++;
-        if (vga_y >= VGA_HEIGHT) {
-            vga_y = 0;
-        }
+        vga_newline();
     }
     
-    const int index = vga_y * VGA_WIDTH + vga_x;
-    vga_buffer[index] = (uint16_t)c | (uint16_t)vga_color << 8;
+    const int index = (vga_origin + vga_y) * VGA_WIDTH + vga_x;
+    vga_shadow[index] = (uint16_t)c | (uint16_t)vga_color << 8;
+    vga_mark_dirty(vga_y, vga_x, vga_x + 1);
     vga_x++;
 }
 
+// Escreve 'len' bytes na tela de uma vez, interpretando os escapes de cor
+void vga_write(const char* buf, int len) {
+    vga_batch_begin();
+    for (int i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == KC_ESCAPE && i + 1 < len) {
+            char d = buf[++i];
+            uint8_t fg = (d >= 'A') ? d - 'A' + 10 : d - '0';
+            vga_set_color((fg & 0x0F) | (VGA_BLACK << 4));
+            continue;
+        }
+        vga_putchar(c);
+    }
+    vga_batch_end();
+}
+
+// Função para exibir string
 void vga_puts(const char* str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        vga_putchar(str[i]);
+    int len = 0;
+    while (str[len] != '\0') {
+        len++;
+    }
+    vga_write(str, len);
+}
+
+// Pares "00".."99": cada divisão por 100 gera dois dígitos de uma vez
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Divide n (64 bits) por d (32 bits) com duas instruções divl, sem depender
+// do __udivdi3 da libgcc. Retorna o resto e deixa o quociente em n.
+static inline uint32_t div64_32(uint64_t* n, uint32_t d) {
+    uint32_t hi = (uint32_t)(*n >> 32);
+    uint32_t lo = (uint32_t)*n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    *n = ((uint64_t)q_hi << 32) | q_lo;
+    return r;
+}
+
+// Escreve n em decimal de trás para frente terminando em 'end'.
+// Retorna o início dos dígitos.
+static char* fmt_u32(char* end, uint32_t n) {
+    while (n >= 100) {
+        uint32_t q = n / 100;
+        uint32_t r = (n - q * 100) * 2;
+        end -= 2;
+        end[0] = digit_pairs[r];
+        end[1] = digit_pairs[r + 1];
+        n = q;
+    }
+    if (n >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[n * 2];
+        end[1] = digit_pairs[n * 2 + 1];
+    } else {
+        *--end = '0' + n;
+    }
+    return end;
+}
+
+static char* fmt_u64(char* end, uint64_t n) {
+    // Blocos de 8 dígitos enquanto o número não cabe em 32 bits
+    while (n >> 32) {
+        char* start = fmt_u32(end, div64_32(&n, 100000000));
+        end -= 8;
+        while (start > end) {
+            *--start = '0';
+        }
+    }
+    return fmt_u32(end, (uint32_t)n);
+}
+
+static char* fmt_hex(char* end, uint64_t n, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[n & 0xF];
+        n >>= 4;
+    } while (n);
+    return end;
+}
+
+// Buffer de saída do kprintf: tudo é formatado aqui e vai para a tela em um
+// único vga_write (ou em blocos, se passar de KPRINTF_BUFFER)
+typedef struct {
+    char buf[KPRINTF_BUFFER];
+    int len;
+} KprintfBuffer;
+
+#define FMT_LEFT 1      // '-': alinha à esquerda
+#define FMT_ZERO 2      // '0': completa com zeros
+
+static void kbuf_putc(KprintfBuffer* b, char c) {
+    // Não separa um escape de cor do seu dígito entre dois blocos
+    if (b->len == KPRINTF_BUFFER || (c == KC_ESCAPE && b->len == KPRINTF_BUFFER - 1)) {
+        vga_write(b->buf, b->len);
+        b->len = 0;
     }
+    b->buf[b->len++] = c;
 }
 
-void vga_putint(int num) {
-    if (num == 0) {
-        vga_putchar('0');
+// Emite um campo com largura mínima; o prefixo (sinal, "0x") vem antes dos zeros
+static void kbuf_field(KprintfBuffer* b, const char* prefix, const char* s, int len,
+                       int width, int flags) {
+    int pad = width - (int)len;
+    for (const char* p = prefix; *p; p++) {
+        pad--;
+    }
+    if (!(flags & (FMT_LEFT | FMT_ZERO))) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+    while (*prefix) {
+        kbuf_putc(b, *prefix++);
+    }
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        while (pad-- > 0) kbuf_putc(b, '0');
+    }
+    for (int i = 0; i < len; i++) {
+        kbuf_putc(b, s[i]);
+    }
+    if (flags & FMT_LEFT) {
+        while (pad-- > 0) kbuf_putc(b, ' ');
+    }
+}
+
+// printf do kernel: %d %u %x %X %p %s %c %%, com 'l'/'ll', largura, '-' e '0'
+void vkprintf(const char* fmt, va_list args) {
+    KprintfBuffer b;
+    char num[24];
+    b.len = 0;
+    
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        fmt++;
+        
+        int flags = 0;
+        int width = 0;
+        int longs = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FMT_LEFT;
+            else if (*fmt == '0') flags |= FMT_ZERO;
+            else break;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+        
+        char* end = num + sizeof(num);
+        char* start;
+        const char* prefix = "";
+        uint64_t value;
+        switch (*fmt) {
+        case 'd': {
+            int64_t v = longs >= 2 ? va_arg(args, long long)
+                      : longs ? va_arg(args, long) : va_arg(args, int);
+            if (v < 0) {
+                prefix = "-";
+                value = -(uint64_t)v;
+            } else {
+                value = v;
+            }
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        }
+        case 'u':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = (value >> 32) ? fmt_u64(end, value) : fmt_u32(end, (uint32_t)value);
+            break;
+        case 'x':
+        case 'X':
+            value = longs >= 2 ? va_arg(args, unsigned long long)
+                  : longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            start = fmt_hex(end, value, *fmt == 'X');
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void*);
+            start = fmt_hex(end, value, 0);
+            prefix = "0x";
+            flags |= FMT_ZERO;
+            width = 2 + 2 * sizeof(void*);
+            break;
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            int len = 0;
+            if (!str) {
+                str = "(null)";
+            }
+            while (str[len] != '\0') {
+                len++;
+            }
+            kbuf_field(&b, "", str, len, width, flags);
+            continue;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            kbuf_field(&b, "", &c, 1, width, flags);
+            continue;
+        }
+        case '\0':
+            fmt--;
+            continue;
+        default:
+            // '%%' vira '%'; conversão desconhecida é copiada como está
+            if (*fmt != '%') {
+                kbuf_putc(&b, '%');
+            }
+            kbuf_putc(&b, *fmt);
+            continue;
+        }
+        kbuf_field(&b, prefix, start, end - start, width, flags);
+    }
+    
+    if (b.len) {
+        vga_write(b.buf, b.len);
+    }
+}
+
+void kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vkprintf(fmt, args);
+    va_end(args);
+}
+
+// Nomes das exceções da CPU (vetores 0-31)
+static const char* const exception_names[32] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "BOUND Range Exceeded", "Invalid Opcode", "Device Not Available",
+    "Double Fault", "Coprocessor Segment Overrun", "Invalid TSS", "Segment Not Present",
+    "Stack-Segment Fault", "General Protection", "Page Fault", "Reserved",
+    "x87 Floating-Point", "Alignment Check", "Machine Check", "SIMD Floating-Point",
+    "Virtualization", "Control Protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security", "Reserved"
+};
+
+// Tela de pânico: mostra o motivo e os registradores (se houver frame) na tela e para a CPU
+void panic(const char* reason, InterruptFrame* frame) {
+    uint32_t cr0, cr2, cr3, cr4;
+    
+    __asm__ volatile("cli");
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    
+    // Escreve direto, sem lote
+    vga_batch_depth = 0;
+    vga_set_color(VGA_WHITE | (VGA_RED << 4));
+    vga_clear();
+    
+    kprintf("\n *** KERNEL PANIC: %s ***\n\n", reason);
+    if (frame) {
+        kprintf(" vetor %u  erro 0x%08x\n\n", frame->vector, frame->error);
+        kprintf(" EAX=%08x  EBX=%08x  ECX=%08x  EDX=%08x\n",
+                frame->eax, frame->ebx, frame->ecx, frame->edx);
+        // O pushal guarda o ESP já com EFLAGS, CS, EIP, erro e vetor (20 bytes)
+        kprintf(" ESI=%08x  EDI=%08x  EBP=%08x  ESP=%08x\n",
+                frame->esi, frame->edi, frame->ebp, frame->esp + 20);
+        kprintf(" EIP=%08x  EFLAGS=%08x  CS=%04x\n", frame->eip, frame->eflags, frame->cs);
+        kprintf(" DS=%04x  ES=%04x  FS=%04x  GS=%04x\n",
+                frame->ds, frame->es, frame->fs, frame->gs);
+    }
+    kprintf(" CR0=%08x  CR2=%08x  CR3=%08x  CR4=%08x\n\n", cr0, cr2, cr3, cr4);
+    kprintf(" Sistema parado.\n");
+    vga_flush();
+    
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+// Tarefa do double fault: o estado de quem falhou ficou salvo na TSS do kernel
+static void double_fault_task() {
+    InterruptFrame frame = {
+        .gs = tss.gs, .fs = tss.fs, .es = tss.es, .ds = tss.ds,
+        .edi = tss.edi, .esi = tss.esi, .ebp = tss.ebp, .esp = tss.esp - 20,    // panic soma os 20 de volta
+        .ebx = tss.ebx, .edx = tss.edx, .ecx = tss.ecx, .eax = tss.eax,
+        .vector = 8, .error = 0,
+        .eip = tss.eip, .cs = tss.cs, .eflags = tss.eflags
+    };
+    panic(exception_names[8], &frame);
+}
+
+// Ponto comum de todas as interrupções: IRQs levam o EOI antes do handler
+// (o IF continua desligado até o iret) e exceções sem handler viram pânico
+void interrupt_dispatch(InterruptFrame* frame) {
+    uint32_t vector = frame->vector;
+    InterruptHandler handler = interrupt_handlers[vector];
+    
+    if (vector >= IRQ_BASE) {
+        int irq = vector - IRQ_BASE;
+        
+        // IRQ 7/15 sem bit no ISR é espúria: não leva EOI (a 15 ainda deve um ao mestre)
+        if ((irq == 7 || irq == 15) && !pic_in_service(irq)) {
+            if (irq == 15) {
+                outb(PIC1_COMMAND, PIC_EOI);
+            }
+            return;
+        }
+        
+        pic_eoi(irq);
+        if (handler) {
+            handler(frame);
+        }
         return;
     }
     
-    if (num < 0) {
-        vga_putchar('-');
-        num = -num;
+    if (handler) {
+        handler(frame);
+        return;
+    }
+    panic(exception_names[vector], frame);
+}
+
+// Função para ler um registrador da CMOS (o índice e o dado precisam sair
+// juntos: quem chama fica com as interrupções desligadas se a IRQ8 estiver ativa)
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_INDEX, reg);
+    return inb(CMOS_DATA);
+}
+
+// Função para escrever um registrador da CMOS
+static void cmos_write(uint8_t reg, uint8_t val) {
+    outb(CMOS_INDEX, reg);
+    outb(CMOS_DATA, val);
+}
+
+static inline uint8_t bcd_to_bin(uint8_t val) {
+    return (val & 0x0F) + (val >> 4) * 10;
+}
+
+// Registradores lidos de uma vez, na ordem de rtc_read
+static const uint8_t rtc_regs[RTC_REG_COUNT] = {
+    RTC_SECONDS, RTC_MINUTES, RTC_HOURS, RTC_DAY, RTC_MONTH, RTC_YEAR, RTC_CENTURY
+};
+
+// Função para ler todos os registradores de data/hora fora de uma atualização
+static void rtc_read_raw(uint8_t* regs) {
+    while (cmos_read(RTC_STATUS_A) & RTC_A_UIP) {}
+    for (int i = 0; i < RTC_REG_COUNT; i++) {
+        regs[i] = cmos_read(rtc_regs[i]);
     }
+}
+
+// Dias desde 01/01/1970 (days_from_civil: sem tabela de meses nem laço)
+static uint32_t days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Função para converter segundos desde 1970 em data e hora (UTC)
+void epoch_to_datetime(uint32_t epoch, DateTime* dt) {
+    uint32_t days = epoch / 86400;
+    uint32_t secs = epoch % 86400;
     
-    char buffer[20];
-    int i = 0;
+    dt->hour = secs / 3600;
+    dt->minute = (secs / 60) % 60;
+    dt->second = secs % 60;
+    dt->weekday = (days + 4) % 7;       // 01/01/1970 foi uma quinta
+    
+    // civil_from_days: o inverso de days_from_civil
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    
+    dt->day = doy - (153 * mp + 2) / 5 + 1;
+    dt->month = mp < 10 ? mp + 3 : mp - 9;
+    dt->year = yoe + era * 400 + (dt->month <= 2);
+}
+
+// Função para ler a data e a hora da CMOS. Repete até duas leituras
+// seguidas baterem (uma atualização pode cair no meio) e converte BCD e o
+// modo de 12 horas. Devolve os segundos desde 1970.
+static uint32_t rtc_read() {
+    uint8_t regs[RTC_REG_COUNT];
+    uint8_t again[RTC_REG_COUNT];
+    int same;
+    
+    rtc_read_raw(again);
+    do {
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            regs[i] = again[i];
+        }
+        rtc_read_raw(again);
+        same = 1;
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            if (regs[i] != again[i]) {
+                same = 0;
+            }
+        }
+    } while (!same);
     
-    while (num > 0) {
-        buffer[i++] = '0' + (num % 10);
-        num /= 10;
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    int pm = regs[2] & RTC_HOUR_PM;
+    regs[2] &= ~RTC_HOUR_PM;
+    
+    if (!(status_b & RTC_B_BINARY)) {
+        for (int i = 0; i < RTC_REG_COUNT; i++) {
+            regs[i] = bcd_to_bin(regs[i]);
+        }
     }
     
-    for (int j = i - 1; j >= 0; j--) {
-        vga_putchar(buffer[j]);
+    // 12 AM é 0h e 12 PM é 12h
+    if (!(status_b & RTC_B_24H)) {
+        regs[2] %= 12;
+        if (pm) {
+            regs[2] += 12;
+        }
     }
+    
+    // O registrador de século não é padrão: sem um valor plausível, 20xx
+    uint32_t century = regs[6] >= 19 && regs[6] <= 21 ? regs[6] : 20;
+    uint32_t year = century * 100 + regs[5];
+    
+    return days_from_civil(year, regs[4], regs[3]) * 86400
+         + regs[2] * 3600 + regs[1] * 60 + regs[0];
 }
 
-// Funções de I/O
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
+// Nomes para o date no formato do Unix
+static const char* const weekday_names[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char* const month_names[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+// Handler da IRQ8: o RTC avisa o fim de cada atualização, ou seja, um
+// segundo. Ler o registrador C reconhece a IRQ.
+void rtc_irq(InterruptFrame* frame) {
+    (void)frame;
+    if (cmos_read(RTC_STATUS_C) & RTC_C_UF) {
+        rtc_seconds++;
+    }
 }
 
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+// Função para ler o RTC uma vez no boot e ligar a IRQ de fim de
+// atualização: a hora anda um segundo por IRQ8, sem voltar à CMOS.
+// Chamada antes do sti.
+void rtc_init() {
+    rtc_boot_epoch = rtc_read();
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    cmos_write(RTC_STATUS_B, status_b | RTC_B_UIE);
+    cmos_read(RTC_STATUS_C);
+    irq_install(RTC_IRQ, rtc_irq);
 }
 
 // Função para verificar se há tecla disponível
@@ -139,14 +1082,45 @@ char read_keyboard() {
 
 // Estrutura para comandos
 #define MAX_COMMAND_LENGTH 256
-#define MAX_ARGS 16
-#define MAX_HISTORY 50
+#define SHELL_ARENA_SIZE 4096       // Memória temporária de um comando
+#define ARENA_ALIGN 8
+#define HISTORY_SIZE 64             // Anel do histórico (potência de 2)
+
+// Arena de alocação por ponteiro: cada alocação só avança 'used' e tudo é
+// liberado de uma vez em arena_reset
+typedef struct {
+    uint8_t* base;
+    uint32_t size;
+    uint32_t used;
+    uint32_t high_water;        // Maior 'used' desde o boot
+    uint32_t last_used;         // 'used' do último comando, no reset
+    uint32_t resets;
+    uint32_t failures;          // Alocações que não couberam
+} Arena;
 
-char command_buffer[MAX_COMMAND_LENGTH];
-int command_pos = 0;
-char command_history[MAX_HISTORY][MAX_COMMAND_LENGTH];
-int history_pos = 0;
-int current_history = 0;
+// Editor de linha: o texto, o que já está desenhado na tela e a posição no histórico
+typedef struct {
+    char buf[MAX_COMMAND_LENGTH];
+    char shown[MAX_COMMAND_LENGTH];     // Células já desenhadas na tela
+    char saved[MAX_COMMAND_LENGTH];     // Linha nova guardada ao navegar no histórico
+    int len;
+    int cursor;
+    int shown_len;
+    int saved_len;
+    int start_x;                        // Onde a linha começa (logo depois do prompt)
+    int start_y;
+    uint32_t browse;                    // Entrada mostrada (history_count = linha nova)
+} LineEditor;
+
+KeyDecoder keyboard_decoder;    // Shift/Ctrl/Alt/Caps do teclado
+LineEditor line_editor;
+char history_ring[HISTORY_SIZE][MAX_COMMAND_LENGTH];
+int history_len[HISTORY_SIZE];
+uint32_t history_count = 0;     // Linhas gravadas desde o boot
+
+// Memória temporária dos comandos, zerada depois de cada execute_command
+uint8_t shell_arena_memory[SHELL_ARENA_SIZE];
+Arena shell_arena = { shell_arena_memory, SHELL_ARENA_SIZE, 0, 0, 0, 0, 0 };
 
 // Função para comparar strings
 int strcmp(const char* s1, const char* s2) {
@@ -176,43 +1150,257 @@ void strcpy(char* dest, const char* src) {
     *dest = '\0';
 }
 
-// Função para dividir comando em argumentos
-int parse_command(const char* command, char* args[]) {
-    int argc = 0;
+// Função para alocar 'size' bytes da arena (alinhados a ARENA_ALIGN).
+// Devolve NULL se não couber; não existe free, só arena_reset.
+void* arena_alloc(Arena* arena, uint32_t size) {
+    uint32_t offset = (arena->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    
+    if (offset > arena->size || size > arena->size - offset) {
+        arena->failures++;
+        return NULL;
+    }
+    arena->used = offset + size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return arena->base + offset;
+}
+
+// Função para liberar tudo que foi alocado na arena
+void arena_reset(Arena* arena) {
+    arena->last_used = arena->used;
+    arena->used = 0;
+    arena->resets++;
+}
+
+// Espaço ou tab separa argumentos
+static inline int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Função para dividir comando em argumentos. As palavras e o vetor args
+// (terminado em NULL) são copiados para a arena, então a linha não é
+// alterada e o número de argumentos só é limitado pela arena.
+char** parse_command(Arena* arena, const char* command, int* argc) {
+    int count = 0;
+    
+    for (int i = 0; command[i] != '\0'; i++) {
+        if (!is_blank(command[i]) && (i == 0 || is_blank(command[i - 1]))) {
+            count++;
+        }
+    }
+    
+    *argc = 0;
+    char** args = arena_alloc(arena, (count + 1) * sizeof(char*));
+    if (!args) {
+        return NULL;
+    }
+    
     int i = 0;
-    int start = 0;
-    
-    while (command[i] != '\0' && argc < MAX_ARGS - 1) {
-        if (command[i] == ' ' || command[i] == '\t') {
-            if (i > start) {
-                command[i] = '\0';
-                args[argc++] = (char*)&command[start];
-                start = i + 1;
-            }
+    while (command[i] != '\0') {
+        if (is_blank(command[i])) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (command[i] != '\0' && !is_blank(command[i])) {
+            i++;
         }
-        i++;
+        char* word = arena_alloc(arena, i - start + 1);
+        if (!word) {
+            break;
+        }
+        for (int j = 0; j < i - start; j++) {
+            word[j] = command[start + j];
+        }
+        word[i - start] = '\0';
+        args[(*argc)++] = word;
     }
     
-    if (i > start) {
-        args[argc++] = (char*)&command[start];
+    args[*argc] = NULL;
+    return args;
+}
+
+// Função para gravar uma linha no anel do histórico (O(1): a mais antiga é
+// sobrescrita quando o anel enche)
+void history_add(const char* line, int len) {
+    if (len == 0) {
+        return;
+    }
+    int slot = history_count & (HISTORY_SIZE - 1);
+    for (int i = 0; i < len; i++) {
+        history_ring[slot][i] = line[i];
+    }
+    history_ring[slot][len] = '\0';
+    history_len[slot] = len;
+    history_count++;
+}
+
+// Índice da entrada mais antiga ainda guardada no anel
+static inline uint32_t history_oldest() {
+    return history_count > HISTORY_SIZE ? history_count - HISTORY_SIZE : 0;
+}
+
+// Converte uma posição da linha em coluna/linha da tela
+static inline void line_cell(LineEditor* le, int pos, int* x, int* y) {
+    int offset = le->start_x + pos;
+    *x = offset % VGA_WIDTH;
+    *y = le->start_y + offset / VGA_WIDTH;
+}
+
+// Função para começar uma linha nova logo depois do prompt
+void line_begin(LineEditor* le) {
+    le->len = 0;
+    le->cursor = 0;
+    le->shown_len = 0;
+    le->start_x = vga_x;
+    le->start_y = vga_y;
+    le->browse = history_count;
+}
+
+// Redesenha a linha comparando com o que já está na tela: só as células que
+// mudaram são escritas (e marcadas sujas), depois o cursor vai para o lugar
+void line_refresh(LineEditor* le) {
+    int end = le->len > le->shown_len ? le->len : le->shown_len;
+    int x, y;
+    
+    // Garante que a linha inteira (e o cursor no fim) cabe na tela
+    line_cell(le, end, &x, &y);
+    while (y >= VGA_HEIGHT) {
+        vga_scroll();
+        le->start_y--;
+        y--;
     }
     
-    args[argc] = NULL;
-    return argc;
+    for (int i = 0; i < end; i++) {
+        char c = i < le->len ? le->buf[i] : ' ';
+        if (i < le->shown_len && le->shown[i] == c) {
+            continue;
+        }
+        line_cell(le, i, &x, &y);
+        vga_shadow[(vga_origin + y) * VGA_WIDTH + x] = (uint16_t)c | (uint16_t)vga_color << 8;
+        vga_mark_dirty(y, x, x + 1);
+        le->shown[i] = c;
+    }
+    le->shown_len = le->len;
+    
+    line_cell(le, le->cursor, &vga_x, &vga_y);
+}
+
+// Troca o conteúdo da linha (histórico); o cursor vai para o fim
+static void line_set(LineEditor* le, const char* text, int len) {
+    for (int i = 0; i < len; i++) {
+        le->buf[i] = text[i];
+    }
+    le->len = len;
+    le->cursor = len;
+}
+
+// Função para aplicar uma tecla à linha. Retorna 1 quando Enter termina a
+// linha (le->buf fica com o '\0' no fim).
+int line_edit(LineEditor* le, uint8_t key) {
+    switch (key) {
+    case '\n':
+        le->cursor = le->len;
+        line_refresh(le);
+        le->buf[le->len] = '\0';
+        return 1;
+    
+    case '\b':
+        if (le->cursor == 0) {
+            return 0;
+        }
+        le->cursor--;
+        // fallthrough
+    case KEY_DELETE:
+        if (le->cursor < le->len) {
+            for (int i = le->cursor; i < le->len - 1; i++) {
+                le->buf[i] = le->buf[i + 1];
+            }
+            le->len--;
+        }
+        break;
+    
+    case KEY_LEFT:
+        if (le->cursor > 0) le->cursor--;
+        break;
+    case KEY_RIGHT:
+        if (le->cursor < le->len) le->cursor++;
+        break;
+    case KEY_HOME:
+    case CTRL('A'):
+        le->cursor = 0;
+        break;
+    case KEY_END:
+    case CTRL('E'):
+        le->cursor = le->len;
+        break;
+    
+    case CTRL('K'):
+        // Apaga do cursor até o fim
+        le->len = le->cursor;
+        break;
+    case CTRL('U'):
+        // Apaga do início até o cursor
+        for (int i = le->cursor; i < le->len; i++) {
+            le->buf[i - le->cursor] = le->buf[i];
+        }
+        le->len -= le->cursor;
+        le->cursor = 0;
+        break;
+    
+    case KEY_UP:
+        if (le->browse == history_oldest()) {
+            return 0;
+        }
+        // Guarda a linha nova antes de sair dela
+        if (le->browse == history_count) {
+            for (int i = 0; i < le->len; i++) {
+                le->saved[i] = le->buf[i];
+            }
+            le->saved_len = le->len;
+        }
+        le->browse--;
+        line_set(le, history_ring[le->browse & (HISTORY_SIZE - 1)],
+                 history_len[le->browse & (HISTORY_SIZE - 1)]);
+        break;
+    case KEY_DOWN:
+        if (le->browse == history_count) {
+            return 0;
+        }
+        le->browse++;
+        if (le->browse == history_count) {
+            line_set(le, le->saved, le->saved_len);
+        } else {
+            line_set(le, history_ring[le->browse & (HISTORY_SIZE - 1)],
+                     history_len[le->browse & (HISTORY_SIZE - 1)]);
+        }
+        break;
+    
+    default:
+        // Só texto entra na linha (Fn, ESC e outros Ctrl são ignorados)
+        if ((key < ' ' && key != '\t') || key >= 0x7F || le->len >= MAX_COMMAND_LENGTH - 1) {
+            return 0;
+        }
+        for (int i = le->len; i > le->cursor; i--) {
+            le->buf[i] = le->buf[i - 1];
+        }
+        le->buf[le->cursor++] = key;
+        le->len++;
+        break;
+    }
+    
+    line_refresh(le);
+    return 0;
 }
 
 // Função para executar comandos
 void execute_command(const char* command) {
-    char* args[MAX_ARGS];
-    int argc = parse_command(command, args);
+    int argc;
+    char** args = parse_command(&shell_arena, command, &argc);
     
     if (argc == 0) return;
     
-    // Adiciona ao histórico
-    if (history_pos < MAX_HISTORY) {
-        strcpy(command_history[history_pos++], command);
-    }
-    
     // Comandos básicos
     if (strcmp(args[0], "help") == 0) {
         vga_puts("Comandos disponíveis:\n");
@@ -221,18 +1409,15 @@ void execute_command(const char* command) {
         vga_puts("  ls       - Lista arquivos (simulado)\n");
         vga_puts("  pwd      - Mostra diretório atual\n");
         vga_puts("  echo     - Exibe texto\n");
-        vga_puts("  date     - Mostra data/hora (simulado)\n");
+        vga_puts("  date     - Mostra data/hora (RTC, UTC)\n");
         vga_puts("  whoami   - Mostra usuário atual\n");
         vga_puts("  uname    - Informações do sistema\n");
         vga_puts("  history  - Mostra histórico de comandos\n");
+        vga_puts("  stats    - Mostra o uso da arena do shell\n");
         vga_puts("  exit     - Sai do shell\n");
     }
     else if (strcmp(args[0], "clear") == 0) {
         vga_clear();
-        vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
-        vga_puts("kernel> ");
-        vga_set_color(vga_color);
-        vga_x = 8;
     }
     else if (strcmp(args[0], "ls") == 0) {
         vga_puts("Arquivos do sistema:\n");
@@ -253,7 +1438,11 @@ void execute_command(const char* command) {
         vga_putchar('\n');
     }
     else if (strcmp(args[0], "date") == 0) {
-        vga_puts("Wed Aug 13 16:15:00 BRT 2025\n");
+        DateTime dt;
+        epoch_to_datetime(rtc_boot_epoch + rtc_seconds, &dt);
+        kprintf("%s %s %2u %02u:%02u:%02u UTC %u\n",
+                weekday_names[dt.weekday], month_names[dt.month - 1], dt.day,
+                dt.hour, dt.minute, dt.second, dt.year);
     }
     else if (strcmp(args[0], "whoami") == 0) {
         vga_puts("cayazita\n");
@@ -263,13 +1452,18 @@ void execute_command(const char* command) {
     }
     else if (strcmp(args[0], "history") == 0) {
         vga_puts("Histórico de comandos:\n");
-        for (int i = 0; i < history_pos; i++) {
-            vga_putint(i + 1);
-            vga_puts("  ");
-            vga_puts(command_history[i]);
-            vga_putchar('\n');
+        for (uint32_t i = history_oldest(); i < history_count; i++) {
+            kprintf("%3u  %s\n", i + 1, history_ring[i & (HISTORY_SIZE - 1)]);
         }
     }
+    else if (strcmp(args[0], "stats") == 0) {
+        // O próprio stats ainda está na arena: 'último' é o comando anterior
+        kprintf("Arena do shell: %u bytes\n", shell_arena.size);
+        kprintf("  último comando: %u bytes\n", shell_arena.last_used);
+        kprintf("  pico:           %u bytes (%u%%)\n", shell_arena.high_water,
+                shell_arena.high_water * 100 / shell_arena.size);
+        kprintf("  comandos: %u  falhas: %u\n", shell_arena.resets, shell_arena.failures);
+    }
     else if (strcmp(args[0], "exit") == 0) {
         vga_puts("Saindo do shell...\n");
         // Aqui você pode implementar saída real
@@ -283,6 +1477,16 @@ void execute_command(const char* command) {
 
 // Função principal do kernel
 void kernel_main() {
+    // GDT/TSS e IDT primeiro: daqui em diante uma falha vira tela de pânico.
+    // O teclado continua por polling; só a IRQ8 do RTC é liberada.
+    gdt_init();
+    interrupts_init();
+    rtc_init();
+    __asm__ volatile("sti");
+    
+    // Banner inteiro sai em um único flush
+    vga_batch_begin();
+    
     // Limpa a tela
     vga_clear();
     
@@ -299,8 +1503,9 @@ void kernel_main() {
     vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
     vga_puts("kernel> ");
     vga_set_color(vga_color);
-    // Cursor fica na frente do prompt
-    vga_x = 8; // "kernel> " tem 8 caracteres
+    line_begin(&line_editor);
+    
+    vga_batch_end();
     
     // Loop principal ultra-simples
     int frame_counter = 0;
@@ -319,9 +1524,7 @@ void kernel_main() {
             vga_y = 0;
             
             // Mostra contador
-            vga_set_color(VGA_LIGHT_RED | (VGA_BLACK << 4));
-            vga_puts("FRAME:");
-            vga_putint(frame_counter / 10);
+            kprintf(KC_LIGHT_RED "FRAME:%d", frame_counter / 10);
             
             // Restaura posição
             vga_x = old_x;
@@ -331,86 +1534,29 @@ void kernel_main() {
         
         // Verifica teclado
         if (keyboard_available()) {
-            char key = read_keyboard();
+            uint8_t key = key_decode(&keyboard_decoder, read_keyboard());
             
-            // Converte para caractere se possível
-            if (key >= 0x02 && key <= 0x0D) {
-                char ch = "1234567890-="[key - 0x02];
-                vga_putchar(ch);
-            }
-            else if (key >= 0x10 && key <= 0x1B) {
-                char ch = "qwertyuiop[]"[key - 0x10];
-                vga_putchar(ch);
-            }
-            else if (key >= 0x1E && key <= 0x28) {
-                char ch = "asdfghjkl;'"[key - 0x1E];
-                vga_putchar(ch);
-            }
-            else if (key >= 0x2C && key <= 0x35) {
-                char ch = "zxcvbnm,./"[key - 0x2C];
-                vga_putchar(ch);
-            }
-            else if (key == 0x39) {
-                vga_putchar(' ');
-            }
-            else if (key == 0x1C) { // Enter
+            if (line_edit(&line_editor, key)) {
                 vga_putchar('\n');
-                // Executa o comando
-                command_buffer[command_pos] = '\0';
-                execute_command(command_buffer);
-                // Reseta buffer e posição
-                command_pos = 0;
+                history_add(line_editor.buf, line_editor.len);
+                vga_batch_begin();
+                execute_command(line_editor.buf);
+                arena_reset(&shell_arena);
+                vga_batch_end();
                 // Mostra novo prompt
                 vga_set_color(VGA_LIGHT_YELLOW | (VGA_BLACK << 4));
                 vga_puts("kernel> ");
                 vga_set_color(vga_color);
-                // Cursor fica na frente do prompt
-                vga_x = 8; // "kernel> " tem 8 caracteres
-            }
-            else if (key == 0x0E) { // Backspace
-                if (vga_x > 0) {
-                    vga_x--;
-                    vga_putchar('\b');
-                    vga_putchar(' ');
-                    vga_putchar('\b');
-                }
-            }
-            else if (key == 0x0F) { // Tab
-                vga_putchar('\t');
-            }
-            else if (key == 0x1A) { // [
-                vga_putchar('[');
-            }
-            else if (key == 0x1B) { // ]
-                vga_putchar(']');
-            }
-            else if (key == 0x27) { // ;
-                vga_putchar(';');
-            }
-            else if (key == 0x28) { // '
-                vga_putchar('\'');
-            }
-            else if (key == 0x33) { // ,
-                vga_putchar(',');
-            }
-            else if (key == 0x34) { // .
-                vga_putchar('.');
-            }
-            else if (key == 0x35) { // /
-                vga_putchar('/');
-            }
-            else if (key == 0x0B) { // 0
-                vga_putchar('0');
-            }
-            else if (key == 0x0C) { // -
-                vga_putchar('-');
-            }
-            else if (key == 0x0D) { // =
-                vga_putchar('=');
+                line_begin(&line_editor);
             }
         }
         
         // Pausa mínima
         for (volatile int i = 0; i < 1; i++) {}
+        
+        // Leva o eco das teclas e o contador para a tela
+        if (vga_dirty_rows) {
+            vga_flush();
+        }
     }
 }
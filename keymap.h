@@ -0,0 +1,109 @@
+// Decodificador do scancode set 1 (teclado US), compartilhado pelos kernels
+// kernel_grub.c, kernel_bash.c e kernel_simple.c e pelo teste keymap_test.c
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+
+// Teclas devolvidas pelo decodificador de scancodes: ASCII abaixo de 0x80,
+// teclas especiais a partir de 0x80 e modificadores a partir de 0xF0
+#define KEY_UP 0x80
+#define KEY_DOWN 0x81
+#define KEY_LEFT 0x82
+#define KEY_RIGHT 0x83
+#define KEY_HOME 0x84
+#define KEY_END 0x85
+#define KEY_PAGE_UP 0x86
+#define KEY_PAGE_DOWN 0x87
+#define KEY_INSERT 0x88
+#define KEY_DELETE 0x89
+#define KEY_F1 0x90
+#define KEY_F2 0x91
+#define KEY_F3 0x92
+#define KEY_F4 0x93
+#define KEY_F5 0x94
+#define KEY_F6 0x95
+#define KEY_F7 0x96
+#define KEY_F8 0x97
+#define KEY_F9 0x98
+#define KEY_F10 0x99
+#define KEY_F11 0x9A
+#define KEY_F12 0x9B
+#define KEY_LSHIFT 0xF0
+#define KEY_RSHIFT 0xF1
+#define KEY_CAPS 0xF2
+#define KEY_CTRL 0xF3
+#define KEY_ALT 0xF4
+
+// Bits de modificador: o bit de cada um é (KEY_x - 0xF0). Os três primeiros
+// escolhem a tabela de tradução.
+#define MOD_LSHIFT 0x01
+#define MOD_RSHIFT 0x02
+#define MOD_CAPS 0x04
+#define MOD_CTRL 0x08
+#define MOD_ALT 0x10
+
+#define SCANCODE_EXTENDED 0xE0
+#define SCANCODE_RELEASE 0x80
+
+// Caractere de controle de Ctrl+letra (como o key_decode devolve)
+#define CTRL(c) ((c) & 0x1F)
+
+// Estado do decodificador de scancodes
+typedef struct {
+    uint8_t extended;                   // Último scancode foi o prefixo 0xE0
+    uint8_t mods;                       // MOD_x dos modificadores pressionados
+} KeyDecoder;
+
+// Tabelas de tradução do scancode set 1 (teclado US), uma posição por make
+// code: traduzir uma tecla é uma leitura de tabela. São geradas no build
+// por keymap_gen.c a partir da lista de teclas.
+#include "keymap_tables.h"
+
+// Tabela por combinação de Shift esquerdo, Shift direito e Caps Lock
+static const uint8_t* const keymap_select[8] = {
+    keymap_normal, keymap_shift, keymap_shift, keymap_shift,
+    keymap_caps, keymap_caps_shift, keymap_caps_shift, keymap_caps_shift
+};
+
+// Função para traduzir um scancode (set 1). Devolve o caractere ou KEY_x da
+// tecla pressionada, ou 0 quando o scancode só muda o estado (prefixo 0xE0,
+// modificadores, teclas soltas). Não faz I/O: só depende de 'decoder'.
+static uint8_t key_decode(KeyDecoder* decoder, uint8_t scancode) {
+    if (scancode == SCANCODE_EXTENDED) {
+        decoder->extended = 1;
+        return 0;
+    }
+    
+    uint8_t code = scancode & ~SCANCODE_RELEASE;
+    uint8_t key = decoder->extended ? keymap_extended[code]
+                                    : keymap_select[decoder->mods & 7][code];
+    decoder->extended = 0;
+    
+    if (key >= KEY_LSHIFT) {
+        uint8_t bit = 1 << (key - KEY_LSHIFT);
+        if (key == KEY_CAPS) {
+            // Caps Lock alterna ao pressionar
+            if (!(scancode & SCANCODE_RELEASE)) {
+                decoder->mods ^= bit;
+            }
+        } else if (scancode & SCANCODE_RELEASE) {
+            decoder->mods &= ~bit;
+        } else {
+            decoder->mods |= bit;
+        }
+        return 0;
+    }
+    
+    if (scancode & SCANCODE_RELEASE) {
+        return 0;
+    }
+    
+    // Ctrl+letra vira o caractere de controle (Ctrl-A = 1 ... Ctrl-Z = 26)
+    if ((decoder->mods & MOD_CTRL) && ((key | 0x20) >= 'a' && (key | 0x20) <= 'z')) {
+        return key & 0x1F;
+    }
+    return key;
+}
+
+#endif
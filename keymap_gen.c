@@ -0,0 +1,143 @@
+// Gerador das tabelas do scancode set 1 (keymap_tables.h), roda no host:
+// make -f Makefile_grub keymap_tables.h
+// As quatro tabelas de Shift/Caps Lock saem de uma lista de teclas com os
+// caracteres sem e com Shift; Caps Lock só troca a caixa das letras.
+#include <stdio.h>
+#include <string.h>
+
+#define KEYMAP_SIZE 128
+
+// Teclas de caractere em sequência de make codes: um caractere por tecla
+typedef struct {
+    unsigned char code;                 // Make code do primeiro caractere
+    const char* normal;                 // Sem modificador
+    const char* shift;                  // Com Shift
+} KeyRun;
+
+// Tecla com o mesmo valor em todas as tabelas (nome de KEY_x ou literal)
+typedef struct {
+    unsigned char code;
+    const char* value;
+} KeyName;
+
+static const KeyRun key_runs[] = {
+    { 0x01, "\033", "\033" },
+    { 0x02, "1234567890-=\b\t", "!@#$%^&*()_+\b\t" },
+    { 0x10, "qwertyuiop[]\n", "QWERTYUIOP{}\n" },
+    { 0x1E, "asdfghjkl;'`", "ASDFGHJKL:\"~" },
+    { 0x2B, "\\zxcvbnm,./", "|ZXCVBNM<>?" },
+    { 0x37, "*", "*" },
+    { 0x39, " ", " " },
+    { 0x47, "789-456+1230.", "789-456+1230." },         // Teclado numérico
+};
+
+static const KeyName key_names[] = {
+    { 0x1D, "KEY_CTRL" }, { 0x2A, "KEY_LSHIFT" }, { 0x36, "KEY_RSHIFT" },
+    { 0x38, "KEY_ALT" }, { 0x3A, "KEY_CAPS" },
+    { 0x3B, "KEY_F1" }, { 0x3C, "KEY_F2" }, { 0x3D, "KEY_F3" }, { 0x3E, "KEY_F4" },
+    { 0x3F, "KEY_F5" }, { 0x40, "KEY_F6" }, { 0x41, "KEY_F7" }, { 0x42, "KEY_F8" },
+    { 0x43, "KEY_F9" }, { 0x44, "KEY_F10" }, { 0x57, "KEY_F11" }, { 0x58, "KEY_F12" },
+};
+
+// Depois do prefixo 0xE0
+static const KeyName key_extended[] = {
+    { 0x1C, "'\\n'" }, { 0x1D, "KEY_CTRL" }, { 0x35, "'/'" }, { 0x38, "KEY_ALT" },
+    { 0x47, "KEY_HOME" }, { 0x48, "KEY_UP" }, { 0x49, "KEY_PAGE_UP" },
+    { 0x4B, "KEY_LEFT" }, { 0x4D, "KEY_RIGHT" }, { 0x4F, "KEY_END" },
+    { 0x50, "KEY_DOWN" }, { 0x51, "KEY_PAGE_DOWN" }, { 0x52, "KEY_INSERT" },
+    { 0x53, "KEY_DELETE" },
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+// Uma tabela em texto: cada posição é "0", um literal ou um KEY_x
+static char cells[KEYMAP_SIZE][16];
+
+// Função para escrever um caractere como literal C (ou número, sem literal)
+static void cell_char(int code, unsigned char c) {
+    switch (c) {
+    case '\b': strcpy(cells[code], "'\\b'"); break;
+    case '\t': strcpy(cells[code], "'\\t'"); break;
+    case '\n': strcpy(cells[code], "'\\n'"); break;
+    case '\'': strcpy(cells[code], "'\\''"); break;
+    case '\\': strcpy(cells[code], "'\\\\'"); break;
+    default:
+        if (c >= ' ' && c < 0x7F) {
+            sprintf(cells[code], "'%c'", c);
+        } else {
+            sprintf(cells[code], "%d", c);
+        }
+    }
+}
+
+// Função para trocar a caixa de uma letra (o que o Caps Lock faz)
+static unsigned char swap_case(unsigned char c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 'A';
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 'a';
+    }
+    return c;
+}
+
+// Função para montar uma das quatro tabelas de caracteres
+static void build(int shift, int caps) {
+    for (int i = 0; i < KEYMAP_SIZE; i++) {
+        strcpy(cells[i], "0");
+    }
+    for (unsigned i = 0; i < COUNT(key_runs); i++) {
+        const char* chars = shift ? key_runs[i].shift : key_runs[i].normal;
+        for (int j = 0; chars[j]; j++) {
+            unsigned char c = chars[j];
+            cell_char(key_runs[i].code + j, caps ? swap_case(c) : c);
+        }
+    }
+    for (unsigned i = 0; i < COUNT(key_names); i++) {
+        strcpy(cells[key_names[i].code], key_names[i].value);
+    }
+}
+
+// Função para imprimir a tabela montada, oito posições por linha, até a
+// última linha que tem alguma tecla
+static void emit(const char* comment, const char* name) {
+    int last = 0;
+    for (int i = 0; i < KEYMAP_SIZE; i++) {
+        if (strcmp(cells[i], "0") != 0) {
+            last = i;
+        }
+    }
+
+    printf("\n// %s\nstatic const uint8_t %s[%d] = {\n", comment, name, KEYMAP_SIZE);
+    for (int row = 0; row <= last; row += 8) {
+        char line[128] = "";
+        for (int i = row; i < row + 8; i++) {
+            strcat(line, cells[i]);
+            strcat(line, i < row + 7 ? ", " : ",");
+        }
+        printf("    %-65s// 0x%02X\n", line, row);
+    }
+    printf("};\n");
+}
+
+int main(void) {
+    printf("// Gerado por keymap_gen.c: não editar\n");
+
+    build(0, 0);
+    emit("Teclas sem modificador", "keymap_normal");
+    build(1, 0);
+    emit("Com Shift", "keymap_shift");
+    build(0, 1);
+    emit("Com Caps Lock (só as letras mudam)", "keymap_caps");
+    build(1, 1);
+    emit("Com Caps Lock e Shift (letras voltam a minúsculas)", "keymap_caps_shift");
+
+    for (int i = 0; i < KEYMAP_SIZE; i++) {
+        strcpy(cells[i], "0");
+    }
+    for (unsigned i = 0; i < COUNT(key_extended); i++) {
+        strcpy(cells[key_extended[i].code], key_extended[i].value);
+    }
+    emit("Depois do prefixo 0xE0", "keymap_extended");
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Teste do decodificador de scancodes (keymap.h), compilado para o host:
+// make -f Makefile_grub test
+#include <stdio.h>
+#include "keymap.h"
+
+static int failures = 0;
+
+// Função para passar uma sequência de scancodes pelo decodificador e comparar
+// cada tecla devolvida com a esperada
+static void check(const char* name, KeyDecoder* decoder, const uint8_t* codes,
+                  const uint8_t* expected, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8_t key = key_decode(decoder, codes[i]);
+        if (key != expected[i]) {
+            printf("FALHOU %s: scancode %d (0x%02X) deu 0x%02X, esperado 0x%02X\n",
+                   name, i, codes[i], key, expected[i]);
+            failures++;
+            return;
+        }
+    }
+    printf("ok     %s\n", name);
+}
+
+#define CHECK(name, decoder, codes, expected) \
+    check(name, decoder, codes, expected, (int)(sizeof(codes) / sizeof(codes[0])))
+
+int main(void) {
+    KeyDecoder decoder = { 0, 0 };
+
+    // 'a' solto e 'a' com Shift esquerdo (2A ... AA) e direito (36 ... B6)
+    const uint8_t shift_codes[] = { 0x1E, 0x9E, 0x2A, 0x1E, 0x02, 0x9E, 0xAA, 0x1E,
+                                    0x36, 0x30, 0xB6, 0x30 };
+    const uint8_t shift_keys[]  = { 'a', 0, 0, 'A', '!', 0, 0, 'a',
+                                    0, 'B', 0, 'b' };
+    CHECK("shift", &decoder, shift_codes, shift_keys);
+
+    // Caps Lock alterna ao pressionar, só vale para letras e se inverte com Shift
+    const uint8_t caps_codes[] = { 0x3A, 0xBA, 0x1E, 0x02, 0x2A, 0x1E, 0x02, 0xAA,
+                                   0x3A, 0xBA, 0x1E };
+    const uint8_t caps_keys[]  = { 0, 0, 'A', '1', 0, 'a', '!', 0,
+                                   0, 0, 'a' };
+    CHECK("caps", &decoder, caps_codes, caps_keys);
+
+    // Setas e teclas de edição com o prefixo E0 (make e break)
+    const uint8_t arrow_codes[] = { 0xE0, 0x48, 0xE0, 0xC8, 0xE0, 0x50, 0xE0, 0x4B,
+                                    0xE0, 0x4D, 0xE0, 0x47, 0xE0, 0x53, 0x48 };
+    const uint8_t arrow_keys[]  = { 0, KEY_UP, 0, 0, 0, KEY_DOWN, 0, KEY_LEFT,
+                                    0, KEY_RIGHT, 0, KEY_HOME, 0, KEY_DELETE, '8' };
+    CHECK("e0 setas", &decoder, arrow_codes, arrow_keys);
+
+    // Shift falso E0 2A / E0 AA que o teclado manda em volta das setas:
+    // ignorado, sem mexer nos modificadores
+    const uint8_t fake_codes[] = { 0xE0, 0x2A, 0xE0, 0x48, 0xE0, 0xC8, 0xE0, 0xAA, 0x1E };
+    const uint8_t fake_keys[]  = { 0, 0, 0, KEY_UP, 0, 0, 0, 0, 'a' };
+    CHECK("e0 2a shift falso", &decoder, fake_codes, fake_keys);
+    if (decoder.mods != 0) {
+        printf("FALHOU e0 2a shift falso: mods = 0x%02X\n", decoder.mods);
+        failures++;
+    }
+
+    // Teclas soltas (break codes) nunca produzem caractere
+    const uint8_t break_codes[] = { 0x9E, 0x82, 0x9C, 0xB9, 0xBB, 0x81 };
+    const uint8_t break_keys[]  = { 0, 0, 0, 0, 0, 0 };
+    CHECK("break", &decoder, break_codes, break_keys);
+
+    // Ctrl+letra (esquerdo 1D e direito E0 1D) vira caractere de controle;
+    // Ctrl com dígito não muda a tecla
+    const uint8_t ctrl_codes[] = { 0x1D, 0x1E, 0x12, 0x02, 0x9D, 0x1E,
+                                   0xE0, 0x1D, 0x2A, 0x16, 0xAA, 0xE0, 0x9D, 0x16 };
+    const uint8_t ctrl_keys[]  = { 0, CTRL('A'), CTRL('E'), '1', 0, 'a',
+                                   0, 0, 0, CTRL('U'), 0, 0, 0, 'u' };
+    CHECK("ctrl+letra", &decoder, ctrl_codes, ctrl_keys);
+
+    if (failures) {
+        printf("%d teste(s) falharam\n", failures);
+        return 1;
+    }
+    printf("todos os testes passaram\n");
+    return 0;
+}